@@ -364,10 +364,11 @@ static const std::map<std::string,
         }},
 
         {"cmpx", [](isa::Emitter& e, const SymbolTable& symtab, const ast::Instruction& i) {
-            e.fa(i.operands[0].asRegIdx(), i.operands[1].asRegIdx(), i.operands[2].asBitsImm<15>());
+            e.cmpx(i.operands[0].asRegIdx(), i.operands[1].asRegIdx(), i.operands[2].asRegIdx());
         }},
         {"fa", [](isa::Emitter& e, const SymbolTable& symtab, const ast::Instruction& i) {
-            e.cmpx(i.operands[0].asRegIdx(), i.operands[1].asRegIdx(), i.operands[2].asRegIdx());
+            // the immediate is signed, so it can count down too
+            e.fa(i.operands[0].asRegIdx(), i.operands[1].asRegIdx(), i.operands[2].asSignedImm<15>().asUnsigned());
         }},
 
         {"flushicache",
@@ -36,6 +36,11 @@ int main(int argc, char* argv[]) {
         .default_value(false)
         .implicit_value(true);
 
+    ap.add_argument("--symbols")
+        .help("also write the address of every label to a sidecar file, "
+              "for sim to name functions by")
+        .metavar("SYMFILE");
+
     ap.add_argument("source");
 
     try {
@@ -123,4 +128,13 @@ int main(int argc, char* argv[]) {
             fOut.write(v, sizeof(v));
         }
     }
+
+    if (auto path = ap.present<std::string>("--symbols")) {
+        std::ofstream fSyms(*path);
+        if (!fSyms.is_open()) {
+            std::cerr << "[!] cant open " << *path << std::endl;
+            std::exit(1);
+        }
+        labelPass.getSymtab().writeSidecar(fSyms);
+    }
 }
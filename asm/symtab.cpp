@@ -1,5 +1,21 @@
 #include "symtab.h"
 
+#include <algorithm>
+#include <vector>
+
+void SymbolTable::writeSidecar(std::ostream& os) const {
+    std::vector<const Symbol*> byAddr;
+    for (const auto& p : table)
+        byAddr.push_back(&p.second);
+    // stable: labels sharing an address stay in name order
+    std::stable_sort(byAddr.begin(), byAddr.end(),
+                     [](const Symbol* a, const Symbol* b) {
+                         return a->addr < b->addr;
+                     });
+    for (const auto* sym : byAddr)
+        fmt::print(os, "{:#x} {}\n", sym->addr, sym->ident);
+}
+
 void LabelVisitor::enter(const ast::LabelDecl& ld, size_t depth) {
     auto ident = ld.ident.getLexeme();
     std::string canonicalIdent = std::string(ident);
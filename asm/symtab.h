@@ -3,7 +3,10 @@
 #include <compare>
 #include <cstdint>
 #include <map>
+#include <optional>
 #include <ostream>
+#include <string>
+#include <string_view>
 
 #include <fmt/core.h>
 #include <fmt/ostream.h>
@@ -50,6 +53,13 @@ class SymbolTable {
     }
     void insert(Symbol&& sym) { table.insert({sym.ident, sym}); }
 
+    /**
+     * The symbol sidecar: one `ADDR NAME` line per symbol, ADDR in 0x hex,
+     * in address order. Local labels are spelled `parent.local`. sim reads
+     * this to name functions (see docs/profile.md).
+     */
+    void writeSidecar(std::ostream& os) const;
+
     friend std::ostream& operator<<(std::ostream& os,
                                     const SymbolTable& table) {
         os << "symbol table\n"
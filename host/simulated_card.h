@@ -0,0 +1,378 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fmt/core.h>
+
+#include "card.h"
+
+/// a DMA transfer started on the card, to check on; later ones are bigger
+using dma_handle_t = uint64_t;
+
+struct Accelerator {
+    virtual ~Accelerator() = default;
+
+    virtual void copyToCard(uint32_t* hostSrc, uint64_t cardDst,
+                            uint64_t len) = 0;
+    virtual void copyFromCard(uint32_t* hostDst, uint64_t cardSrc,
+                              uint64_t len) = 0;
+
+    /**
+     * Start copies like copyToCard() and copyFromCard(), and return without
+     * waiting for them. Transfers finish in the order they're started, after
+     * any started before them, and the host buffer has to be left alone until
+     * they have.
+     */
+    virtual auto startCopyToCard(uint32_t* hostSrc, uint64_t cardDst,
+                                 uint64_t len) -> dma_handle_t = 0;
+    virtual auto startCopyFromCard(uint32_t* hostDst, uint64_t cardSrc,
+                                   uint64_t len) -> dma_handle_t = 0;
+    /// whether `transfer` (and so everything started before it) is done
+    virtual auto pollDma(dma_handle_t transfer) -> bool = 0;
+    virtual void waitDma(dma_handle_t transfer) = 0;
+
+    virtual void resetCores(uint64_t cores) = 0;
+    virtual void haltCores(uint64_t cores) = 0;
+    virtual void unhaltCores(uint64_t cores) = 0;
+    virtual auto checkDirty() -> uint64_t = 0;
+
+    /// waits until every core in `cores` is dirty, then checkDirty()s; a
+    /// card that can only be polled is polled
+    virtual auto waitDirty(uint64_t cores) -> uint64_t {
+        uint64_t dirty;
+        while (((dirty = checkDirty()) & cores) != cores)
+            std::this_thread::yield();
+        return dirty;
+    }
+};
+
+/**
+ * The card, simulated: a Card whose cores run on a background thread while
+ * the host carries on, so it can get the next batch of data ready while the
+ * last one runs, then poll checkDirty() or block in waitDirty() for it to
+ * finish, like on the FPGA.
+ *
+ * Cores start held, as if haltCores() had been called on them, and run once
+ * unhalted. A core is dirty once it's executed a halt, until it's reset.
+ * haltCores(), unhaltCores() and resetCores() take effect at the end of the
+ * running cores' quantum, and return once they have: a core is stopped once
+ * haltCores() returns, so its registers and stores are all there to look at.
+ * Copies to and from the card go straight to its memory, running cores or
+ * not, like the real card's DMA, but code copied over code a core has already
+ * run isn't picked up until the core is reset.
+ *
+ * Copies go through a queue, which another thread works through: it takes
+ * everything queued at once, and does each run of transfers that carry on
+ * where the last left off (in both host and card memory, in the same
+ * direction) as one copy, so a buffer sent over in small pieces costs about
+ * what sending it in one go would. copyToCard() and copyFromCard() queue
+ * theirs and wait for it, so they're ordered with the rest.
+ *
+ * `interrupted()` is asked between quanta whether the user wants the cores
+ * stopped (ctrl-c, say); if so, every running core's registers are dumped and
+ * it's halted, so it counts as done.
+ */
+struct SimulatedCard : public Accelerator {
+    SimulatedCard(size_t memSize, size_t nCores,
+                  std::function<bool()> interrupted = [] { return false; })
+        : card(memSize, nCores),
+          allCores(nCores == 64 ? ~uint64_t(0) : (uint64_t(1) << nCores) - 1),
+          interrupted(std::move(interrupted)) {
+        for (size_t i = 0; i < nCores; i++)
+            card.core(i).held = true;
+        runner = std::thread([this] { runCores(); });
+        dmaWorker = std::thread([this] { runDma(); });
+    }
+    ~SimulatedCard() override {
+        {
+            std::lock_guard lock(dmaLock);
+            dmaStopping = true;
+        }
+        dmaChanged.notify_all();
+        dmaWorker.join();
+        {
+            std::lock_guard lock(m);
+            stopping = true;
+        }
+        changed.notify_all();
+        runner.join();
+    }
+
+    Card card;
+    const uint64_t allCores;
+
+    // accelerator interface
+    void copyToCard(uint32_t* hostSrc, uint64_t cardDst,
+                    uint64_t len) override {
+        waitDma(startCopyToCard(hostSrc, cardDst, len));
+    }
+
+    void copyFromCard(uint32_t* hostDst, uint64_t cardSrc,
+                      uint64_t len) override {
+        waitDma(startCopyFromCard(hostDst, cardSrc, len));
+    }
+
+    auto startCopyToCard(uint32_t* hostSrc, uint64_t cardDst, uint64_t len)
+        -> dma_handle_t override {
+        return queueDma({true, hostSrc, cardDst, len});
+    }
+
+    auto startCopyFromCard(uint32_t* hostDst, uint64_t cardSrc, uint64_t len)
+        -> dma_handle_t override {
+        return queueDma({false, hostDst, cardSrc, len});
+    }
+
+    auto pollDma(dma_handle_t transfer) -> bool override {
+        std::lock_guard lock(dmaLock);
+        return dmaDone >= transfer;
+    }
+
+    void waitDma(dma_handle_t transfer) override {
+        std::unique_lock lock(dmaLock);
+        dmaChanged.wait(lock, [&] { return dmaDone >= transfer; });
+    }
+
+    /**
+     * Puts the image at `path` in card memory at `cardDst`, like
+     * copyToCard(), but mapped rather than read in and copied, where it
+     * can be.
+     */
+    void loadToCard(const std::string& path, uint64_t cardDst) {
+        {
+            // after whatever's already queued
+            std::unique_lock lock(dmaLock);
+            dmaChanged.wait(lock, [&] { return dmaDone == dmaStarted; });
+        }
+        card.core(0).mem._check_addr(cardDst, 32); // align to 32 bit words
+        try {
+            card.memory().load(path, cardDst);
+        } catch (const std::runtime_error& err) {
+            fmt::print(stderr, "[!] {}\n", err.what());
+            std::exit(1);
+        }
+    }
+
+    void resetCores(uint64_t cores) override { request(toReset, cores); }
+
+    void haltCores(uint64_t cores) override { request(toHold, cores); }
+
+    void unhaltCores(uint64_t cores) override { request(toRelease, cores); }
+
+    auto checkDirty() -> uint64_t override {
+        std::lock_guard lock(m);
+        rethrowError();
+        return dirty;
+    }
+
+    auto waitDirty(uint64_t cores) -> uint64_t override {
+        cores &= allCores;
+        std::unique_lock lock(m);
+        changed.wait(lock,
+                     [&] { return error || (dirty & cores) == cores; });
+        rethrowError();
+        return dirty;
+    }
+
+    /// a queued copy
+    struct Transfer {
+        bool toCard;
+        uint32_t* host;
+        uint64_t card; // in bytes, like len
+        uint64_t len;
+    };
+
+    /**
+     * Merges each transfer in `batch` into the one before it where it
+     * carries on from it: same direction, and starting where it ended in both
+     * host and card memory. What's left does the same as the batch did.
+     */
+    static void coalesce(std::vector<Transfer>& batch) {
+        size_t n = 0;
+        for (const auto& t : batch) {
+            if (n > 0) {
+                auto& last = batch[n - 1];
+                if (last.toCard == t.toCard &&
+                    last.host + last.len / 4 == t.host &&
+                    last.card + last.len == t.card) {
+                    last.len += t.len;
+                    continue;
+                }
+            }
+            batch[n++] = t;
+        }
+        batch.resize(n);
+    }
+
+  private:
+    auto queueDma(const Transfer& transfer) -> dma_handle_t {
+        // align to 32 bit words
+        card.core(0).mem._check_addr(transfer.card, 32);
+        if (transfer.len % 4 != 0) {
+            std::cerr
+                << "copy length must be a multiple of 4 bytes (i.e., copy "
+                   "length must be an integer multiple of a 32-bit word)\n";
+            std::exit(1);
+        }
+        if (transfer.len > 0)
+            card.core(0).mem._check_addr(transfer.card + transfer.len - 4,
+                                         32);
+
+        std::lock_guard lock(dmaLock);
+        dmaQueue.push_back(transfer);
+        dmaChanged.notify_all();
+        return ++dmaStarted;
+    }
+
+    /// the DMA thread: does whatever's queued, a batch at a time, until
+    /// the card goes and there's nothing left
+    void runDma() {
+        std::vector<Transfer> batch;
+        std::unique_lock lock(dmaLock);
+        while (true) {
+            dmaChanged.wait(lock,
+                            [&] { return dmaStopping || !dmaQueue.empty(); });
+            if (dmaQueue.empty())
+                return;
+            batch.swap(dmaQueue);
+            auto last = dmaStarted;
+            lock.unlock();
+
+            coalesce(batch);
+            auto* mem = card.memory().data();
+            for (const auto& t : batch) {
+                if (t.toCard)
+                    memcpy(mem + t.card / 4, t.host, t.len);
+                else
+                    memcpy(t.host, mem + t.card / 4, t.len);
+            }
+            batch.clear();
+
+            lock.lock();
+            dmaDone = last;
+            dmaChanged.notify_all();
+        }
+    }
+
+    /// adds `cores` to `pending`, and waits for it to be seen to
+    void request(uint64_t& pending, uint64_t cores) {
+        std::unique_lock lock(m);
+        rethrowError();
+        pending |= cores & allCores;
+        if (running)
+            changed.wait(lock, [&] { return error || pending == 0; });
+        else
+            applyRequests();
+        changed.notify_all();
+        rethrowError();
+    }
+
+    /// with `m` locked, and no core running
+    void applyRequests() {
+        for (size_t i = 0; i < card.nCores(); i++) {
+            auto& core = card.core(i);
+            if (toReset & (1ULL << i))
+                card.reset(i);
+            if (toHold & (1ULL << i))
+                core.held = true;
+            if (toRelease & (1ULL << i))
+                core.held = false;
+        }
+        toReset = toHold = toRelease = 0;
+
+        dirty = 0;
+        for (size_t i = 0; i < card.nCores(); i++)
+            if (card.core(i).cpu.isHalted())
+                dirty |= 1ULL << i;
+    }
+
+    /// with `m` locked
+    auto runnable() -> bool {
+        for (size_t i = 0; i < card.nCores(); i++)
+            if (!card.core(i).held && !card.core(i).cpu.isHalted())
+                return true;
+        return false;
+    }
+
+    /// with `m` locked; the error is the card's, and stays until it's gone
+    void rethrowError() {
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    /// the background thread: runs whatever cores there are to run, seeing
+    /// to requests between quanta
+    void runCores() {
+        std::unique_lock lock(m);
+        while (true) {
+            changed.wait(lock, [&] { return stopping || runnable(); });
+            if (stopping)
+                return;
+            running = true;
+            lock.unlock();
+
+            bool stopped = false;
+            std::exception_ptr err;
+            try {
+                card.run(Card::DEFAULT_QUANTUM, 0, [&] {
+                    std::lock_guard guard(m);
+                    if (interrupted()) {
+                        stopped = true;
+                        return false;
+                    }
+                    applyRequests();
+                    changed.notify_all();
+                    return !stopping;
+                });
+            } catch (...) {
+                err = std::current_exception();
+            }
+
+            lock.lock();
+            running = false;
+            // a core that was stopped (or whose debugger quit) is done, as
+            // far as the host is concerned
+            for (size_t i = 0; i < card.nCores(); i++) {
+                auto& core = card.core(i);
+                if (core.quitting ||
+                    (stopped && !core.held && !core.cpu.isHalted())) {
+                    fmt::print("core {}\n", i);
+                    core.cpu.dump();
+                    core.cpu.halt();
+                }
+            }
+            error = err;
+            applyRequests();
+            changed.notify_all();
+            if (error)
+                return;
+        }
+    }
+
+    std::function<bool()> interrupted;
+    std::thread runner;
+    std::mutex m;
+    // signalled whenever requests have been seen to, or the cores stop
+    std::condition_variable changed;
+    bool running = false;
+    bool stopping = false;
+    std::exception_ptr error;
+    uint64_t toReset = 0, toHold = 0, toRelease = 0;
+    uint64_t dirty = 0;
+
+    std::thread dmaWorker;
+    std::mutex dmaLock;
+    // signalled when something's queued, or a batch is done
+    std::condition_variable dmaChanged;
+    bool dmaStopping = false;
+    std::vector<Transfer> dmaQueue;
+    dma_handle_t dmaStarted = 0, dmaDone = 0;
+};
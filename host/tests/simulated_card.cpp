@@ -0,0 +1,164 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest.h"
+
+#include <filesystem>
+#include <fstream>
+#include <numeric>
+
+#include <morph/encoder.h>
+#include <morph/util.h>
+
+#include "simulated_card.h"
+
+using Transfer = SimulatedCard::Transfer;
+
+/// spins until the word at 0x2000 isn't zero, then adds 1 to 0x1000
+auto waitThenCount() -> std::vector<uint32_t> {
+    isa::Emitter e;
+    e.loadImmediate(false, 2, 0x2000);
+    e.loadScalar(false, 3, 2, 0);
+    e.compareImm(3, 0);
+    e.branchImm(condition_t::ez, -3);
+    e.loadImmediate(false, 4, 0x1000);
+    e.fa(5, 4, 1);
+    e.halt();
+    return e.getData();
+}
+
+auto readWord(SimulatedCard& card, uint64_t addr) -> uint32_t {
+    uint32_t word;
+    card.copyFromCard(&word, addr, 4);
+    return word;
+}
+
+TEST_CASE("driving the cores like the FPGA") {
+    SimulatedCard card(4096, 2);
+    auto code = waitThenCount();
+    card.copyToCard(code.data(), 0, code.size() * 4);
+    CHECK(card.checkDirty() == 0);
+
+    card.resetCores(0b11);
+    card.unhaltCores(0b11);
+    CHECK(card.checkDirty() == 0);
+
+    // core 0 is stopped by the time haltCores() returns, so only core 1
+    // sees the flag
+    card.haltCores(0b01);
+    uint32_t flag = 1;
+    card.copyToCard(&flag, 0x2000, 4);
+    CHECK(card.waitDirty(0b10) == 0b10);
+    CHECK(readWord(card, 0x1000) == 1);
+    CHECK(card.checkDirty() == 0b10);
+
+    card.unhaltCores(0b01);
+    CHECK(card.waitDirty(0b11) == 0b11);
+    CHECK(readWord(card, 0x1000) == 2);
+
+    // a reset core isn't dirty until it halts again
+    card.resetCores(0b01);
+    CHECK(card.checkDirty() == 0b10);
+    card.unhaltCores(0b01);
+    CHECK(card.waitDirty(0b01) == 0b11);
+    CHECK(readWord(card, 0x1000) == 3);
+}
+
+TEST_CASE("a core that panics") {
+    // ld36 from 2 is misaligned
+    isa::Emitter e;
+    e.loadImmediate(false, 1, 2);
+    e.loadScalar(true, 2, 1, 0);
+    e.halt();
+    auto code = e.getData();
+
+    SimulatedCard card(4096, 1);
+    card.copyToCard(code.data(), 0, code.size() * 4);
+    card.resetCores(0b1);
+    card.unhaltCores(0b1);
+    CHECK_THROWS_AS(card.waitDirty(0b1), Panic);
+    CHECK_THROWS_AS(card.checkDirty(), Panic);
+}
+
+TEST_CASE("DMA transfers finish in the order they're started") {
+    SimulatedCard card(1 << 16, 1);
+    std::vector<uint32_t> src(1 << 14);
+    std::iota(src.begin(), src.end(), 1);
+
+    std::vector<dma_handle_t> handles;
+    for (size_t at = 0; at < src.size(); at += 100) {
+        auto n = std::min<size_t>(100, src.size() - at);
+        handles.push_back(card.startCopyToCard(src.data() + at, at * 4, n * 4));
+    }
+    std::vector<uint32_t> dst(src.size());
+    auto back = card.startCopyFromCard(dst.data(), 0, dst.size() * 4);
+    for (size_t i = 1; i < handles.size(); i++)
+        CHECK(handles[i] > handles[i - 1]);
+    CHECK(back > handles.back());
+
+    card.waitDma(back);
+    for (auto h : handles)
+        CHECK(card.pollDma(h));
+    CHECK(dst == src);
+}
+
+TEST_CASE("coalescing transfers") {
+    uint32_t buf[64];
+
+    SUBCASE("each one carrying on from the last") {
+        std::vector<Transfer> batch = {{true, buf, 0x100, 16},
+                                       {true, buf + 4, 0x110, 8},
+                                       {true, buf + 6, 0x118, 40}};
+        SimulatedCard::coalesce(batch);
+        REQUIRE(batch.size() == 1);
+        CHECK(batch[0].host == buf);
+        CHECK(batch[0].card == 0x100);
+        CHECK(batch[0].len == 64);
+    }
+
+    SUBCASE("but not the other way, or with a gap") {
+        std::vector<Transfer> batch = {
+            {true, buf, 0x100, 16},
+            {false, buf + 4, 0x110, 16},  // the other way
+            {false, buf + 8, 0x124, 16},  // a gap on the card
+            {false, buf + 13, 0x134, 16}, // a gap on the host
+            {false, buf + 17, 0x144, 16}, // carries on
+        };
+        SimulatedCard::coalesce(batch);
+        REQUIRE(batch.size() == 4);
+        CHECK(batch[0].len == 16);
+        CHECK(batch[1].card == 0x110);
+        CHECK(batch[2].card == 0x124);
+        CHECK(batch[3].host == buf + 13);
+        CHECK(batch[3].len == 32);
+    }
+}
+
+TEST_CASE("loadToCard waits for the queue") {
+    auto path = std::filesystem::temp_directory_path() / "morph_host_test.bin";
+    std::vector<uint32_t> image(1024, 7);
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(image.data()),
+                  image.size() * 4);
+    }
+
+    SimulatedCard card(1 << 16, 1);
+    std::vector<uint32_t> junk(1 << 15, 9);
+    auto h = card.startCopyToCard(junk.data(), 0, junk.size() * 4);
+    card.loadToCard(path.string(), 0);
+    CHECK(card.pollDma(h));
+    CHECK(readWord(card, 0) == 7);
+    CHECK(readWord(card, 4 * 1023) == 7);
+    CHECK(readWord(card, 4 * 1024) == 9);
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("the card finishes its transfers before it goes") {
+    std::vector<uint32_t> src(1 << 14, 3), dst(1 << 14, 0);
+    {
+        SimulatedCard card(1 << 16, 1);
+        card.startCopyToCard(src.data(), 0, src.size() * 4);
+        card.startCopyFromCard(dst.data(), 0, dst.size() * 4);
+    }
+    CHECK(dst == src);
+}
@@ -0,0 +1,277 @@
+#!/usr/bin/env python3
+"""
+Generate the libmorph opcode tables from isa.yml.
+
+    isagen.py isa.yml opcodes.h decode_table.h
+
+opcodes.h has the opcode enum, a 128-entry opcode info table, one struct per
+format with get/put for each of its fields, and an encoder per instruction.
+decode_table.h has a decode function per opcode, templated on the visitor,
+and both a 128-entry dispatch table and a switch over them.
+
+Both halves come from the same field descriptions, so the encoder and the
+decoder cannot disagree about where a field lives.
+"""
+import re
+import sys
+
+import yaml
+
+try:
+    from yaml import CLoader as Loader
+except ImportError:
+    from yaml import Loader
+
+OPCODE_BITS = 7
+N_OPCODES = 1 << OPCODE_BITS
+FIELD_BITS = 32 - OPCODE_BITS
+
+# mnemonics that can't be C++ identifiers as-is
+CXX_RESERVED = {'and', 'or', 'xor', 'not', 'bitand', 'bitor', 'compl'}
+
+HEADER = '// generated by isa/isagen.py from isa/isa.yml -- do not edit\n'
+
+
+class SpecError(Exception):
+    pass
+
+
+def ident(mnemonic):
+    return mnemonic + '_' if mnemonic in CXX_RESERVED else mnemonic
+
+
+def camel(s):
+    return s[0].upper() + s[1:].lower()
+
+
+def parse_range(r):
+    """'24-20' -> (24, 20); 16 -> (16, 16)"""
+    if isinstance(r, int):
+        return r, r
+    hi, lo = (int(x) for x in str(r).split('-'))
+    if hi < lo:
+        raise SpecError(f'bit range {r} is backwards')
+    return hi, lo
+
+
+class Field:
+    def __init__(self, name, ranges):
+        self.name = name
+        self.ranges = [parse_range(r) for r in ranges]
+        self.width = sum(hi - lo + 1 for hi, lo in self.ranges)
+
+    def bits(self):
+        for hi, lo in self.ranges:
+            yield from range(lo, hi + 1)
+
+    def get(self):
+        slices = [f'instr.slice<{hi}, {lo}>()' for hi, lo in self.ranges]
+        return '.concat('.join(slices) + ')' * (len(slices) - 1)
+
+    def put(self):
+        # walk the ranges least significant first, peeling bits off `v`
+        terms = []
+        shift = 0
+        for hi, lo in reversed(self.ranges):
+            n = hi - lo + 1
+            src = f'(v >> {shift})' if shift else 'v'
+            terms.append(f'(({src} & {(1 << n) - 1:#x}) << {lo})')
+            shift += n
+        return ' | '.join(reversed(terms))
+
+
+class Format:
+    def __init__(self, name, fields):
+        self.name = name
+        self.fields = {k: Field(k, v) for k, v in (fields or {}).items()}
+
+        seen = {}
+        for f in self.fields.values():
+            for b in f.bits():
+                if b >= FIELD_BITS:
+                    raise SpecError(
+                        f'{name}.{f.name} overlaps the opcode (bit {b})')
+                if b in seen:
+                    raise SpecError(
+                        f'{name}.{f.name} overlaps {name}.{seen[b]} '
+                        f'(bit {b})')
+                seen[b] = f.name
+
+
+class Instruction:
+    def __init__(self, d, formats):
+        self.mnemonic = d['mnemonic']
+        self.ident = ident(self.mnemonic)
+        enc = d['encoding']
+        self.opcode = enc['opcode']
+        if not 0 <= self.opcode < N_OPCODES:
+            raise SpecError(f'{self.mnemonic}: opcode out of range')
+        if enc['format'] not in formats:
+            raise SpecError(f'{self.mnemonic}: no format {enc["format"]}')
+        self.format = formats[enc['format']]
+        self.operands = d.get('operands') or []
+        for op in self.operands:
+            if op not in self.format.fields:
+                raise SpecError(f'{self.mnemonic}: {self.format.name} has '
+                                f'no field {op}')
+        self.decode = d['decode']
+        # the decoder extracts whatever the visitor call mentions
+        self.decode_uses = [op for op in self.operands
+                            if re.search(rf'\b{op}\b', self.decode)]
+        self.category = d['category']
+
+
+def load(path):
+    with open(path) as f:
+        d = yaml.load(f, Loader=Loader)
+    formats = {k: Format(k, v) for k, v in d['formats'].items()}
+    instrs = [Instruction(i, formats) for i in d['instructions']]
+
+    by_opcode = {}
+    for i in instrs:
+        if i.opcode in by_opcode:
+            raise SpecError(f'{i.mnemonic} and {by_opcode[i.opcode].mnemonic} '
+                            f'share opcode {i.opcode:#09b}')
+        by_opcode[i.opcode] = i
+    return formats, instrs, by_opcode
+
+
+def gen_opcodes(formats, instrs, by_opcode):
+    categories = sorted({i.category for i in instrs})
+    out = [HEADER, '#pragma once\n\n',
+           '#include <array>\n#include <cstddef>\n#include <cstdint>\n\n',
+           '#include "morph/varint.h"\n\n', 'namespace isa {\n']
+
+    out.append('enum class Opcode : uint8_t {\n')
+    for i in instrs:
+        out.append(f'    {i.ident} = {i.opcode:#09b},\n')
+    out.append('};\n\n')
+
+    out.append('enum class Format : uint8_t {\n    Invalid,\n')
+    for name in formats:
+        out.append(f'    {name},\n')
+    out.append('};\n\n')
+
+    out.append('enum class Category : uint8_t {\n    Invalid,\n')
+    for c in categories:
+        out.append(f'    {camel(c)},\n')
+    out.append('};\n\n')
+
+    out.append('inline constexpr size_t N_CATEGORIES = '
+               f'{len(categories) + 1};\n\n')
+    out.append('// as spelled in isa.yml, indexed by Category\n'
+               'inline constexpr std::array<const char*, N_CATEGORIES> '
+               'categoryNames = {{\n    "invalid",\n')
+    for c in categories:
+        out.append(f'    "{c}",\n')
+    out.append('}};\n\n')
+
+    out.append('struct OpcodeInfo {\n'
+               '    const char* mnemonic; // nullptr if unassigned\n'
+               '    Format format;\n'
+               '    Category category;\n'
+               '};\n\n')
+    out.append(f'inline constexpr size_t N_OPCODES = {N_OPCODES};\n\n')
+    out.append('inline constexpr std::array<OpcodeInfo, N_OPCODES> '
+               'opcodeInfo = {{\n')
+    for op in range(N_OPCODES):
+        if i := by_opcode.get(op):
+            out.append(f'    {{"{i.mnemonic}", Format::{i.format.name}, '
+                       f'Category::{camel(i.category)}}},\n')
+        else:
+            out.append('    {nullptr, Format::Invalid, Category::Invalid},\n')
+    out.append('}};\n\n')
+
+    out.append('inline auto opcodeOf(bits<32> instr) -> uint32_t {\n'
+               f'    return instr.slice<31, {FIELD_BITS}>().inner;\n'
+               '}\n\n')
+
+    out.append('namespace format {\n')
+    for fmt in formats.values():
+        out.append(f'struct {fmt.name} {{\n')
+        for f in fmt.fields.values():
+            out.append(
+                f'    struct {f.name} {{\n'
+                f'        static constexpr size_t width = {f.width};\n'
+                f'        static auto get(bits<32> instr) -> bits<{f.width}> {{\n'
+                f'            return {f.get()};\n'
+                f'        }}\n'
+                f'        static constexpr auto put(uint64_t v) -> uint32_t {{\n'
+                f'            return {f.put()};\n'
+                f'        }}\n'
+                f'    }};\n')
+        out.append('};\n')
+    out.append('} // namespace format\n\n')
+
+    out.append('namespace encode {\n')
+    for i in instrs:
+        params = ', '.join(f'uint64_t {op}' for op in i.operands)
+        terms = [f'uint32_t{{{i.opcode:#09b}}} << {FIELD_BITS}']
+        terms += [f'format::{i.format.name}::{op}::put({op})'
+                  for op in i.operands]
+        body = ' |\n           '.join(terms)
+        out.append(f'inline constexpr auto {i.ident}({params}) -> uint32_t {{\n'
+                   f'    return {body};\n}}\n')
+    out.append('} // namespace encode\n')
+
+    out.append('} // namespace isa\n')
+    return ''.join(out)
+
+
+def gen_decode_table(formats, instrs, by_opcode):
+    out = [HEADER, '#pragma once\n\n', '#include <array>\n\n',
+           '#include "morph/isa.h"\n', '#include "morph/opcodes.h"\n',
+           '#include "morph/ty.h"\n', '#include "morph/util.h"\n\n',
+           'namespace isa::decode_table {\n',
+           'template <typename V> using Handler = void (*)(V&, bits<32>);\n\n',
+           'template <typename V> inline void invalid(V&, bits<32>) {\n'
+           '    unimplemented("invalid opcode");\n}\n\n']
+
+    for i in instrs:
+        param = 'bits<32> instr' if i.decode_uses else 'bits<32>'
+        out.append(f'template <typename V> inline void {i.ident}(V& visit, '
+                   f'{param}) {{\n')
+        for op in i.decode_uses:
+            out.append(f'    auto {op} = format::{i.format.name}::{op}::get'
+                       '(instr);\n')
+        out.append(f'    visit.{i.decode};\n}}\n\n')
+
+    out.append('/// one out-of-line call per instruction\n'
+               'template <typename V>\n'
+               'inline constexpr std::array<Handler<V>, N_OPCODES> handlers = {\n')
+    for op in range(N_OPCODES):
+        i = by_opcode.get(op)
+        out.append(f'    {i.ident if i else "invalid"}<V>,\n')
+    out.append('};\n\n')
+
+    out.append('/// the same, as a switch the compiler can inline through\n'
+               'template <typename V> inline void dispatch(V& visit, '
+               'bits<32> instr) {\n'
+               '    switch (opcodeOf(instr)) {\n')
+    for i in instrs:
+        out.append(f'    case {i.opcode:#09b}:\n'
+                   f'        return {i.ident}(visit, instr);\n')
+    out.append('    default:\n        return invalid(visit, instr);\n'
+               '    }\n}\n')
+    out.append('} // namespace isa::decode_table\n')
+    return ''.join(out)
+
+
+def main(argv):
+    if len(argv) != 4:
+        print(__doc__.strip(), file=sys.stderr)
+        return 2
+    try:
+        spec = load(argv[1])
+    except SpecError as e:
+        print(f'{argv[1]}: {e}', file=sys.stderr)
+        return 1
+    with open(argv[2], 'w') as f:
+        f.write(gen_opcodes(*spec))
+    with open(argv[3], 'w') as f:
+        f.write(gen_decode_table(*spec))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -5,6 +5,8 @@
 #include <fmt/core.h>
 #include <fmt/ostream.h>
 
+#include "morph/decode_table.h"
+
 #include "isa.h"
 #include "ty.h"
 #include "util.h"
@@ -162,6 +164,23 @@ struct InstructionVisitor {
 
 void decodeInstruction(InstructionVisitor& visit, bits<32> instr);
 
+/// anything with InstructionVisitor's methods, virtual or not
+template <typename V>
+concept Visitor = requires(V& v) {
+    v.halt();
+    v.nop();
+};
+
+/**
+ * Static-dispatch decode: with a concrete (ideally `final`) visitor type the
+ * compiler sees straight through the opcode switch into the visitor's
+ * method. Callers holding a plain InstructionVisitor& still get the
+ * out-of-line version above.
+ */
+template <Visitor V> void decodeInstruction(V& visit, bits<32> instr) {
+    decode_table::dispatch(visit, instr);
+}
+
 struct PrintVisitor : public InstructionVisitor {
     explicit PrintVisitor(std::ostream& os) : os{os} {}
     virtual ~PrintVisitor() = default;
@@ -343,11 +362,14 @@ struct PrintVisitor : public InstructionVisitor {
     }
 
     void fa(reg_idx rD, reg_idx rA, s<15> imm) override {
-        fmt::print(os, "fa r{}, r{}, {:#x}", rD.inner, rA.inner, imm.inner);
+        fmt::print(os, "fa r{}, r{}, {:#x}", rD.inner, rA.inner,
+                   imm._sgn_inner());
     }
 
     void cmpx(reg_idx rD, reg_idx rA, s<15> imm) override {
-        fmt::print(os, "cmpx r{}, r{}, {:#x}", rD.inner, rA.inner, imm.inner);
+        // rB rides in the top of the immediate field
+        fmt::print(os, "cmpx r{}, r{}, r{}", rD.inner, rA.inner,
+                   imm.raw() >> 10);
     }
 
     void ftoi(reg_idx rD, reg_idx rA) override {
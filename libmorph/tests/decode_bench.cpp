@@ -0,0 +1,183 @@
+// decodes a large random instruction stream and reports decodes/second,
+// through both the virtual and the templated decodeInstruction.
+// run with `meson test --benchmark -v` or directly, optionally passing the
+// number of instructions and passes.
+#include <chrono>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include <fmt/core.h>
+
+#include "morph/decoder.h"
+#include "morph/opcodes.h"
+
+using namespace isa;
+
+// does as little as possible per instruction, so the decoder is all we time
+struct CountingVisitor final : public InstructionVisitor {
+    uint64_t n = 0;
+    uint64_t sum = 0;
+
+    void nop() override { n++; }
+    void halt() override { n++; }
+    void bkpt(bits<25> imm) override { n++, sum += imm.inner; }
+    void jmp(s<25> imm) override { n++, sum += imm.inner; }
+    void jal(s<25> imm) override { n++, sum += imm.inner; }
+    void jmpr(reg_idx rA, s<20> imm) override { n++, sum += rA + imm.inner; }
+    void jalr(reg_idx rA, s<20> imm) override { n++, sum += rA + imm.inner; }
+    void branchimm(condition_t cond, s<22> imm) override {
+        n++, sum += imm.inner;
+    }
+    void branchreg(condition_t cond, reg_idx rA, s<17> imm) override {
+        n++, sum += rA + imm.inner;
+    }
+    void lil(reg_idx rD, s<18> imm) override { n++, sum += rD + imm.inner; }
+    void lih(reg_idx rD, s<18> imm) override { n++, sum += rD + imm.inner; }
+    void vldi(vreg_idx vD, reg_idx rA, s<11> imm, vmask_t mask) override {
+        n++, sum += vD + rA + imm.inner;
+    }
+    void vsti(s<11> imm, reg_idx rA, vreg_idx vB, vmask_t mask) override {
+        n++, sum += vB + rA + imm.inner;
+    }
+    void vldr(vreg_idx vD, reg_idx rA, reg_idx rB, vmask_t mask) override {
+        n++, sum += vD + rA + rB;
+    }
+    void vstr(reg_idx rA, reg_idx rB, vreg_idx vA, vmask_t mask) override {
+        n++, sum += vA + rA + rB;
+    }
+    void ld(reg_idx rD, reg_idx rA, s<15> imm, bool b36) override {
+        n++, sum += rD + rA + imm.inner;
+    }
+    void st(reg_idx rA, reg_idx rB, s<15> imm, bool b36) override {
+        n++, sum += rA + rB + imm.inner;
+    }
+    void scalarArithmetic(reg_idx rD, reg_idx rA, reg_idx rB,
+                          ScalarArithmeticOp op) override {
+        n++, sum += rD + rA + rB;
+    }
+    void scalarArithmeticImmediate(reg_idx rD, reg_idx rA, s<15> imm,
+                                   ScalarArithmeticOp op) override {
+        n++, sum += rD + rA + imm.inner;
+    }
+    void cmpI(reg_idx rA, s<20> imm) override { n++, sum += rA + imm.inner; }
+    void arithmeticNot(reg_idx rD, reg_idx rA) override { n++, sum += rD + rA; }
+    void floatArithmetic(reg_idx rD, reg_idx rA, reg_idx rB,
+                         FloatArithmeticOp op) override {
+        n++, sum += rD + rA + rB;
+    }
+    void cmp(reg_idx rA, reg_idx rB) override { n++, sum += rA + rB; }
+    void vectorArithmetic(LanewiseVectorOp op, vreg_idx vD, vreg_idx vA,
+                          vreg_idx vB, vmask_t mask) override {
+        n++, sum += vD + vA + vB;
+    }
+    void vdot(reg_idx rD, vreg_idx vA, vreg_idx vB) override {
+        n++, sum += rD + vA + vB;
+    }
+    void vdota(reg_idx rD, reg_idx rA, vreg_idx vA, vreg_idx vB) override {
+        n++, sum += rD + rA + vA + vB;
+    }
+    void vidx(reg_idx rD, vreg_idx vA, vlaneidx_t imm) override {
+        n++, sum += rD + vA + imm;
+    }
+    void vreduce(reg_idx rD, vreg_idx vA, vmask_t mask) override {
+        n++, sum += rD + vA;
+    }
+    void vsplat(vreg_idx vD, reg_idx rA, vmask_t mask) override {
+        n++, sum += vD + rA;
+    }
+    void vswizzle(vreg_idx vD, vreg_idx vA, vlaneidx_t i0, vlaneidx_t i1,
+                  vlaneidx_t i2, vlaneidx_t i3, vmask_t mask) override {
+        n++, sum += vD + vA + i0 + i1 + i2 + i3;
+    }
+    void vectorScalarArithmetic(VectorScalarOp op, vreg_idx vD, reg_idx rA,
+                                vreg_idx vB, vmask_t mask) override {
+        n++, sum += vD + rA + vB;
+    }
+    void vsma(vreg_idx vD, reg_idx rA, vreg_idx vA, vreg_idx vB,
+              vmask_t mask) override {
+        n++, sum += vD + rA + vA + vB;
+    }
+    void matrixWrite(MatrixWriteOp op, u<3> idx, vreg_idx vA,
+                     vreg_idx vB) override {
+        n++, sum += idx + vA + vB;
+    }
+    void matmul() override { n++; }
+    void systolicstep() override { n++; }
+    void readC(vreg_idx vD, u<3> idx, bool high) override {
+        n++, sum += vD + idx;
+    }
+    void vcomp(vreg_idx vD, reg_idx rA, reg_idx rB, vreg_idx vB,
+               vmask_t mask) override {
+        n++, sum += vD + rA + rB + vB;
+    }
+    void flushdirty() override { n++; }
+    void flushclean() override { n++; }
+    void flushicache() override { n++; }
+    void flushline(reg_idx rA, s<20> imm) override {
+        n++, sum += rA + imm.inner;
+    }
+    void fa(reg_idx rD, reg_idx rA, s<15> imm) override {
+        n++, sum += rD + rA + imm.inner;
+    }
+    void cmpx(reg_idx rD, reg_idx rA, s<15> imm) override {
+        n++, sum += rD + rA + imm.inner;
+    }
+    void ftoi(reg_idx rD, reg_idx rA) override { n++, sum += rD + rA; }
+    void itof(reg_idx rD, reg_idx rA) override { n++, sum += rD + rA; }
+    void wcsr(s<2> csr, reg_idx rA) override { n++, sum += rA; }
+    void rcsr(s<2> csr, reg_idx rA) override { n++, sum += rA; }
+    void cmpdec(reg_idx rD, reg_idx rA, reg_idx rB) override {
+        n++, sum += rD + rA + rB;
+    }
+    void cmpinc(reg_idx rD, reg_idx rA, reg_idx rB) override {
+        n++, sum += rD + rA + rB;
+    }
+};
+
+int main(int argc, char* argv[]) {
+    size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 0) : 1 << 20;
+    int passes = argc > 2 ? std::atoi(argv[2]) : 20;
+
+    // random words with a valid opcode, minus the few whose sub-op fields
+    // don't decode (e.g. A-format op codes past shl)
+    std::mt19937 rng(42);
+    std::vector<uint32_t> valid;
+    for (size_t op = 0; op < N_OPCODES; op++)
+        if (opcodeInfo[op].mnemonic)
+            valid.push_back(op);
+
+    CountingVisitor v;
+    std::vector<uint32_t> stream;
+    stream.reserve(count);
+    while (stream.size() < count) {
+        uint32_t word = (valid[rng() % valid.size()] << 25) |
+                        (rng() & ((1u << 25) - 1));
+        try {
+            decodeInstruction(v, word);
+            stream.push_back(word);
+        } catch (const std::logic_error&) {
+        }
+    }
+
+    auto time = [&](const char* name, auto&& decode) {
+        auto start = std::chrono::steady_clock::now();
+        for (int p = 0; p < passes; p++)
+            for (uint32_t word : stream)
+                decode(word);
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+
+        double decodes = double(count) * passes;
+        fmt::print("{:>8}: {} decodes in {:.3f}s, {:.1f}M decodes/s\n", name,
+                   decodes, elapsed.count(), decodes / elapsed.count() / 1e6);
+    };
+    time("virtual", [&](uint32_t word) {
+        decodeInstruction(static_cast<InstructionVisitor&>(v), word);
+    });
+    time("template", [&](uint32_t word) { decodeInstruction(v, word); });
+
+    // keep the visitor's work observable
+    fmt::print("checksum {:#x}\n", v.sum);
+    return 0;
+}
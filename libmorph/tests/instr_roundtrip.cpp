@@ -0,0 +1,263 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest.h"
+
+#include <random>
+
+#include "morph/decoder.h"
+#include "morph/encoder.h"
+#include "morph/opcodes.h"
+
+using namespace isa;
+
+// decodes straight back into an Emitter, so encode -> decode -> encode
+// has to be the identity for every instruction
+struct ReEmitVisitor : public InstructionVisitor {
+    Emitter e;
+
+    void nop() override { e.nop(); }
+    void halt() override { e.halt(); }
+    void bkpt(bits<25> imm) override { e.bkpt(imm); }
+
+    void jmp(s<25> imm) override { e.jumpPCRel(imm, false); }
+    void jal(s<25> imm) override { e.jumpPCRel(imm, true); }
+    void jmpr(reg_idx rA, s<20> imm) override { e.jumpRegRel(rA, imm, false); }
+    void jalr(reg_idx rA, s<20> imm) override { e.jumpRegRel(rA, imm, true); }
+
+    void branchimm(condition_t cond, s<22> imm) override {
+        e.branchImm(cond, imm);
+    }
+    void branchreg(condition_t cond, reg_idx rA, s<17> imm) override {
+        e.branchReg(cond, rA, imm);
+    }
+
+    void lil(reg_idx rD, s<18> imm) override { e.loadImmediate(false, rD, imm); }
+    void lih(reg_idx rD, s<18> imm) override { e.loadImmediate(true, rD, imm); }
+
+    void vldi(vreg_idx vD, reg_idx rA, s<11> imm, vmask_t mask) override {
+        e.loadVectorImmStride(vD, rA, imm, mask);
+    }
+    void vsti(s<11> imm, reg_idx rA, vreg_idx vB, vmask_t mask) override {
+        e.storeVectorImmStride(rA, vB, imm, mask);
+    }
+    void vldr(vreg_idx vD, reg_idx rA, reg_idx rB, vmask_t mask) override {
+        e.loadVectorRegStride(vD, rA, rB, mask);
+    }
+    void vstr(reg_idx rA, reg_idx rB, vreg_idx vA, vmask_t mask) override {
+        e.storeVectorRegStride(rA, rB, vA, mask);
+    }
+
+    void ld(reg_idx rD, reg_idx rA, s<15> imm, bool b36) override {
+        e.loadScalar(b36, rD, rA, imm);
+    }
+    void st(reg_idx rA, reg_idx rB, s<15> imm, bool b36) override {
+        e.storeScalar(b36, rA, rB, imm);
+    }
+
+    void scalarArithmetic(reg_idx rD, reg_idx rA, reg_idx rB,
+                          ScalarArithmeticOp op) override {
+        e.scalarArithmetic(op, rD, rA, rB);
+    }
+    void scalarArithmeticImmediate(reg_idx rD, reg_idx rA, s<15> imm,
+                                   ScalarArithmeticOp op) override {
+        e.scalarArithmeticImmediate(op, rD, rA, imm);
+    }
+    void cmpI(reg_idx rA, s<20> imm) override { e.compareImm(rA, imm); }
+    void arithmeticNot(reg_idx rD, reg_idx rA) override {
+        e.scalarArithmeticNot(rD, rA);
+    }
+    void floatArithmetic(reg_idx rD, reg_idx rA, reg_idx rB,
+                         FloatArithmeticOp op) override {
+        e.floatArithmetic(op, rD, rA, rB);
+    }
+    void cmp(reg_idx rA, reg_idx rB) override { e.compareReg(rA, rB); }
+
+    void vectorArithmetic(LanewiseVectorOp op, vreg_idx vD, vreg_idx vA,
+                          vreg_idx vB, vmask_t mask) override {
+        e.vectorLanewiseArith(op, vD, vA, vB, mask);
+    }
+    void vdot(reg_idx rD, vreg_idx vA, vreg_idx vB) override {
+        e.vdot(rD, vA, vB);
+    }
+    void vdota(reg_idx rD, reg_idx rA, vreg_idx vA, vreg_idx vB) override {
+        e.vdota(rD, rA, vA, vB);
+    }
+    void vidx(reg_idx rD, vreg_idx vA, vlaneidx_t imm) override {
+        e.vidx(rD, vA, imm);
+    }
+    void vreduce(reg_idx rD, vreg_idx vA, vmask_t mask) override {
+        e.vreduce(rD, vA, mask);
+    }
+    void vsplat(vreg_idx vD, reg_idx rA, vmask_t mask) override {
+        e.vsplat(vD, rA, mask);
+    }
+    void vswizzle(vreg_idx vD, vreg_idx vA, vlaneidx_t i0, vlaneidx_t i1,
+                  vlaneidx_t i2, vlaneidx_t i3, vmask_t mask) override {
+        e.vswizzle(vD, vA, i0, i1, i2, i3, mask);
+    }
+    void vectorScalarArithmetic(VectorScalarOp op, vreg_idx vD, reg_idx rA,
+                                vreg_idx vB, vmask_t mask) override {
+        e.vectorScalarArith(op, vD, rA, vB, mask);
+    }
+    void vsma(vreg_idx vD, reg_idx rA, vreg_idx vA, vreg_idx vB,
+              vmask_t mask) override {
+        e.vsma(vD, rA, vA, vB, mask);
+    }
+
+    void matrixWrite(MatrixWriteOp op, u<3> idx, vreg_idx vA,
+                     vreg_idx vB) override {
+        e.matrixWrite(op, vA, vB, idx);
+    }
+    void matmul() override { e.matmul(); }
+    void systolicstep() override { e.systolicStep(); }
+    void readC(vreg_idx vD, u<3> idx, bool high) override {
+        e.readC(vD, idx, high);
+    }
+    void vcomp(vreg_idx vD, reg_idx rA, reg_idx rB, vreg_idx vB,
+               vmask_t mask) override {
+        e.vcomp(vD, rA, rB, vB, mask);
+    }
+
+    void flushdirty() override { e.flushcache(CacheControlOp::Flushdirty); }
+    void flushclean() override { e.flushcache(CacheControlOp::Flushclean); }
+    void flushicache() override { e.flushcache(CacheControlOp::Flushicache); }
+    void flushline(reg_idx rA, s<20> imm) override { e.flushline(rA, imm); }
+
+    void fa(reg_idx rD, reg_idx rA, s<15> imm) override {
+        e.fa(rD, rA, imm.asUnsigned());
+    }
+    void cmpx(reg_idx rD, reg_idx rA, s<15> imm) override {
+        e.cmpx(rD, rA, imm.raw() >> 10);
+    }
+    void ftoi(reg_idx rD, reg_idx rA) override {
+        e.floatIntConv(FloatIntConversionOp::Ftoi, rD, rA);
+    }
+    void itof(reg_idx rD, reg_idx rA) override {
+        e.floatIntConv(FloatIntConversionOp::Itof, rD, rA);
+    }
+    void wcsr(s<2> csr, reg_idx rA) override {
+        e.csr(CsrOp::Wcsr, rA, csr.raw());
+    }
+    void rcsr(s<2> csr, reg_idx rA) override {
+        e.csr(CsrOp::Rcsr, rA, csr.raw());
+    }
+    void cmpdec(reg_idx rD, reg_idx rA, reg_idx rB) override {
+        e.compareAndMutate(CmpMutateDirection::Decrement, rD, rA, rB);
+    }
+    void cmpinc(reg_idx rD, reg_idx rA, reg_idx rB) override {
+        e.compareAndMutate(CmpMutateDirection::Increment, rD, rA, rB);
+    }
+};
+
+// one of everything the Emitter can produce, with random operands
+void emitEverything(Emitter& e, std::mt19937_64& rng) {
+    auto r = [&] { return reg_idx(rng() % 32); };
+    auto m = [&] { return vmask_t(rng() % 16); };
+    auto l = [&] { return vlaneidx_t(rng() % 4); };
+    auto sN = [&](size_t n) {
+        return static_cast<int64_t>(rng() % (1ULL << n)) - (1LL << (n - 1));
+    };
+    auto cond = [&] { return condition_t(rng() % 6); };
+
+    e.halt();
+    e.nop();
+    e.bkpt(rng() % (1 << 25));
+    e.jumpPCRel(sN(25), false);
+    e.jumpPCRel(sN(25), true);
+    e.jumpRegRel(r(), sN(20), false);
+    e.jumpRegRel(r(), sN(20), true);
+    e.branchImm(cond(), sN(22));
+    e.branchReg(cond(), r(), sN(17));
+    for (int i = 0; i < 8; i++) {
+        auto op = ScalarArithmeticOp(i);
+        e.scalarArithmetic(op, r(), r(), r());
+        if (op != ScalarArithmeticOp::Mul)
+            e.scalarArithmeticImmediate(op, r(), r(), sN(15));
+    }
+    e.scalarArithmeticNot(r(), r());
+    e.compareImm(r(), sN(20));
+    e.compareReg(r(), r());
+    e.compareAndMutate(CmpMutateDirection::Increment, r(), r(), r());
+    e.compareAndMutate(CmpMutateDirection::Decrement, r(), r(), r());
+    for (int i = 0; i < 4; i++)
+        e.floatArithmetic(FloatArithmeticOp(i), r(), r(), r());
+    for (int i = 0; i < 6; i++)
+        e.vectorLanewiseArith(LanewiseVectorOp(i), r(), r(), r(), m());
+    for (int i = 0; i < 4; i++)
+        e.vectorScalarArith(VectorScalarOp(i), r(), r(), r(), m());
+    e.vdot(r(), r(), r());
+    e.vdota(r(), r(), r(), r());
+    e.vidx(r(), r(), l());
+    e.vreduce(r(), r(), m());
+    e.vsplat(r(), r(), m());
+    e.vswizzle(r(), r(), l(), l(), l(), l(), m());
+    e.vsma(r(), r(), r(), r(), m());
+    e.vcomp(r(), r(), r(), r(), m());
+    for (int i = 0; i < 3; i++)
+        e.matrixWrite(MatrixWriteOp(i), r(), r(), rng() % 8);
+    e.matmul();
+    e.systolicStep();
+    e.readC(r(), rng() % 8, rng() % 2);
+    e.loadImmediate(false, r(), rng() % (1 << 18));
+    e.loadImmediate(true, r(), rng() % (1 << 18));
+    e.loadScalar(false, r(), r(), sN(15));
+    e.loadScalar(true, r(), r(), sN(15));
+    e.storeScalar(false, r(), r(), sN(15));
+    e.storeScalar(true, r(), r(), sN(15));
+    e.loadVectorImmStride(r(), r(), sN(11), m());
+    e.storeVectorImmStride(r(), r(), sN(11), m());
+    e.loadVectorRegStride(r(), r(), r(), m());
+    e.storeVectorRegStride(r(), r(), r(), m());
+    e.floatIntConv(FloatIntConversionOp::Ftoi, r(), r());
+    e.floatIntConv(FloatIntConversionOp::Itof, r(), r());
+    e.flushcache(CacheControlOp::Flushdirty);
+    e.flushcache(CacheControlOp::Flushclean);
+    e.flushcache(CacheControlOp::Flushicache);
+    e.flushline(r(), sN(20));
+    e.csr(CsrOp::Wcsr, r(), rng() % 4);
+    e.csr(CsrOp::Rcsr, r(), rng() % 4);
+    e.cmpx(r(), r(), r());
+    e.fa(r(), r(), rng() % (1 << 15));
+}
+
+TEST_CASE("encoder and decoder agree on every instruction") {
+    std::mt19937_64 rng(0x15a);
+    for (int trial = 0; trial < 64; trial++) {
+        Emitter e;
+        emitEverything(e, rng);
+
+        ReEmitVisitor v;
+        for (uint32_t word : e.getData()) {
+            INFO(fmt::format("{:#034b}", word));
+            REQUIRE_NOTHROW(decodeInstruction(v, word));
+            CHECK(v.e.getData().back() == word);
+
+            // and again through the virtual entry point
+            auto& base = static_cast<InstructionVisitor&>(v);
+            REQUIRE_NOTHROW(decodeInstruction(base, word));
+            CHECK(v.e.getData().back() == word);
+        }
+    }
+}
+
+TEST_CASE("every assigned opcode is reachable from the encoder") {
+    std::mt19937_64 rng(1);
+    Emitter e;
+    emitEverything(e, rng);
+
+    std::array<bool, N_OPCODES> seen{};
+    for (uint32_t word : e.getData())
+        seen[opcodeOf(word)] = true;
+    for (size_t op = 0; op < N_OPCODES; op++) {
+        INFO(op);
+        CHECK(seen[op] == (opcodeInfo[op].mnemonic != nullptr));
+    }
+}
+
+TEST_CASE("unassigned opcodes don't decode") {
+    ReEmitVisitor v;
+    for (size_t op = 0; op < N_OPCODES; op++) {
+        if (opcodeInfo[op].mnemonic == nullptr)
+            CHECK_THROWS_AS(decodeInstruction(v, uint32_t(op << 25)),
+                            Unimplemented);
+    }
+}
@@ -0,0 +1,115 @@
+#include "cache.h"
+
+#include <bit>
+#include <stdexcept>
+
+#include <fmt/format.h>
+
+Cache::Cache(CacheConfig config) : cfg{config}, counters{} {
+    auto pow2 = [](uint32_t v) { return v != 0 && (v & (v - 1)) == 0; };
+    if (!pow2(cfg.lineBytes) || cfg.lineBytes < 16)
+        throw std::invalid_argument(fmt::format(
+            "cache line size must be a power of two, at least 16 bytes (not "
+            "{})",
+            cfg.lineBytes));
+    // the PLRU tree has to fit in 64 bits
+    if (!pow2(cfg.ways) || cfg.ways > 32)
+        throw std::invalid_argument(fmt::format(
+            "cache ways must be a power of two up to 32 (not {})", cfg.ways));
+    if (!pow2(cfg.sets))
+        throw std::invalid_argument(fmt::format(
+            "cache sets must be a power of two (not {})", cfg.sets));
+    if (cfg.indexBit + std::countr_zero(cfg.sets) > 36)
+        throw std::invalid_argument(fmt::format(
+            "cache index bits {}.. run past the 36-bit address",
+            cfg.indexBit));
+
+    lineShift = std::countr_zero(cfg.lineBytes);
+    levels = std::countr_zero(cfg.ways);
+    lines.assign(size_t(cfg.sets) * cfg.ways, Line{0, false, false});
+    plru.assign(cfg.sets, 0);
+}
+
+auto Cache::access(uint64_t addr, bool write) -> bool {
+    auto set = setOf(addr);
+    auto tag = addr >> lineShift;
+    (write ? counters.writes : counters.reads)++;
+
+    int hit = find(set, tag);
+    unsigned way;
+    if (hit >= 0) {
+        way = hit;
+    } else {
+        (write ? counters.writeMisses : counters.readMisses)++;
+        way = victim(set);
+        auto& line = lines[set * cfg.ways + way];
+        if (line.valid && line.dirty)
+            counters.writebacks++;
+        line = Line{tag, true, false};
+    }
+
+    if (write)
+        lines[set * cfg.ways + way].dirty = true;
+    touch(set, way);
+    return hit >= 0;
+}
+
+void Cache::flushDirty() {
+    for (auto& line : lines) {
+        if (line.valid && line.dirty) {
+            counters.writebacks++;
+            line.dirty = false;
+        }
+    }
+}
+
+void Cache::flushClean() {
+    for (auto& line : lines)
+        if (!line.dirty)
+            line.valid = false;
+}
+
+void Cache::flushLine(uint64_t addr) {
+    auto set = setOf(addr);
+    int way = find(set, addr >> lineShift);
+    if (way < 0)
+        return;
+    auto& line = lines[set * cfg.ways + way];
+    if (line.dirty)
+        counters.writebacks++;
+    line = Line{0, false, false};
+}
+
+auto Cache::find(size_t set, uint64_t tag) const -> int {
+    const Line* ways = &lines[set * cfg.ways];
+    for (unsigned w = 0; w < cfg.ways; w++)
+        if (ways[w].valid && ways[w].tag == tag)
+            return static_cast<int>(w);
+    return -1;
+}
+
+auto Cache::victim(size_t set) const -> unsigned {
+    const Line* ways = &lines[set * cfg.ways];
+    for (unsigned w = cfg.ways; w-- > 0;)
+        if (!ways[w].valid)
+            return w;
+
+    // follow the less recently used side all the way down
+    unsigned way = 0;
+    uint64_t node = 1;
+    for (unsigned l = 0; l < levels; l++) {
+        unsigned older = !((plru[set] >> node) & 1);
+        way = (way << 1) | older;
+        node = 2 * node + older;
+    }
+    return way;
+}
+
+void Cache::touch(size_t set, unsigned way) {
+    uint64_t node = 1;
+    for (unsigned l = levels; l-- > 0;) {
+        uint64_t upper = (way >> l) & 1;
+        plru[set] = (plru[set] & ~(uint64_t(1) << node)) | (upper << node);
+        node = 2 * node + upper;
+    }
+}
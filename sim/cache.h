@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Shape of a set-associative cache. The defaults are the card's data cache
+ * (data_cache.sv): 64-byte lines, 4 ways, 256 sets.
+ */
+struct CacheConfig {
+    uint32_t lineBytes = 64;
+    uint32_t ways = 4;
+    uint32_t sets = 256;
+    // lowest address bit of the set index. data_cache_controller.sv takes
+    // the index from the top of the address, addr[35:28], with the tag in
+    // between; use log2(lineBytes) for the usual index-above-offset layout
+    uint32_t indexBit = 28;
+
+    /// instruction_cache.sv: the same lines and ways, but 128 sets.
+    /// icache_controller.sv indexes with addr[34:28], leaving addr[35] to the
+    /// tag
+    static auto icache() -> CacheConfig {
+        CacheConfig config;
+        config.sets = 128;
+        return config;
+    }
+};
+
+struct CacheStats {
+    uint64_t reads = 0;
+    uint64_t writes = 0;
+    uint64_t readMisses = 0;
+    uint64_t writeMisses = 0;
+    // dirty lines written back to memory, by eviction or by a flush
+    uint64_t writebacks = 0;
+};
+
+/**
+ * Set-associative, write-back, write-allocate cache model, following the
+ * RTL: tree pseudo-LRU replacement (next_metadata_comb.sv), filling invalid
+ * ways highest first before evicting anything.
+ *
+ * Only tags and valid/dirty bits are modelled. The data stays in MemPool,
+ * so the model never changes what a program sees; it just counts what the
+ * card's cache would have done.
+ */
+class Cache {
+  public:
+    /// throws std::invalid_argument for shapes the model can't do
+    explicit Cache(CacheConfig config);
+
+    /// an aligned access within one line. true on a hit
+    auto access(uint64_t addr, bool write) -> bool;
+
+    /// writes back every dirty line, leaving it valid and clean
+    void flushDirty();
+    /// invalidates every clean line
+    void flushClean();
+    /// writes back (if dirty) and invalidates the line holding `addr`
+    void flushLine(uint64_t addr);
+
+    [[nodiscard]] auto config() const -> const CacheConfig& { return cfg; }
+    [[nodiscard]] auto stats() const -> const CacheStats& { return counters; }
+
+  private:
+    struct Line {
+        uint64_t tag; // the whole line address, addr / lineBytes
+        bool valid;
+        bool dirty;
+    };
+
+    auto setOf(uint64_t addr) const -> size_t {
+        return (addr >> cfg.indexBit) & (cfg.sets - 1);
+    }
+    /// line index of `addr` in `set`, or -1
+    auto find(size_t set, uint64_t tag) const -> int;
+    auto victim(size_t set) const -> unsigned;
+    void touch(size_t set, unsigned way);
+
+    CacheConfig cfg;
+    unsigned lineShift, levels; // log2(lineBytes), log2(ways)
+    std::vector<Line> lines;    // sets * ways
+    // per set: one bit per node of the PLRU tree, heap-ordered from 1. a set
+    // bit means the upper half below that node was used more recently
+    std::vector<uint64_t> plru;
+    CacheStats counters;
+};
@@ -0,0 +1,293 @@
+#pragma once
+
+#include <algorithm>
+#include <barrier>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <morph/opcodes.h>
+#include <morph/util.h>
+
+#include "cpu.h"
+#include "debugger.h"
+#include "iproxy.h"
+#include "mem.h"
+#include "threaded.h"
+
+/**
+ * One core of a Card: its own CPU state, engine and debugger, and its own
+ * MemSystem (a view of the card's memory), so nothing it caches about the
+ * code it's run is shared with the other cores. Like separate I-caches, a
+ * core only notices another core rewriting code it's already run through
+ * flushicache.
+ */
+struct Core {
+    Core(const MemPool& memory, MemPool::View view);
+
+    CPUState cpu;
+    MemSystem mem;
+    bool quitting;
+    Debugger debugger;
+    CPUInstructionProxy<NullTracer> iproxy;
+    ThreadedEngine<NullTracer> engine;
+
+    uint64_t retired; // instructions, over every run()
+    // with Ordering::Deterministic, the words this quantum changed and what
+    // it changed them to, waiting for the end of the quantum
+    std::vector<std::pair<uint64_t, uint32_t>> stores;
+    // ...and the pages they're on, which its view has to drop
+    std::vector<uint64_t> storedPages;
+    // ...and whether it stopped at an atomic, which runs at the barrier
+    bool atomicPending;
+    // held by whoever's driving the card, so it sits quanta out like a
+    // halted core until they let it go
+    bool held;
+};
+
+/**
+ * A multi-core card: up to MAX_CORES cores sharing one memory, run on a pool
+ * of host threads.
+ *
+ * Cores run in quanta: each runs `quantum` instructions (or until it halts),
+ * then waits at a barrier for the rest to catch up. That keeps them within a
+ * quantum of each other, so a core spinning on a flag another core sets
+ * isn't left to run arbitrarily far ahead.
+ *
+ * How stores from different cores in the same quantum land depends on the
+ * Ordering. With Ordering::Host, every core writes straight to the shared
+ * memory, so they interleave however the host threads happen to. With
+ * Ordering::Deterministic, each core runs its quantum on a private
+ * copy-on-write view, seeing only its own stores on top of memory as it was
+ * when the quantum started; at the barrier, the words each core changed are
+ * written back in core order (so the highest-numbered core wins a word two
+ * of them changed). That makes a run the same however many host threads it
+ * gets, and whichever of them runs which core.
+ *
+ * Atomics (fa, cmpx) are atomic across cores either way. With
+ * Ordering::Host they're host atomics on the shared memory; with
+ * Ordering::Deterministic, a core's quantum ends at one, and it runs at the
+ * barrier after the stores are written back, one core at a time in core
+ * order, each seeing the one before.
+ */
+class Card {
+  public:
+    static constexpr size_t MAX_CORES = 8;
+    static constexpr uint64_t DEFAULT_QUANTUM = 10000;
+
+    enum class Ordering { Host, Deterministic };
+
+    /// `words` of memory, all zero, and 1 to MAX_CORES cores, all at PC 0
+    Card(size_t words, size_t nCores, Ordering ordering = Ordering::Host);
+
+    Card(const Card&) = delete;
+    Card& operator=(const Card&) = delete;
+
+    /// the card's memory, as the host sees it
+    [[nodiscard]] auto memory() -> MemPool& { return mem; }
+    [[nodiscard]] auto nCores() const -> size_t { return cores.size(); }
+    [[nodiscard]] auto core(size_t i) -> Core& { return *cores.at(i); }
+
+    /**
+     * Starts core `i` over: registers cleared, at PC 0 and not halted, with
+     * none of the code it had decoded kept, since whatever's driving the card
+     * has likely loaded new code. Only while it isn't running: outside run(),
+     * or from `between()`.
+     */
+    void reset(size_t i);
+
+    /**
+     * Runs every core until they've all halted (or are held), or one's
+     * debugger quits, on
+     * `hostThreads` threads (0 for one per core; a thread with more than one
+     * core runs them one after another each quantum). `between()` is called
+     * between quanta, on one thread with every core stopped, and can end the
+     * run early by returning false. If a core throws (a panic, a bad
+     * access...), the run stops at the end of that quantum and the exception
+     * is rethrown here.
+     * @return whether every core halted
+     */
+    auto run(uint64_t quantum, size_t hostThreads,
+             const std::function<bool()>& between) -> bool;
+
+  private:
+    /// `atomics`: whether it can run one, or has to stop in front of it
+    void runCore(Core& core, uint64_t quantum, bool atomics,
+                 std::exception_ptr& error);
+    /// fills core.stores from the pages its view has written, looking at
+    /// only those, so a quantum costs what it touched, however big memory is
+    void collectStores(Core& core);
+    /// writes them back, and has its view see memory again
+    void commit(Core& core);
+
+    MemPool mem;
+    Ordering ordering;
+    std::vector<std::unique_ptr<Core>> cores;
+};
+
+inline Core::Core(const MemPool& memory, MemPool::View view)
+    : cpu{}, mem(memory, view), quitting(false), debugger(cpu, mem, quitting),
+      iproxy(cpu, mem, debugger, std::make_shared<NullTracer>()),
+      engine(cpu, mem), retired(0), atomicPending(false), held(false) {}
+
+inline Card::Card(size_t words, size_t nCores, Ordering ordering)
+    : mem(words, MemPool::Backing::Shareable), ordering{ordering} {
+    if (nCores < 1 || nCores > MAX_CORES)
+        panic("a card has 1 to MAX_CORES cores");
+    auto view = ordering == Ordering::Deterministic ? MemPool::View::Private
+                                                    : MemPool::View::Shared;
+    for (size_t i = 0; i < nCores; i++)
+        cores.push_back(std::make_unique<Core>(mem, view));
+}
+
+inline void Card::reset(size_t i) {
+    auto& core = *cores.at(i);
+    core.cpu = CPUState{};
+    core.quitting = false;
+    core.stores.clear();
+    core.storedPages.clear();
+    core.atomicPending = false;
+    core.engine.codeFlushed();
+}
+
+inline void Card::runCore(Core& core, uint64_t quantum, bool atomics,
+                          std::exception_ptr& error) {
+    uint64_t left = quantum;
+    try {
+        core.engine.run(
+            [&](uint64_t pc, const DecodedInstruction<NullTracer>& inst) {
+                if (!atomics &&
+                    isa::opcodeInfo[isa::opcodeOf(bits<32>(inst.ir))]
+                            .category == isa::Category::Atomic) {
+                    // fetch it again next time
+                    core.cpu.pc.setTakenPC(pc);
+                    core.cpu.pc.setTaken(true);
+                    core.atomicPending = true;
+                    return false;
+                }
+                inst.execute(core.iproxy);
+                core.retired++;
+                // a breakpoint only stops this core; the others carry on
+                // to the end of the quantum and wait there
+                core.debugger.tick();
+                return !core.quitting && --left > 0;
+            });
+    } catch (...) {
+        error = std::current_exception();
+    }
+}
+
+inline void Card::collectStores(Core& core) {
+    const auto& view = core.mem.mempool;
+    size_t pageWords = MemPool::pageBytes() / 4;
+    core.stores.clear();
+    core.storedPages = core.mem.takeWrittenPages();
+    for (auto page : core.storedPages) {
+        size_t end = std::min((page + 1) * pageWords, mem.size());
+        for (size_t i = page * pageWords; i < end; i++)
+            if (view[i] != mem[i])
+                core.stores.emplace_back(i, view[i]);
+    }
+}
+
+inline void Card::commit(Core& core) {
+    for (auto [i, value] : core.stores)
+        mem[i] = value;
+    core.stores.clear();
+    core.mem.mempool.discard(core.storedPages);
+    core.storedPages.clear();
+}
+
+inline auto Card::run(uint64_t quantum, size_t hostThreads,
+                      const std::function<bool()>& between) -> bool {
+    if (quantum == 0)
+        panic("a quantum has to be at least one instruction");
+    size_t nThreads = hostThreads == 0 ? cores.size()
+                                       : std::min(hostThreads, cores.size());
+    bool deterministic = ordering == Ordering::Deterministic;
+
+    std::vector<std::exception_ptr> errors(cores.size());
+    std::exception_ptr betweenError;
+    bool done = false;
+    // runs once per quantum, on whichever thread gets to the barrier last
+    auto endQuantum = [&]() noexcept {
+        if (deterministic) {
+            try {
+                for (auto& core : cores)
+                    commit(*core);
+                for (size_t i = 0; i < cores.size(); i++) {
+                    auto& core = *cores[i];
+                    if (!core.atomicPending)
+                        continue;
+                    core.atomicPending = false;
+                    runCore(core, 1, true, errors[i]);
+                    collectStores(core);
+                    commit(core);
+                }
+            } catch (...) {
+                betweenError = std::current_exception();
+                done = true;
+                return;
+            }
+        }
+
+        bool idle = true;
+        for (size_t i = 0; i < cores.size(); i++) {
+            idle &= cores[i]->cpu.isHalted() || cores[i]->held;
+            done |= cores[i]->quitting || errors[i] != nullptr;
+        }
+        done |= idle;
+        if (done)
+            return;
+        try {
+            done = !between();
+        } catch (...) {
+            betweenError = std::current_exception();
+            done = true;
+        }
+    };
+    std::barrier sync(std::ptrdiff_t(nThreads), endQuantum);
+
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < nThreads; t++) {
+        threads.emplace_back([&, t] {
+            while (!done) {
+                for (size_t i = t; i < cores.size(); i += nThreads) {
+                    auto& core = *cores[i];
+                    // a halted core just sits the quantum out
+                    if (core.cpu.isHalted() || core.held)
+                        continue;
+                    runCore(core, quantum, !deterministic, errors[i]);
+                    // every core's view still has the memory this quantum
+                    // started with underneath it, so each can be compared
+                    // against that in parallel
+                    if (deterministic && !errors[i]) {
+                        try {
+                            collectStores(core);
+                        } catch (...) {
+                            errors[i] = std::current_exception();
+                        }
+                    }
+                }
+                sync.arrive_and_wait();
+            }
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+
+    for (auto& error : errors)
+        if (error)
+            std::rethrow_exception(error);
+    if (betweenError)
+        std::rethrow_exception(betweenError);
+
+    bool allHalted = true;
+    for (auto& core : cores)
+        allHalted &= core->cpu.isHalted();
+    return allHalted;
+}
@@ -0,0 +1,161 @@
+#include "checkpoint.h"
+
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include "lz.h"
+
+static constexpr char MAGIC[8] = {'M', 'O', 'R', 'P', 'H', 'C', 'K', 'P'};
+static constexpr uint32_t VERSION = 1;
+
+namespace {
+
+/// plain values, as they are in memory
+struct Writer {
+    std::ofstream& out;
+
+    template <typename V> void put(const V& v) {
+        static_assert(std::is_trivially_copyable_v<V>);
+        out.write(reinterpret_cast<const char*>(&v), sizeof(v));
+    }
+    void put(const MatrixUnit::Matrix& m) {
+        out.write(reinterpret_cast<const char*>(m.data()),
+                  m.size() * sizeof(float));
+    }
+};
+
+struct Reader {
+    std::ifstream& in;
+    const std::string& path;
+
+    void bytes(void* dst, size_t n) {
+        if (!in.read(static_cast<char*>(dst), std::streamsize(n)))
+            throw std::runtime_error(fmt::format("`{}` is cut short", path));
+    }
+    template <typename V> auto get() -> V {
+        static_assert(std::is_trivially_copyable_v<V>);
+        V v;
+        bytes(&v, sizeof(v));
+        return v;
+    }
+    void get(MatrixUnit::Matrix& m) {
+        bytes(m.data(), m.size() * sizeof(float));
+    }
+};
+
+} // namespace
+
+void saveCheckpoint(const std::string& path, const CPUState& cpu,
+                    const MemSystem& mem) {
+    std::ofstream out(path, std::ios::binary);
+    if (!out.is_open())
+        throw std::runtime_error(fmt::format("can't open `{}`", path));
+    Writer w{out};
+
+    out.write(MAGIC, sizeof(MAGIC));
+    w.put(VERSION);
+
+    for (size_t i = 0; i < ScalarRegisterFile::N_REGS; i++)
+        w.put(cpu.r[i].inner);
+    for (size_t i = 0; i < VectorRegisterFile::N_REGS; i++)
+        w.put(cpu.v[i]);
+    w.put(uint8_t(cpu.f.zero));
+    w.put(uint8_t(cpu.f.sign));
+    w.put(uint8_t(cpu.f.overflow));
+    w.put(uint8_t(cpu.halted));
+    w.put(cpu.pc.current);
+    w.put(uint8_t(cpu.pc.taken));
+    w.put(cpu.pc.aNotTaken);
+    w.put(cpu.pc.aTaken);
+    w.put(cpu.matUnit.A);
+    w.put(cpu.matUnit.B);
+    w.put(cpu.matUnit.C);
+    w.put(uint64_t(cpu.matUnit.systolicCycleCt));
+
+    uint64_t memBytes = mem.size();
+    uint64_t pageBytes = MemPool::pageBytes();
+    auto pages = mem.mempool.writtenPages();
+    w.put(memBytes);
+    w.put(pageBytes);
+    w.put(uint64_t(pages.size()));
+
+    auto* base = reinterpret_cast<const uint8_t*>(mem.mempool.data());
+    std::vector<uint8_t> packed(lz::bound(pageBytes));
+    for (auto page : pages) {
+        // the last page may only be partly emulated memory
+        auto at = page * pageBytes;
+        auto len = std::min(pageBytes, memBytes - at);
+        auto n = uint32_t(lz::compress(base + at, len, packed.data()));
+        w.put(page);
+        w.put(n);
+        out.write(reinterpret_cast<const char*>(packed.data()), n);
+    }
+
+    if (!out.flush())
+        throw std::runtime_error(fmt::format("can't write `{}`", path));
+}
+
+void restoreCheckpoint(const std::string& path, CPUState& cpu,
+                       MemSystem& mem) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open())
+        throw std::runtime_error(fmt::format("can't open `{}`", path));
+    Reader r{in, path};
+
+    char magic[sizeof(MAGIC)];
+    r.bytes(magic, sizeof(magic));
+    if (std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0)
+        throw std::runtime_error(fmt::format("`{}` isn't a checkpoint", path));
+    if (auto version = r.get<uint32_t>(); version != VERSION)
+        throw std::runtime_error(fmt::format(
+            "`{}` is a version {} checkpoint, but this build reads version {}",
+            path, version, VERSION));
+
+    for (size_t i = 0; i < ScalarRegisterFile::N_REGS; i++)
+        cpu.r[i].inner = r.get<uint64_t>();
+    for (size_t i = 0; i < VectorRegisterFile::N_REGS; i++)
+        cpu.v[i] = r.get<VectorRegisterFile::Reg>();
+    cpu.f.zero = r.get<uint8_t>() != 0;
+    cpu.f.sign = r.get<uint8_t>() != 0;
+    cpu.f.overflow = r.get<uint8_t>() != 0;
+    cpu.halted = r.get<uint8_t>() != 0;
+    cpu.pc.current = r.get<uint64_t>();
+    cpu.pc.taken = r.get<uint8_t>() != 0;
+    cpu.pc.aNotTaken = r.get<uint64_t>();
+    cpu.pc.aTaken = r.get<uint64_t>();
+    r.get(cpu.matUnit.A);
+    r.get(cpu.matUnit.B);
+    r.get(cpu.matUnit.C);
+    cpu.matUnit.systolicCycleCt = r.get<uint64_t>();
+
+    auto memBytes = r.get<uint64_t>();
+    if (memBytes != mem.size())
+        throw std::runtime_error(fmt::format(
+            "`{}` was taken with {} words of memory, not {} (see --mem-size)",
+            path, memBytes / 4, mem.size() / 4));
+    auto pageBytes = r.get<uint64_t>();
+    auto nPages = r.get<uint64_t>();
+    if (pageBytes == 0 || pageBytes > memBytes + MemPool::pageBytes())
+        throw std::runtime_error(
+            fmt::format("`{}` has a corrupt page size", path));
+
+    auto* base = reinterpret_cast<uint8_t*>(mem.mempool.data());
+    std::vector<uint8_t> packed;
+    for (uint64_t i = 0; i < nPages; i++) {
+        auto page = r.get<uint64_t>();
+        auto n = r.get<uint32_t>();
+        if (n > lz::bound(pageBytes) || page > (memBytes - 1) / pageBytes)
+            throw std::runtime_error(
+                fmt::format("`{}` has a corrupt page", path));
+        auto at = page * pageBytes;
+        packed.resize(n);
+        r.bytes(packed.data(), n);
+        lz::decompress(packed.data(), n, base + at,
+                       std::min(pageBytes, memBytes - at));
+    }
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <string>
+
+#include "cpu.h"
+#include "mem.h"
+
+/**
+ * Checkpoints: all of a CPUState (registers, flags, the PC's pending jump,
+ * the matrix unit), plus the pages of emulated memory the program has
+ * written, each LZ-compressed. Pages still exactly as the memory image left
+ * them aren't saved, so a checkpoint is restored on top of the same image.
+ * Nothing microarchitectural (cache or timing model state) is saved.
+ *
+ * The format is little-endian and only meant to be read back by the same
+ * build; see docs/checkpoint.md.
+ */
+
+/// throws std::runtime_error if `path` can't be written
+void saveCheckpoint(const std::string& path, const CPUState& cpu,
+                    const MemSystem& mem);
+
+/**
+ * Restores a checkpoint onto `cpu`, and onto `mem` after the memory image
+ * has been loaded into it. Throws std::runtime_error if `path` can't be read,
+ * isn't a checkpoint, or was taken with a different memory size.
+ */
+void restoreCheckpoint(const std::string& path, CPUState& cpu,
+                       MemSystem& mem);
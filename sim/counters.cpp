@@ -0,0 +1,74 @@
+#include "counters.h"
+
+#include <morph/util.h>
+
+#include "timing.h"
+
+PerfCounters::PerfCounters()
+    : counted{}, bias{}, selected{0}, timing{nullptr}, icache{nullptr},
+      dcache{nullptr} {}
+
+void PerfCounters::watch(const TimingModel* timing, const Cache* icache,
+                         const Cache* dcache) {
+    this->timing = timing;
+    this->icache = icache;
+    this->dcache = dcache;
+}
+
+auto PerfCounters::raw(Counter counter) const -> uint64_t {
+    switch (counter) {
+    case Counter::Cycles:
+        if (!timing)
+            panic("the cycle counter needs --timing");
+        return timing->cycles();
+    case Counter::DCacheMisses:
+        if (!dcache)
+            panic("the D-cache miss counter needs --dcache");
+        return dcache->stats().readMisses + dcache->stats().writeMisses;
+    case Counter::ICacheMisses:
+        if (!icache)
+            panic("the I-cache miss counter needs --icache");
+        return icache->stats().readMisses;
+    default:
+        return counted[static_cast<size_t>(counter)];
+    }
+}
+
+auto PerfCounters::read(Counter counter) const -> uint64_t {
+    return raw(counter) + bias[static_cast<size_t>(counter)];
+}
+
+void PerfCounters::write(Counter counter, uint64_t value) {
+    bias[static_cast<size_t>(counter)] = value - raw(counter);
+}
+
+auto PerfCounters::selection() const -> Counter {
+    // only checked once it's used, so selecting is just a write
+    if (selected >= N_COUNTERS)
+        panic("no such performance counter");
+    return static_cast<Counter>(selected);
+}
+
+auto PerfCounters::readCsr(uint64_t csr) const -> uint64_t {
+    switch (csr) {
+    case CSR_SELECT:
+        return selected;
+    case CSR_VALUE:
+        return read(selection()) & u<36>::mask;
+    default:
+        panic("no such CSR");
+    }
+}
+
+void PerfCounters::writeCsr(uint64_t csr, uint64_t value) {
+    switch (csr) {
+    case CSR_SELECT:
+        selected = value;
+        break;
+    case CSR_VALUE:
+        write(selection(), value);
+        break;
+    default:
+        panic("no such CSR");
+    }
+}
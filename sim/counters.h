@@ -0,0 +1,100 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include <morph/opcodes.h>
+#include <morph/varint.h>
+
+#include "cache.h"
+
+class TimingModel;
+
+enum class Counter : uint8_t {
+    Instructions,
+    Cycles, // needs --timing
+    Loads,
+    Stores,
+    VectorOps,
+    SystolicSteps,
+    DCacheMisses, // needs --dcache (or --timing)
+    ICacheMisses, // needs --icache (or --timing)
+};
+
+inline constexpr size_t N_COUNTERS = 8;
+
+/**
+ * Performance counters for programs to read about themselves, through the
+ * CSRs. There are only four CSR numbers, so two of them go through a
+ * selector:
+ *
+ * - `wcsr 0, rA` selects counter r[rA] (a Counter); `rcsr rD, 0` reads the
+ *   selection back.
+ * - `rcsr rD, 1` reads the selected counter, truncated to 36 bits;
+ *   `wcsr 1, rA` sets it, so a region can start from zero.
+ *
+ * Instructions, loads, stores, vector ops and systolic steps are counted as
+ * they retire. Cycles and cache misses are read off the timing model and
+ * cache models as they are, so they cost nothing until read.
+ */
+class PerfCounters {
+  public:
+    static constexpr uint64_t CSR_SELECT = 0;
+    static constexpr uint64_t CSR_VALUE = 1;
+
+    PerfCounters();
+
+    /// read cycles and misses from these (any of which may be nullptr)
+    void watch(const TimingModel* timing, const Cache* icache,
+               const Cache* dcache);
+
+    /// the instruction `ir` has just run
+    void retire(uint32_t ir) {
+        auto op = static_cast<isa::Opcode>(isa::opcodeOf(bits<32>(ir)));
+        counted[static_cast<size_t>(Counter::Instructions)]++;
+        switch (op) {
+        case isa::Opcode::ld32:
+        case isa::Opcode::ld36:
+        case isa::Opcode::vldi:
+        case isa::Opcode::vldr:
+            counted[static_cast<size_t>(Counter::Loads)]++;
+            break;
+        case isa::Opcode::st32:
+        case isa::Opcode::st36:
+        case isa::Opcode::vsti:
+        case isa::Opcode::vstr:
+            counted[static_cast<size_t>(Counter::Stores)]++;
+            break;
+        case isa::Opcode::systolicstep:
+            counted[static_cast<size_t>(Counter::SystolicSteps)]++;
+            break;
+        default:
+            if (isa::opcodeInfo[static_cast<size_t>(op)].category ==
+                isa::Category::Vector)
+                counted[static_cast<size_t>(Counter::VectorOps)]++;
+            break;
+        }
+    }
+
+    /// panics on a counter that isn't being modelled
+    [[nodiscard]] auto read(Counter counter) const -> uint64_t;
+    void write(Counter counter, uint64_t value);
+
+    // what rcsr and wcsr do with CSR number `csr`
+    [[nodiscard]] auto readCsr(uint64_t csr) const -> uint64_t;
+    void writeCsr(uint64_t csr, uint64_t value);
+
+  private:
+    /// before write()s are taken into account
+    [[nodiscard]] auto raw(Counter counter) const -> uint64_t;
+    [[nodiscard]] auto selection() const -> Counter;
+
+    std::array<uint64_t, N_COUNTERS> counted;
+    // added to each counter, so writing one doesn't disturb what it counts
+    std::array<uint64_t, N_COUNTERS> bias;
+    uint64_t selected;
+
+    const TimingModel* timing;
+    const Cache* icache;
+    const Cache* dcache;
+};
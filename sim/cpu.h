@@ -5,6 +5,7 @@
 #include <fmt/core.h>
 #include <iomanip>
 #include <iostream>
+#include <string>
 #include <vector>
 
 #include <morph/ty.h>
@@ -12,6 +13,13 @@
 
 #include "mem.h"
 
+template <typename T> class JitCompiler;
+struct CPUState;
+void saveCheckpoint(const std::string& path, const CPUState& cpu,
+                    const MemSystem& mem);
+void restoreCheckpoint(const std::string& path, CPUState& cpu,
+                       MemSystem& mem);
+
 struct ScalarRegisterFile {
     using Reg = u<36>;
     static constexpr size_t N_REGS = 32;
@@ -43,6 +51,12 @@ struct ConditionFlags {
     bool overflow = false;
 };
 
+// generated code (see jit.h) addresses registers and flags in place, so
+// these need to stay plain arrays of plain data.
+static_assert(sizeof(ScalarRegisterFile) == ScalarRegisterFile::N_REGS * 8);
+static_assert(sizeof(VectorRegisterFile) == VectorRegisterFile::N_REGS * 16);
+static_assert(sizeof(ConditionFlags) == 3);
+
 inline std::ostream& operator<<(std::ostream& os, const ConditionFlags& f) {
     if (f.zero)
         os << 'Z';
@@ -84,6 +98,14 @@ struct PC {
     [[nodiscard]] auto wasTaken() const -> uint64_t { return taken; }
 
   private:
+    // catches the PC up after running straight-line code
+    template <typename T> friend class JitCompiler;
+    // checkpoints save and restore the jump in flight too
+    friend void saveCheckpoint(const std::string& path, const CPUState& cpu,
+                               const MemSystem& mem);
+    friend void restoreCheckpoint(const std::string& path, CPUState& cpu,
+                                  MemSystem& mem);
+
     uint64_t current;
 
     bool taken;
@@ -331,6 +331,22 @@ void st36(CPUState& cpu, MemSystem& mem, reg_idx rA, reg_idx rB, s<15> imm) {
     mem.write(addr, val);
 }
 
+// -- atomics
+void fa(CPUState& cpu, MemSystem& mem, reg_idx rD, reg_idx rA, s<15> imm) {
+    u<36> addr = cpu.r[rA];
+    cpu.r[rD].inner = mem.fetchAdd36(addr.raw(), uint64_t(imm._sgn_inner()));
+}
+
+/// swaps in rB if the word is rD; either way, rD gets the word, and the zero
+/// flag says whether it swapped
+void cmpx(CPUState& cpu, MemSystem& mem, reg_idx rD, reg_idx rA, reg_idx rB) {
+    u<36> addr = cpu.r[rA];
+    auto expected = cpu.r[rD].inner;
+    auto old = mem.compareExchange36(addr.raw(), expected, cpu.r[rB].inner);
+    cpu.r[rD].inner = old;
+    cpu.f.zero = old == expected;
+}
+
 // -- vector memory instructions
 void vldi(CPUState& cpu, MemSystem& mem, vreg_idx vD, reg_idx rA, s<11> imm,
           vmask_t mask) {
@@ -8,6 +8,7 @@
 #include <morph/decoder.h>
 #include <morph/util.h>
 
+#include "counters.h"
 #include "cpu.h"
 #include "debugger.h"
 #include "instructions.h"
@@ -26,12 +27,24 @@
     HANDLE_BR(suffix, le, ##__VA_ARGS__)                                       \
     HANDLE_BR(suffix, ge, ##__VA_ARGS__)
 
-class CPUInstructionProxy : public isa::InstructionVisitor {
+/**
+ * Executes instructions against a CPUState/MemSystem, reporting each one's
+ * operands and results to a `T`.
+ *
+ * The tracer type is fixed at compile time, and NullTracer and FileTracer
+ * are final, so the tracer calls are direct; with NullTracer they inline
+ * away to nothing. The binary picks which instantiation to run at startup.
+ */
+template <typename T>
+class CPUInstructionProxy final : public isa::InstructionVisitor {
   public:
     ~CPUInstructionProxy() override = default;
     CPUInstructionProxy(CPUState& cpu, MemSystem& mem, Debugger& dbg,
-                        std::shared_ptr<Tracer> tracer)
-        : cpu{cpu}, mem{mem}, dbg{dbg}, tracer{tracer} {}
+                        std::shared_ptr<T> tracer)
+        : cpu{cpu}, mem{mem}, dbg{dbg}, tracer{tracer}, counters{nullptr} {}
+
+    /// what rcsr and wcsr read and write; without any, they panic
+    void countInto(PerfCounters* counters) { this->counters = counters; }
 
     // misc
     void nop() override { instructions::nop(cpu, mem); }
@@ -518,16 +531,53 @@ class CPUInstructionProxy : public isa::InstructionVisitor {
     }
 
     // -- atomics
-    void fa(reg_idx rD, reg_idx rA, s<15> imm) override { unimplemented(); }
+    void fa(reg_idx rD, reg_idx rA, s<15> imm) override {
+        tracer->scalarRegInput(cpu, "rA", rA);
+        tracer->immInput(imm._sgn_inner());
+
+        instructions::fa(cpu, mem, rD, rA, imm);
+
+        tracer->scalarRegOutput(cpu, "rD", rD);
+    }
+
+    void cmpx(reg_idx rD, reg_idx rA, s<15> imm) override {
+        // rB rides in the top of the immediate field
+        reg_idx rB = imm.raw() >> 10;
+        tracer->scalarRegInput(cpu, "rD", rD);
+        tracer->scalarRegInput(cpu, "rA", rA);
+        tracer->scalarRegInput(cpu, "rB", rB);
+
+        instructions::cmpx(cpu, mem, rD, rA, rB);
 
-    void cmpx(reg_idx rD, reg_idx rA, s<15> imm) override { unimplemented(); }
+        tracer->scalarRegOutput(cpu, "rD", rD);
+        tracer->flagsWriteback(cpu.f);
+    }
+
+    // -- CSRs, which are all performance counters
+    void wcsr(s<2> csr, reg_idx rA) override {
+        tracer->immInput(csr.raw());
+        tracer->scalarRegInput(cpu, "rA", rA);
+
+        perfCounters().writeCsr(csr.raw(), cpu.r[rA].inner);
+    }
+    void rcsr(s<2> csr, reg_idx rA) override {
+        tracer->immInput(csr.raw());
+
+        cpu.r[rA].inner = perfCounters().readCsr(csr.raw());
 
-    void wcsr(s<2> csr, reg_idx rA) override { unimplemented(); }
-    void rcsr(s<2> csr, reg_idx rA) override { unimplemented(); }
+        tracer->scalarRegOutput(cpu, "rA", rA);
+    }
 
   private:
+    auto perfCounters() -> PerfCounters& {
+        if (!counters)
+            panic("the CSRs are performance counters, which need --counters");
+        return *counters;
+    }
+
     CPUState& cpu;
     MemSystem& mem;
     Debugger& dbg;
-    std::shared_ptr<Tracer> tracer;
+    std::shared_ptr<T> tracer;
+    PerfCounters* counters;
 };
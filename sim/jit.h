@@ -0,0 +1,578 @@
+#pragma once
+
+#include <cstdint>
+#include <exception>
+#include <utility>
+#include <vector>
+
+#include <morph/decoder.h>
+
+#include "cpu.h"
+#include "iproxy.h"
+#include "mem.h"
+#include "predecode.h"
+#include "x64.h"
+
+/// Compiled basic block. Returns false if it had to stop partway through.
+template <typename T>
+using NativeBlock = bool (*)(CPUState*, CPUInstructionProxy<T>*);
+
+/**
+ * Emits native code for one instruction at a time, addressing the
+ * register files and flags in place.
+ *
+ * Anything without a native lowering below (branches, the matrix unit, ...)
+ * becomes a call out to the instruction's predecoded handler, so it still
+ * goes through CPUInstructionProxy and MemSystem.
+ *
+ * Loads and stores are done inline, straight on the MemPool, behind a few
+ * instructions that make the same checks MemSystem would: aligned, in
+ * bounds and, for stores, nowhere near code we've fetched. An access that
+ * fails them is called out instead, to panic or invalidate as usual. That's
+ * only done when nothing is watching memory traffic: no tracer, no cache
+ * model.
+ */
+template <typename T> class JitEmitter final : public isa::InstructionVisitor {
+  public:
+    using Asm = x64::Assembler;
+
+    struct PCFields {
+        x64::Mem current, taken, aNotTaken, aTaken;
+    };
+
+    JitEmitter(Asm& a, CPUState& cpu, MemSystem& mem, PCFields pcFields,
+               std::exception_ptr* pending, const uint64_t* epoch)
+        : a{a}, cpu{cpu}, mem{mem}, pcFields{pcFields}, pending{pending},
+          epoch{epoch}, pc{0}, inst{nullptr}, supported{true},
+          calledOut{false}, bails{} {}
+    ~JitEmitter() override = default;
+
+    // set up for the next instruction, then run the decoder over it
+    void at(uint64_t nextPC, const DecodedInstruction<T>& nextInst) {
+        pc = nextPC;
+        inst = &nextInst;
+        calledOut = false;
+    }
+
+    /// put the PC where getNewPC() would have left it for the current
+    /// instruction, which the interpreter's main loop expects after it
+    void catchUpPC() {
+        a.movImm64(x64::rax, pc);
+        a.mov(pcFields.current, x64::rax);
+        a.alu(x64::AluOp::Add, x64::rax, 4);
+        a.mov(pcFields.aNotTaken, x64::rax);
+        a.mov(pcFields.aTaken, x64::rax);
+        a.movByte(pcFields.taken, 0);
+    }
+
+    Asm& a;
+    CPUState& cpu;
+    MemSystem& mem;
+    PCFields pcFields;
+    std::exception_ptr* pending;
+    const uint64_t* epoch;
+
+    uint64_t pc;
+    const DecodedInstruction<T>* inst;
+    bool supported; // false if this block can't be compiled
+    bool calledOut; // last instruction went through callOut()
+    std::vector<size_t> bails; // jumps to the early-exit path
+
+    // misc
+    void nop() override {}
+    void halt() override { callOut(); }
+    // the debugger needs to get control back right after this
+    void bkpt(bits<25> signal) override { supported = false; }
+
+    // control flow
+    void jmp(s<25> imm) override { callOut(); }
+    void jal(s<25> imm) override { callOut(); }
+    void jmpr(reg_idx rA, s<20> imm) override { callOut(); }
+    void jalr(reg_idx rA, s<20> imm) override { callOut(); }
+    void branchimm(condition_t cond, s<22> imm) override { callOut(); }
+    void branchreg(condition_t cond, reg_idx rA, s<17> imm) override {
+        callOut();
+    }
+
+    void lil(reg_idx rD, s<18> imm) override {
+        a.mov(x64::rax, r(rD));
+        a.alu(x64::AluOp::And, x64::rax, ~0x3ffff);
+        a.alu(x64::AluOp::Or, x64::rax, static_cast<int32_t>(imm.raw()));
+        a.mov(r(rD), x64::rax);
+    }
+    void lih(reg_idx rD, s<18> imm) override {
+        a.mov(x64::rax, r(rD));
+        a.movImm64(x64::rcx, ~(0x3ffffULL << 18));
+        a.alu(x64::AluOp::And, x64::rax, x64::rcx);
+        a.movImm64(x64::rcx, imm.raw() << 18);
+        a.alu(x64::AluOp::Or, x64::rax, x64::rcx);
+        a.mov(r(rD), x64::rax);
+    }
+
+    // memory. the vector forms ignore their mask, like the interpreter, and
+    // post-increment rA without wrapping it to 36 bits, also like it.
+    void vldi(vreg_idx vD, reg_idx rA, s<11> imm, vmask_t mask) override {
+        access(rA, 0, 16, false, [&] {
+            a.movups(x64::xmm0, x64::Mem{x64::rdx, 0});
+            a.movups(v(vD), x64::xmm0);
+            postIncrement(rA, static_cast<int32_t>(imm._sgn_inner() * 16));
+        });
+    }
+    void vsti(s<11> imm, reg_idx rA, vreg_idx vB, vmask_t mask) override {
+        access(rA, 0, 16, true, [&] {
+            a.movups(x64::xmm0, v(vB));
+            a.movups(x64::Mem{x64::rdx, 0}, x64::xmm0);
+            postIncrement(rA, static_cast<int32_t>(imm._sgn_inner() * 16));
+        });
+    }
+    void vldr(vreg_idx vD, reg_idx rA, reg_idx rB, vmask_t mask) override {
+        access(rA, 0, 16, false, [&] {
+            a.movups(x64::xmm0, x64::Mem{x64::rdx, 0});
+            a.movups(v(vD), x64::xmm0);
+            postIncrement(rA, rB);
+        });
+    }
+    void vstr(reg_idx rA, reg_idx rB, vreg_idx vA, vmask_t mask) override {
+        access(rA, 0, 16, true, [&] {
+            a.movups(x64::xmm0, v(vA));
+            a.movups(x64::Mem{x64::rdx, 0}, x64::xmm0);
+            postIncrement(rA, rB);
+        });
+    }
+    void ld(reg_idx rD, reg_idx rA, s<15> imm, bool b36) override {
+        auto offset = static_cast<int32_t>(imm._sgn_inner());
+        access(rA, offset, b36 ? 8 : 4, false, [&] {
+            // ld36 takes all of the next word, same as MemSystem::read36
+            if (b36)
+                a.mov(x64::rax, x64::Mem{x64::rdx, 0});
+            else
+                a.mov32(x64::rax, x64::Mem{x64::rdx, 0});
+            a.mov(r(rD), x64::rax);
+        });
+    }
+    void st(reg_idx rA, reg_idx rB, s<15> imm, bool b36) override {
+        auto offset = static_cast<int32_t>(imm._sgn_inner());
+        access(rA, offset, b36 ? 8 : 4, true, [&] {
+            a.mov(x64::rcx, r(rB));
+            if (b36) {
+                mask36(x64::rcx);
+                a.mov(x64::Mem{x64::rdx, 0}, x64::rcx);
+            } else {
+                a.mov32(x64::Mem{x64::rdx, 0}, x64::rcx);
+            }
+        });
+    }
+
+    void scalarArithmetic(reg_idx rD, reg_idx rA, reg_idx rB,
+                          isa::ScalarArithmeticOp op) override {
+        using Op = isa::ScalarArithmeticOp;
+
+        a.mov(x64::rax, r(rA));
+        a.mov(x64::rcx, r(rB));
+        switch (op) {
+        case Op::Add:
+            a.alu(x64::AluOp::Add, x64::rax, x64::rcx);
+            mask36(x64::rax);
+            break;
+        case Op::Sub:
+            a.alu(x64::AluOp::Sub, x64::rax, x64::rcx);
+            mask36(x64::rax);
+            break;
+        case Op::Mul:
+            a.imul(x64::rax, x64::rcx);
+            mask36(x64::rax);
+            break;
+        case Op::And:
+            a.alu(x64::AluOp::And, x64::rax, x64::rcx);
+            break;
+        case Op::Or:
+            a.alu(x64::AluOp::Or, x64::rax, x64::rcx);
+            break;
+        case Op::Xor:
+            a.alu(x64::AluOp::Xor, x64::rax, x64::rcx);
+            break;
+        case Op::Shr:
+        case Op::Shl:
+            // shift amount is rB[3:0]
+            a.alu(x64::AluOp::And, x64::rcx, 0xf);
+            mask36(x64::rax);
+            a.shiftCl(op == Op::Shl ? x64::ShiftOp::Shl : x64::ShiftOp::Shr,
+                      x64::rax);
+            mask36(x64::rax);
+            break;
+        }
+        a.mov(r(rD), x64::rax);
+    }
+
+    void scalarArithmeticImmediate(reg_idx rD, reg_idx rA, s<15> imm,
+                                   isa::ScalarArithmeticOp op) override {
+        using Op = isa::ScalarArithmeticOp;
+
+        auto simm = static_cast<int32_t>(imm._sgn_inner());
+        // the logical ops take the immediate zero-extended
+        auto uimm = static_cast<int32_t>(imm.raw());
+
+        a.mov(x64::rax, r(rA));
+        switch (op) {
+        case Op::Add:
+            a.alu(x64::AluOp::Add, x64::rax, simm);
+            break;
+        case Op::Sub:
+            a.alu(x64::AluOp::Sub, x64::rax, simm);
+            break;
+        case Op::And:
+            a.alu(x64::AluOp::And, x64::rax, uimm);
+            break;
+        case Op::Or:
+            a.alu(x64::AluOp::Or, x64::rax, uimm);
+            break;
+        case Op::Xor:
+            a.alu(x64::AluOp::Xor, x64::rax, uimm);
+            break;
+        case Op::Shr:
+        case Op::Shl:
+            // out-of-range shift amounts are left to the C++ implementation
+            if (simm < 0 || simm >= 64)
+                return callOut();
+            a.shift(op == Op::Shl ? x64::ShiftOp::Shl : x64::ShiftOp::Shr,
+                    x64::rax, static_cast<uint8_t>(simm));
+            break;
+        default:
+            return callOut();
+        }
+        mask36(x64::rax);
+        a.mov(r(rD), x64::rax);
+    }
+
+    void cmpI(reg_idx rA, s<20> imm) override {
+        a.mov(x64::rax, r(rA));
+        sext36(x64::rax);
+        a.movImm32(x64::rcx, static_cast<int32_t>(imm._sgn_inner()));
+        compare();
+    }
+    void arithmeticNot(reg_idx rD, reg_idx rA) override {
+        a.mov(x64::rax, r(rA));
+        a.not_(x64::rax);
+        mask36(x64::rax);
+        a.mov(r(rD), x64::rax);
+    }
+    void floatArithmetic(reg_idx rD, reg_idx rA, reg_idx rB,
+                         isa::FloatArithmeticOp op) override {
+        callOut();
+    }
+    void cmp(reg_idx rA, reg_idx rB) override {
+        a.mov(x64::rax, r(rA));
+        sext36(x64::rax);
+        a.mov(x64::rcx, r(rB));
+        sext36(x64::rcx);
+        compare();
+    }
+
+    void vectorArithmetic(isa::LanewiseVectorOp op, vreg_idx vD, vreg_idx vA,
+                          vreg_idx vB, vmask_t mask) override {
+        using Op = isa::LanewiseVectorOp;
+
+        // min/max don't agree with std::min/max about NaNs, and partial
+        // masks would need a blend
+        if (mask.inner != 0xf || op == Op::Min || op == Op::Max)
+            return callOut();
+
+        x64::PackedOp packed = x64::PackedOp::Add;
+        switch (op) {
+        case Op::Add:
+            packed = x64::PackedOp::Add;
+            break;
+        case Op::Sub:
+            packed = x64::PackedOp::Sub;
+            break;
+        case Op::Mul:
+            packed = x64::PackedOp::Mul;
+            break;
+        case Op::Div:
+            packed = x64::PackedOp::Div;
+            break;
+        default:
+            break;
+        }
+
+        a.movups(x64::xmm0, v(vA));
+        a.movups(x64::xmm1, v(vB));
+        a.packed(packed, x64::xmm0, x64::xmm1);
+        a.movups(v(vD), x64::xmm0);
+    }
+    void vdot(reg_idx rD, vreg_idx vA, vreg_idx vB) override { callOut(); }
+    void vdota(reg_idx rD, reg_idx rA, vreg_idx vA, vreg_idx vB) override {
+        callOut();
+    }
+    void vidx(reg_idx rD, vreg_idx vA, vlaneidx_t imm) override { callOut(); }
+    void vreduce(reg_idx rD, vreg_idx vA, vmask_t mask) override {
+        callOut();
+    }
+    void vsplat(vreg_idx vD, reg_idx rA, vmask_t mask) override { callOut(); }
+    void vswizzle(vreg_idx vD, vreg_idx vA, vlaneidx_t i0, vlaneidx_t i1,
+                  vlaneidx_t i2, vlaneidx_t i3, vmask_t mask) override {
+        callOut();
+    }
+    void vectorScalarArithmetic(isa::VectorScalarOp op, vreg_idx vD, reg_idx rA,
+                                vreg_idx vB, vmask_t mask) override {
+        callOut();
+    }
+    void vsma(vreg_idx vD, reg_idx rA, vreg_idx vA, vreg_idx vB,
+              vmask_t mask) override {
+        callOut();
+    }
+    void vcomp(vreg_idx vD, reg_idx rA, reg_idx rB, vreg_idx vB,
+               vmask_t mask) override {
+        callOut();
+    }
+
+    void matrixWrite(isa::MatrixWriteOp op, u<3> idx, vreg_idx vA,
+                     vreg_idx vB) override {
+        callOut();
+    }
+    void matmul() override { callOut(); }
+    void systolicstep() override { callOut(); }
+    void readC(vreg_idx vD, u<3> idx, bool high) override { callOut(); }
+
+    void flushdirty() override { callOut(); }
+    void flushclean() override { callOut(); }
+    void flushicache() override { callOut(); }
+    void flushline(reg_idx rA, s<20> imm) override { callOut(); }
+
+    void fa(reg_idx rD, reg_idx rA, s<15> imm) override { callOut(); }
+    void cmpx(reg_idx rD, reg_idx rA, s<15> imm) override { callOut(); }
+
+    void ftoi(reg_idx rD, reg_idx rA) override { callOut(); }
+    void itof(reg_idx rD, reg_idx rA) override { callOut(); }
+
+    void wcsr(s<2> csr, reg_idx rA) override { callOut(); }
+    void rcsr(s<2> csr, reg_idx rA) override { callOut(); }
+
+    void cmpdec(reg_idx rD, reg_idx rA, reg_idx rB) override {
+        cmp(rD, rA);
+        scalarArithmetic(rD, rD, rB, isa::ScalarArithmeticOp::Sub);
+    }
+    void cmpinc(reg_idx rD, reg_idx rA, reg_idx rB) override {
+        cmp(rD, rA);
+        scalarArithmetic(rD, rD, rB, isa::ScalarArithmeticOp::Add);
+    }
+
+  private:
+    static auto callHandler(CPUInstructionProxy<T>* proxy,
+                            const DecodedInstruction<T>* inst,
+                            std::exception_ptr* pending) noexcept -> bool {
+        // exceptions can't unwind through generated code, so carry them
+        // over it by hand
+        try {
+            inst->execute(*proxy);
+            return true;
+        } catch (...) {
+            *pending = std::current_exception();
+            return false;
+        }
+    }
+
+    void callOut() {
+        catchUpPC();
+
+        a.mov(x64::rdi, x64::r12);
+        a.movImm64(x64::rsi, reinterpret_cast<uint64_t>(inst));
+        a.movImm64(x64::rdx, reinterpret_cast<uint64_t>(pending));
+        a.movImm64(x64::rax, reinterpret_cast<uint64_t>(&callHandler));
+        a.call(x64::rax);
+        a.testAl();
+        bails.push_back(a.jcc(x64::Cond::e));
+
+        // the rest of the block is stale if that stored into it
+        a.movImm64(x64::rax, reinterpret_cast<uint64_t>(epoch));
+        a.cmp(x64::r13, x64::Mem{x64::rax, 0});
+        bails.push_back(a.jcc(x64::Cond::ne));
+
+        calledOut = true;
+    }
+
+    /**
+     * Memory access of `bytes` at (rA + offset) mod 2^36. `body` does it at
+     * the host address in rdx, if the address passes the checks; otherwise
+     * the instruction is called out.
+     */
+    template <typename Body>
+    void access(reg_idx rA, int32_t offset, unsigned bytes, bool store,
+                Body&& body) {
+        if (mem.tracer || mem.dcache)
+            return callOut();
+
+        std::vector<size_t> slow;
+        a.mov(x64::rax, r(rA));
+        if (offset != 0)
+            a.alu(x64::AluOp::Add, x64::rax, offset);
+        mask36(x64::rax);
+
+        // aligned
+        a.mov(x64::rcx, x64::rax);
+        a.alu(x64::AluOp::And, x64::rcx, static_cast<int32_t>(bytes - 1));
+        slow.push_back(a.jcc(x64::Cond::ne));
+        // in bounds
+        if (mem.size() < bytes) {
+            slow.push_back(a.jmp());
+        } else {
+            a.movImm64(x64::rcx, mem.size() - bytes);
+            a.alu(x64::AluOp::Cmp, x64::rax, x64::rcx);
+            slow.push_back(a.jcc(x64::Cond::a));
+        }
+        // clear of [codeLo, codeHi), which grows as code gets fetched
+        if (store) {
+            a.movImm64(x64::rcx, reinterpret_cast<uint64_t>(&mem.codeHi));
+            a.cmp(x64::rax, x64::Mem{x64::rcx, 0});
+            auto clear = a.jcc(x64::Cond::ae);
+            a.mov(x64::rdx, x64::rax);
+            a.alu(x64::AluOp::Add, x64::rdx, static_cast<int32_t>(bytes));
+            a.movImm64(x64::rcx, reinterpret_cast<uint64_t>(&mem.codeLo));
+            a.cmp(x64::rdx, x64::Mem{x64::rcx, 0});
+            slow.push_back(a.jcc(x64::Cond::a));
+            a.bind(clear);
+        }
+
+        a.movImm64(x64::rdx, reinterpret_cast<uint64_t>(mem.mempool.data()));
+        a.alu(x64::AluOp::Add, x64::rdx, x64::rax);
+        body();
+        auto done = a.jmp();
+
+        for (auto at : slow)
+            a.bind(at);
+        callOut();
+        a.bind(done);
+        // the PC only got caught up on the slow path
+        calledOut = false;
+    }
+
+    void postIncrement(reg_idx rA, int32_t by) {
+        a.mov(x64::rax, r(rA));
+        a.alu(x64::AluOp::Add, x64::rax, by);
+        a.mov(r(rA), x64::rax);
+    }
+    void postIncrement(reg_idx rA, reg_idx rB) {
+        a.mov(x64::rax, r(rA));
+        a.mov(x64::rcx, r(rB));
+        a.alu(x64::AluOp::Add, x64::rax, x64::rcx);
+        a.mov(r(rA), x64::rax);
+    }
+
+    // flags from rax - rcx, both already sign extended from 36 bits, the
+    // same way instructions::cmp computes them
+    void compare() {
+        a.mov(x64::rdx, x64::rax);
+        a.alu(x64::AluOp::Sub, x64::rdx, x64::rcx);
+        a.set(x64::Cond::e, flag(&cpu.f.zero));
+        a.set(x64::Cond::s, flag(&cpu.f.sign));
+        // overflow: operand signs differ, and result sign differs from rA's
+        a.alu(x64::AluOp::Xor, x64::rcx, x64::rax);
+        a.alu(x64::AluOp::Xor, x64::rax, x64::rdx);
+        a.alu(x64::AluOp::And, x64::rax, x64::rcx);
+        a.bt(x64::rax, 35);
+        a.set(x64::Cond::c, flag(&cpu.f.overflow));
+    }
+
+    void mask36(x64::Reg reg) {
+        a.shift(x64::ShiftOp::Shl, reg, 28);
+        a.shift(x64::ShiftOp::Shr, reg, 28);
+    }
+    void sext36(x64::Reg reg) {
+        a.shift(x64::ShiftOp::Shl, reg, 28);
+        a.shift(x64::ShiftOp::Sar, reg, 28);
+    }
+
+    auto field(const void* p) const -> x64::Mem {
+        auto offs = static_cast<const char*>(p) -
+                    reinterpret_cast<const char*>(&cpu);
+        return x64::Mem{x64::rbx, static_cast<int32_t>(offs)};
+    }
+    auto r(reg_idx idx) const -> x64::Mem { return field(&cpu.r[idx].inner); }
+    auto v(vreg_idx idx) const -> x64::Mem { return field(&cpu.v[idx]); }
+    auto flag(const bool* f) const -> x64::Mem { return field(f); }
+};
+
+/**
+ * Compiles basic blocks to x86-64.
+ *
+ * Generated code is entered with the CPUState and CPUInstructionProxy to
+ * run against, and leaves the PC exactly as the interpreter would after the
+ * block. It stops early (returning false) if a called-out instruction
+ * throws, which `rethrowPending` then picks back up, or if it invalidates
+ * translated code, including possibly the rest of its own block.
+ */
+template <typename T> class JitCompiler {
+  public:
+    JitCompiler(CPUState& cpu, MemSystem& mem, const uint64_t& epoch)
+        : cpu{cpu}, mem{mem}, epoch{epoch}, arena{}, pending{} {}
+
+    /// nullptr if the block can't be (or wasn't) compiled
+    auto compile(uint64_t start,
+                 const std::vector<DecodedInstruction<T>>& insts)
+        -> NativeBlock<T> {
+        x64::Assembler a;
+        JitEmitter<T> emit(a, cpu, mem, pcFields(), &pending, &epoch);
+
+        // SysV: rdi = cpu, rsi = proxy. keep them (and the epoch we started
+        // in) in callee-saved regs; three pushes also realign the stack.
+        a.push(x64::rbx);
+        a.push(x64::r12);
+        a.push(x64::r13);
+        a.mov(x64::rbx, x64::rdi);
+        a.mov(x64::r12, x64::rsi);
+        a.movImm64(x64::rax, reinterpret_cast<uint64_t>(&epoch));
+        a.mov(x64::r13, x64::Mem{x64::rax, 0});
+
+        uint64_t pc = start;
+        for (auto& inst : insts) {
+            emit.at(pc, inst);
+            isa::decodeInstruction(emit, bits<32>(inst.ir));
+            if (!emit.supported)
+                return nullptr;
+            pc += 4;
+        }
+        if (!emit.calledOut)
+            emit.catchUpPC();
+
+        a.movImm32(x64::rax, 1);
+        epilogue(a);
+
+        for (auto at : emit.bails)
+            a.bind(at);
+        a.movImm32(x64::rax, 0);
+        epilogue(a);
+
+        return reinterpret_cast<NativeBlock<T>>(
+            const_cast<void*>(arena.commit(a.bytes())));
+    }
+
+    /// after a NativeBlock returns false
+    void rethrowPending() {
+        if (pending)
+            std::rethrow_exception(std::exchange(pending, nullptr));
+    }
+
+  private:
+    static void epilogue(x64::Assembler& a) {
+        a.pop(x64::r13);
+        a.pop(x64::r12);
+        a.pop(x64::rbx);
+        a.ret();
+    }
+
+    auto pcFields() -> typename JitEmitter<T>::PCFields {
+        auto at = [&](const void* p) {
+            auto offs = static_cast<const char*>(p) -
+                        reinterpret_cast<const char*>(&cpu);
+            return x64::Mem{x64::rbx, static_cast<int32_t>(offs)};
+        };
+        return {at(&cpu.pc.current), at(&cpu.pc.taken), at(&cpu.pc.aNotTaken),
+                at(&cpu.pc.aTaken)};
+    }
+
+    CPUState& cpu;
+    MemSystem& mem;
+    const uint64_t& epoch;
+    x64::CodeArena arena;
+    std::exception_ptr pending;
+};
@@ -0,0 +1,180 @@
+#include "lz.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+namespace lz {
+
+static constexpr size_t MIN_MATCH = 4;
+static constexpr size_t MAX_OFFSET = 65535;
+// the format ends every block with literals: the last match has to start
+// at least MF_LIMIT bytes before the end, and stop LAST_LITERALS before it
+static constexpr size_t MF_LIMIT = 12;
+static constexpr size_t LAST_LITERALS = 5;
+static constexpr unsigned HASH_BITS = 14;
+
+static auto load32(const uint8_t* p) -> uint32_t {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof v);
+    return v;
+}
+
+static auto load64(const uint8_t* p) -> uint64_t {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof v);
+    return v;
+}
+
+static auto hash(uint32_t v) -> uint32_t {
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static void writeLength(uint8_t*& out, size_t len) {
+    for (; len >= 255; len -= 255)
+        *out++ = 255;
+    *out++ = static_cast<uint8_t>(len);
+}
+
+static void writeLiterals(uint8_t*& out, uint8_t* token, const uint8_t* lit,
+                          size_t n) {
+    *token = static_cast<uint8_t>(std::min<size_t>(n, 15) << 4);
+    if (n >= 15)
+        writeLength(out, n - 15);
+    std::memcpy(out, lit, n);
+    out += n;
+}
+
+auto compress(const uint8_t* src, size_t n, uint8_t* dst) -> size_t {
+    const uint8_t* end = src + n;
+    const uint8_t* anchor = src; // first literal not yet written
+    uint8_t* out = dst;
+
+    if (n > MF_LIMIT) {
+        // where each hashed 4-byte sequence was last seen, as an offset
+        std::vector<uint32_t> table(1 << HASH_BITS);
+        const uint8_t* matchLimit = end - LAST_LITERALS;
+        const uint8_t* ipLimit = end - MF_LIMIT;
+        const uint8_t* ip = src + 1;
+
+        while (ip < ipLimit) {
+            auto seq = load32(ip);
+            auto& slot = table[hash(seq)];
+            const uint8_t* ref = src + slot;
+            slot = static_cast<uint32_t>(ip - src);
+
+            if (ref >= ip || size_t(ip - ref) > MAX_OFFSET ||
+                load32(ref) != seq) {
+                // speed up through data that isn't compressing
+                ip += 1 + ((ip - anchor) >> 6);
+                continue;
+            }
+
+            while (ip > anchor && ref > src && ip[-1] == ref[-1])
+                ip--, ref--;
+
+            const uint8_t* mp = ip + MIN_MATCH;
+            const uint8_t* rp = ref + MIN_MATCH;
+            while (mp + 8 <= matchLimit) {
+                auto diff = load64(mp) ^ load64(rp);
+                if (diff) {
+                    mp += __builtin_ctzll(diff) / 8;
+                    goto matched;
+                }
+                mp += 8, rp += 8;
+            }
+            while (mp < matchLimit && *mp == *rp)
+                mp++, rp++;
+        matched:
+
+            uint8_t* token = out++;
+            writeLiterals(out, token, anchor, ip - anchor);
+            auto offset = static_cast<uint16_t>(ip - ref);
+            *out++ = offset & 0xff;
+            *out++ = offset >> 8;
+            size_t len = (mp - ip) - MIN_MATCH;
+            *token |= static_cast<uint8_t>(std::min<size_t>(len, 15));
+            if (len >= 15)
+                writeLength(out, len - 15);
+
+            ip = anchor = mp;
+            // the next match often starts inside this one
+            table[hash(load32(ip - 2))] = static_cast<uint32_t>(ip - 2 - src);
+        }
+    }
+
+    uint8_t* token = out++;
+    writeLiterals(out, token, anchor, end - anchor);
+    return out - dst;
+}
+
+static auto readLength(const uint8_t*& ip, const uint8_t* end) -> size_t {
+    size_t len = 0;
+    uint8_t b;
+    do {
+        if (ip == end)
+            throw std::runtime_error("lz: block ends inside a length");
+        b = *ip++;
+        len += b;
+    } while (b == 255);
+    return len;
+}
+
+void decompress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t n) {
+    const uint8_t* ip = src;
+    const uint8_t* iend = src + srcSize;
+    uint8_t* op = dst;
+    uint8_t* oend = dst + n;
+
+    while (true) {
+        if (ip == iend)
+            throw std::runtime_error("lz: block ends inside a sequence");
+        uint8_t token = *ip++;
+
+        size_t lit = token >> 4;
+        if (lit == 15)
+            lit += readLength(ip, iend);
+        if (lit > size_t(iend - ip) || lit > size_t(oend - op))
+            throw std::runtime_error("lz: literals run past the block");
+        std::memcpy(op, ip, lit);
+        ip += lit, op += lit;
+
+        // only the last sequence has no match
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            throw std::runtime_error("lz: block ends inside an offset");
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > size_t(op - dst))
+            throw std::runtime_error("lz: match offset out of range");
+
+        size_t len = token & 15;
+        if (len == 15)
+            len += readLength(ip, iend);
+        len += MIN_MATCH;
+        if (len > size_t(oend - op))
+            throw std::runtime_error("lz: match runs past the block");
+
+        const uint8_t* ref = op - offset;
+        if (offset >= len) {
+            std::memcpy(op, ref, len);
+            op += len;
+            continue;
+        }
+        // overlapping: repeats the last `offset` bytes. the pattern doubles
+        // with every copy, so this is a handful of memcpys even for runs
+        while (len > 0) {
+            auto chunk = std::min(len, size_t(op - ref));
+            std::memcpy(op, ref, chunk);
+            op += chunk, len -= chunk;
+        }
+    }
+
+    if (op != oend)
+        throw std::runtime_error("lz: block decompresses to the wrong size");
+}
+
+} // namespace lz
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Small, fast LZ77 block compressor, laid out like LZ4's block format:
+ * sequences of (token, literals, 16-bit match offset, match length), with
+ * lengths past 15 continued in 255-saturating bytes. There's no entropy
+ * coding, so it's only worth it on repetitive data, but it runs at close to
+ * memcpy speed on exactly that. Each block stands alone.
+ */
+namespace lz {
+
+/// room compress() may need for `n` bytes of input
+constexpr auto bound(size_t n) -> size_t { return n + n / 255 + 16; }
+
+/**
+ * Compresses `n` bytes at `src` into `dst`, which must have bound(n) bytes
+ * of room.
+ * @return compressed size
+ */
+auto compress(const uint8_t* src, size_t n, uint8_t* dst) -> size_t;
+
+/**
+ * Decompresses a block compress() made from exactly `n` bytes. Throws
+ * std::runtime_error if the block is corrupt or doesn't decompress to `n`
+ * bytes, and never reads or writes out of bounds doing so.
+ */
+void decompress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t n);
+
+} // namespace lz
@@ -1,7 +1,15 @@
+#include <algorithm>
+#include <bit>
 #include <csignal>
+#include <cstdio>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <optional>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 #include <argparse/argparse.hpp>
 #include <fmt/color.h>
@@ -11,9 +19,17 @@
 #include <morph/decoder.h>
 #include <morph/util.h>
 
+#include "card.h"
+#include "checkpoint.h"
+#include "counters.h"
 #include "cpu.h"
 #include "debugger.h"
 #include "iproxy.h"
+#include "predecode.h"
+#include "profile.h"
+#include "stacks.h"
+#include "threaded.h"
+#include "timing.h"
 
 using json = nlohmann::json;
 
@@ -26,17 +42,148 @@ auto parseArgs(int argc, char* argv[]) -> argparse::ArgumentParser {
     ap.add_argument("memory");
 
     ap.add_argument("--trace").help("write a tracefile").metavar("TRACEFILE");
+    ap.add_argument("--trace-format")
+        .help("`text` (see docs/trace.md); `binary`, which is much cheaper "
+              "to write; or `compressed`, binary in compressed blocks that "
+              "can be read from any instruction. render either as text with "
+              "`tracecat`")
+        .default_value(std::string("text"));
+    ap.add_argument("--trace-pc")
+        .help("only trace instructions at PCs in [FIRST, LAST). may be "
+              "given more than once")
+        .metavar("FIRST:LAST")
+        .default_value(std::vector<std::string>{})
+        .append();
+    ap.add_argument("--trace-category")
+        .help("only trace instructions in these isa.yml categories "
+              "(comma-separated, e.g. `vector,matrix,memory`)")
+        .metavar("CATEGORIES");
+    ap.add_argument("--trace-window")
+        .help("only trace the FIRSTth (from 0) up to the LASTth executed "
+              "instruction. either end may be left out")
+        .metavar("FIRST:LAST");
+    ap.add_argument("--trace-async")
+        .help("format and write the trace on a separate thread, so it "
+              "overlaps with simulation (worth it with a core to spare)")
+        .default_value(false)
+        .implicit_value(true);
     ap.add_argument("--init-state")
         .help("seed the CPU state from a JSON file")
         .metavar("SEED");
+    ap.add_argument("--checkpoint-at")
+        .help("save a checkpoint to --checkpoint-out after N instructions, "
+              "then carry on (not with the JIT)")
+        .metavar("N")
+        .scan<'d', size_t>();
+    ap.add_argument("--checkpoint-out")
+        .help("where --checkpoint-at saves to")
+        .metavar("FILE");
+    ap.add_argument("--restore")
+        .help("start from a checkpoint instead of the beginning. `memory` "
+              "has to be the image the checkpoint was taken from")
+        .metavar("FILE");
     ap.add_argument("--log-execution")
         .help("print PC, IR, and disassembly for each executed instruction "
               "(NOT a formal trace format!)")
         .default_value(false)
         .implicit_value(true);
+    ap.add_argument("--engine")
+        .help("execution engine: `interp` decodes and dispatches one "
+              "instruction at a time, `threaded` runs translated basic "
+              "blocks, `jit` also compiles hot blocks to native code "
+              "(untraced runs only)")
+        .default_value(std::string("interp"));
+    ap.add_argument("--dcache")
+        .help("model the card's data cache, and print its hit/miss counts "
+              "when the program halts")
+        .default_value(false)
+        .implicit_value(true);
+    ap.add_argument("--dcache-geometry")
+        .help("line bytes, ways and sets of the modelled data cache (implies "
+              "--dcache). default is data_cache.sv's")
+        .metavar("LINE:WAYS:SETS");
+    ap.add_argument("--dcache-index")
+        .help("where the set index comes from: `high` is addr[35:28] like "
+              "data_cache_controller.sv, `low` is the bits just above the "
+              "line offset (implies --dcache)")
+        .default_value(std::string("high"));
+    ap.add_argument("--icache")
+        .help("model the card's instruction cache, and print its hit/miss "
+              "counts and the lines missed most when the program halts (not "
+              "with the JIT)")
+        .default_value(false)
+        .implicit_value(true);
+    ap.add_argument("--icache-geometry")
+        .help("line bytes, ways and sets of the modelled instruction cache "
+              "(implies --icache). default is instruction_cache.sv's")
+        .metavar("LINE:WAYS:SETS");
+    ap.add_argument("--icache-index")
+        .help("where the set index comes from: `high` is addr[34:28] like "
+              "icache_controller.sv, `low` is the bits just above the line "
+              "offset (implies --icache)")
+        .default_value(std::string("high"));
+    ap.add_argument("--profile")
+        .help("count how many times each instruction runs, and print the "
+              "hottest instructions and blocks when the program halts (not "
+              "with the JIT)")
+        .default_value(false)
+        .implicit_value(true);
+    ap.add_argument("--profile-out")
+        .help("also write every instruction's count to a .json or .csv file "
+              "(implies --profile)")
+        .metavar("FILE");
+    ap.add_argument("--stacks")
+        .help("write a call-stack profile to FILE in the folded format "
+              "flamegraph.pl and speedscope read, weighted by instructions "
+              "(or cycles, with --timing) (not with the JIT)")
+        .metavar("FILE");
+    ap.add_argument("--symbols")
+        .help("name functions in --stacks after the labels in the sidecar "
+              "`asm --symbols` wrote")
+        .metavar("SYMFILE");
+    ap.add_argument("--counters")
+        .help("count instructions, loads, stores and so on for the program "
+              "to read with rcsr; see docs/profile.md (not with the JIT)")
+        .default_value(false)
+        .implicit_value(true);
+    ap.add_argument("--timing")
+        .help("estimate how many cycles the program takes on the card, and "
+              "print them with the slowest basic blocks when it halts. models "
+              "both caches (not with --trace, or the JIT)")
+        .default_value(false)
+        .implicit_value(true);
+    ap.add_argument("--miss-penalty")
+        .help("cycles --timing charges for each cache fill or writeback")
+        .default_value<uint32_t>(TimingConfig{}.missPenalty)
+        .scan<'u', uint32_t>();
+    ap.add_argument("--cores")
+        .help("simulate N cores (up to 8) sharing memory, each on its own host "
+              "thread, all starting at 0; see docs/multicore.md")
+        .metavar("N")
+        .default_value<size_t>(1)
+        .scan<'d', size_t>();
+    ap.add_argument("--quantum")
+        .help("with --cores, how many instructions each core runs before "
+              "waiting for the rest to catch up")
+        .metavar("K")
+        .default_value<uint64_t>(Card::DEFAULT_QUANTUM)
+        .scan<'d', uint64_t>();
+    ap.add_argument("--host-threads")
+        .help("with --cores, run them on T host threads (default one per "
+              "core, up to the host's)")
+        .metavar("T")
+        .scan<'d', size_t>();
+    ap.add_argument("--deterministic")
+        .help("with --cores, apply each quantum's stores in core order at "
+              "the end of it, so a run comes out the same on any number of "
+              "host threads")
+        .default_value(false)
+        .implicit_value(true);
     ap.add_argument("--mem-size")
         .help("size of emulated memory space, as # of 32-bit words. must be a "
-              "multiple of 128 bits. default is 1MiB")
+              "multiple of 128 bits, up to the whole 36-bit address space "
+              "(2^34 words); only memory the program touches takes up "
+              "space. default is 1MiB")
         .default_value<size_t>((1 << 20) / 4) // 1MiB
         .scan<'d', size_t>();
 
@@ -51,22 +198,22 @@ auto parseArgs(int argc, char* argv[]) -> argparse::ArgumentParser {
     return ap;
 }
 
-void loadMemoryImage(MemSystem& dest, const std::string& path) {
+void loadMemoryImage(MemPool& dest, const std::string& path) {
     if (!std::filesystem::is_regular_file(path)) {
         fmt::print(stderr, "[!] `{}` is not a file\n", path);
         exit(1);
     }
-    std::ifstream fBin(path, std::ios::binary);
-    if (!fBin.is_open()) {
-        fmt::print(stderr, "[!] can't open `{}`\n", path);
+    // WARNING WARNING TODO(erin): only works on little-endian architectures
+    try {
+        dest.load(path, 0);
+    } catch (const std::runtime_error& err) {
+        fmt::print(stderr, "[!] {}\n", err.what());
         exit(1);
     }
-    // WARNING WARNING TODO(erin): only works on little-endian architectures
-    fBin.read(reinterpret_cast<char*>(dest.mempool.data()),
-              dest.mempool.size() * 4);
 }
 
-void initState(CPUState& cpuState, const std::string& path) {
+/// `cpus` are the cores, indexed as in the file's "cpus"
+void initState(const std::vector<CPUState*>& cpus, const std::string& path) {
     if (!std::filesystem::is_regular_file(path)) {
         fmt::print(stderr, "[!] `{}` is not a file\n", path);
         exit(1);
@@ -81,7 +228,15 @@ void initState(CPUState& cpuState, const std::string& path) {
     json data = json::parse(fInit, nullptr, true, true);
     for (auto& [cpukey, cpudata] : data.at("cpus").items()) {
         size_t cpu_idx = std::stoi(cpukey);
-        assert(cpu_idx == 0 && "lol one cpu"); // todo
+        if (cpu_idx >= cpus.size()) {
+            fmt::print(stderr,
+                       "[!] `{}` seeds cpu {}, but there {} only {} (see "
+                       "--cores)\n",
+                       path, cpu_idx, cpus.size() == 1 ? "is" : "are",
+                       cpus.size());
+            exit(1);
+        }
+        auto& cpuState = *cpus[cpu_idx];
 
         if (cpudata.contains("r")) {
             auto regvals = cpudata["r"];
@@ -109,66 +264,588 @@ void initState(CPUState& cpuState, const std::string& path) {
     }
 }
 
-int main(int argc, char* argv[]) {
-    auto ap = parseArgs(argc, argv);
+/// "FIRST:LAST" (decimal or 0x-prefixed hex), either of which may be empty
+auto parseRange(const std::string& arg, const char* option)
+    -> std::pair<uint64_t, uint64_t> {
+    auto bad = [&] {
+        fmt::print(stderr, "[!] {} wants FIRST:LAST, not `{}`\n", option, arg);
+        exit(1);
+    };
+    auto parse = [&](const std::string& s, uint64_t dflt) -> uint64_t {
+        if (s.empty())
+            return dflt;
+        size_t used = 0;
+        uint64_t v = 0;
+        try {
+            v = std::stoull(s, &used, 0);
+        } catch (const std::logic_error&) {
+            bad();
+        }
+        if (used != s.size())
+            bad();
+        return v;
+    };
 
-    std::signal(SIGINT, handle_sigint);
+    auto colon = arg.find(':');
+    if (colon == std::string::npos)
+        bad();
+    return {parse(arg.substr(0, colon), 0),
+            parse(arg.substr(colon + 1), UINT64_MAX)};
+}
 
-    std::shared_ptr<Tracer> tracer = nullptr;
-    if (auto tracepath = ap.present<std::string>("--trace")) {
-        tracer = std::make_shared<FileTracer>(*tracepath);
-    } else {
-        tracer = std::make_shared<NullTracer>();
+auto parseTraceFilter(argparse::ArgumentParser& ap) -> TraceFilter {
+    TraceFilter filter;
+
+    for (auto& arg : ap.get<std::vector<std::string>>("--trace-pc"))
+        filter.pcs.push_back(parseRange(arg, "--trace-pc"));
+
+    if (auto arg = ap.present<std::string>("--trace-category")) {
+        filter.categories = 0;
+        std::stringstream names(*arg);
+        for (std::string name; std::getline(names, name, ',');) {
+            auto it = std::find_if(
+                isa::categoryNames.begin() + 1, isa::categoryNames.end(),
+                [&](const char* c) { return name == c; });
+            if (it == isa::categoryNames.end()) {
+                fmt::print(stderr, "[!] unknown instruction category `{}`\n",
+                           name);
+                exit(1);
+            }
+            filter.categories |= 1u << (it - isa::categoryNames.begin());
+        }
     }
 
-    CPUState cpuState;
+    if (auto arg = ap.present<std::string>("--trace-window"))
+        std::tie(filter.first, filter.last) =
+            parseRange(*arg, "--trace-window");
+
+    return filter;
+}
+
+/// nullopt if `name` (`dcache` or `icache`) isn't being modelled
+auto parseCacheConfig(argparse::ArgumentParser& ap, const std::string& name,
+                      CacheConfig config) -> std::optional<CacheConfig> {
+    auto flag = "--" + name, geometryFlag = flag + "-geometry",
+         indexFlag = flag + "-index";
+    if (ap[flag] == false && !ap.is_used(geometryFlag) &&
+        !ap.is_used(indexFlag))
+        return std::nullopt;
+
+    if (auto arg = ap.present<std::string>(geometryFlag)) {
+        char tail;
+        if (std::sscanf(arg->c_str(), "%u:%u:%u%c", &config.lineBytes,
+                        &config.ways, &config.sets, &tail) != 3) {
+            fmt::print(stderr, "[!] {} wants LINE:WAYS:SETS, not `{}`\n",
+                       geometryFlag, *arg);
+            exit(1);
+        }
+    }
+
+    auto index = ap.get<std::string>(indexFlag);
+    if (index == "low") {
+        config.indexBit = std::countr_zero(config.lineBytes);
+    } else if (index != "high") {
+        fmt::print(stderr, "[!] {} is `high` or `low`, not `{}`\n", indexFlag,
+                   index);
+        exit(1);
+    }
+    return config;
+}
+
+void printCacheStats(const char* name, const Cache& cache) {
+    auto& cfg = cache.config();
+    auto& st = cache.stats();
+    auto pct = [](uint64_t n, uint64_t of) {
+        return of ? 100.0 * double(n) / double(of) : 0.0;
+    };
+    fmt::print(stderr, "{} ({}B lines, {} ways, {} sets):\n", name,
+               cfg.lineBytes, cfg.ways, cfg.sets);
+    fmt::print(stderr, "  reads      {:>12}  misses {:>12} ({:.2f}%)\n",
+               st.reads, st.readMisses, pct(st.readMisses, st.reads));
+    fmt::print(stderr, "  writes     {:>12}  misses {:>12} ({:.2f}%)\n",
+               st.writes, st.writeMisses, pct(st.writeMisses, st.writes));
+    fmt::print(stderr, "  writebacks {:>12}\n", st.writebacks);
+}
+
+/// how many atomics ran, and the `n` addresses they were most contended at
+void printAtomics(
+    const std::unordered_map<uint64_t, MemSystem::AtomicCounts>& atomics,
+    size_t n) {
+    uint64_t ops = 0, contended = 0;
+    std::vector<std::pair<uint64_t, MemSystem::AtomicCounts>> hot;
+    for (auto& [addr, counts] : atomics) {
+        ops += counts.ops;
+        contended += counts.contended;
+        if (counts.contended > 0)
+            hot.emplace_back(addr, counts);
+    }
+    n = std::min(n, hot.size());
+    std::partial_sort(hot.begin(), hot.begin() + n, hot.end(),
+                      [](const auto& a, const auto& b) {
+                          return a.second.contended != b.second.contended
+                                     ? a.second.contended > b.second.contended
+                                     : a.first < b.first;
+                      });
+    hot.resize(n);
+
+    fmt::print(stderr, "atomics: {} at {} addresses, {} contended\n", ops,
+               atomics.size(), contended);
+    if (!hot.empty())
+        fmt::print(stderr, "  most contended addresses:\n");
+    for (auto& [addr, counts] : hot)
+        fmt::print(stderr, "    {:#x}: {} of {}\n", addr, counts.contended,
+                   counts.ops);
+}
+
+/// the `n` I-cache lines with the most misses, and which PCs in them missed
+void printICacheHotLines(const MemSystem& mem, size_t n) {
+    struct HotLine {
+        uint64_t addr = 0, misses = 0;
+        std::vector<std::pair<uint64_t, uint64_t>> pcs; // (pc, misses)
+    };
+    uint64_t lineMask = ~uint64_t(mem.icache->config().lineBytes - 1);
+    std::unordered_map<uint64_t, HotLine> byLine;
+    for (auto [pc, misses] : mem.icacheMisses) {
+        auto& line = byLine[pc & lineMask];
+        line.addr = pc & lineMask;
+        line.misses += misses;
+        line.pcs.emplace_back(pc, misses);
+    }
+
+    std::vector<HotLine> lines;
+    for (auto& [addr, line] : byLine)
+        lines.push_back(std::move(line));
+    n = std::min(n, lines.size());
+    std::partial_sort(lines.begin(), lines.begin() + n, lines.end(),
+                      [](const HotLine& a, const HotLine& b) {
+                          return a.misses != b.misses ? a.misses > b.misses
+                                                      : a.addr < b.addr;
+                      });
+    lines.resize(n);
+
+    if (!lines.empty())
+        fmt::print(stderr, "  most missed lines:\n");
+    for (auto& line : lines) {
+        std::sort(line.pcs.begin(), line.pcs.end(),
+                  [](const auto& a, const auto& b) {
+                      return a.second != b.second ? a.second > b.second
+                                                  : a.first < b.first;
+                  });
+        std::string pcs;
+        for (auto [pc, misses] : line.pcs)
+            pcs += fmt::format("{}{:#x} x{}", pcs.empty() ? "" : ", ", pc,
+                               misses);
+        fmt::print(stderr, "    {:#x}: {} ({})\n", line.addr, line.misses, pcs);
+    }
+}
+
+void writeProfile(const Profile& profile, const MemSystem& mem,
+                  const std::string& path) {
+    auto ext = std::filesystem::path(path).extension();
+    if (ext != ".json" && ext != ".csv") {
+        fmt::print(stderr, "[!] --profile-out wants a .json or .csv file, not "
+                           "`{}`\n",
+                   path);
+        exit(1);
+    }
+    std::ofstream out(path);
+    if (!out.is_open()) {
+        fmt::print(stderr, "[!] can't open `{}`\n", path);
+        exit(1);
+    }
+    if (ext == ".json")
+        profile.writeJson(out, mem);
+    else
+        profile.writeCsv(out, mem);
+}
+
+/// the `n` basic blocks that took the most cycles
+void printTiming(const TimingModel& timing, size_t n) {
+    auto cpi = [](uint64_t cycles, uint64_t insts) {
+        return insts ? double(cycles) / double(insts) : 0.0;
+    };
+    fmt::print(stderr, "timing: {} cycles, {} instructions (CPI {:.2f})\n",
+               timing.cycles(), timing.instructions(),
+               cpi(timing.cycles(), timing.instructions()));
+
+    std::vector<std::pair<uint64_t, BlockTiming>> blocks(
+        timing.blocks().begin(), timing.blocks().end());
+    n = std::min(n, blocks.size());
+    std::partial_sort(blocks.begin(), blocks.begin() + n, blocks.end(),
+                      [](const auto& a, const auto& b) {
+                          return a.second.cycles != b.second.cycles
+                                     ? a.second.cycles > b.second.cycles
+                                     : a.first < b.first;
+                      });
+    blocks.resize(n);
+
+    if (!blocks.empty())
+        fmt::print(stderr, "  slowest blocks:\n");
+    for (auto& [start, b] : blocks)
+        fmt::print(stderr,
+                   "    {:#x}-{:#x}: {} cycles, {} instructions (CPI {:.2f}) "
+                   "over {} runs\n",
+                   start, b.end, b.cycles, b.insts, cpi(b.cycles, b.insts),
+                   b.entries);
+}
+
+/// --mem-size, in words
+auto memorySize(argparse::ArgumentParser& ap) -> size_t {
     size_t memSize = ap.get<size_t>("--mem-size");
     if ((memSize % (128 / 4)) != 0) {
         std::cerr
             << "[!] memory size must be a multiple of 128 bits (16 bytes)\n";
         exit(1);
     }
-    bool quitting;
-    MemSystem mem(memSize, tracer);
+    if (memSize > MemSystem::MAX_SIZE / 4) {
+        std::cerr << "[!] memory size can't be more than the 36-bit address "
+                     "space (2^34 words)\n";
+        exit(1);
+    }
+    return memSize;
+}
+
+/**
+ * Everything after argument parsing, for one tracer type. Untraced runs
+ * instantiate this with NullTracer so none of the per-instruction tracing
+ * survives into their hot loop.
+ */
+template <typename T>
+int simulate(argparse::ArgumentParser& ap, std::shared_ptr<T> tracer) {
+    CPUState cpuState;
+    size_t memSize = memorySize(ap);
+    bool quitting = false;
+    // MemSystem reports through the (virtual) Tracer interface, so only
+    // hand it a tracer that records something
+    MemSystem mem(memSize, std::is_same_v<T, NullTracer> ? nullptr : tracer);
+    try {
+        if (auto config = parseCacheConfig(ap, "dcache", CacheConfig{}))
+            mem.enableDCache(*config);
+        if (auto config = parseCacheConfig(ap, "icache", CacheConfig::icache()))
+            mem.enableICache(*config);
+    } catch (const std::invalid_argument& err) {
+        fmt::print(stderr, "[!] {}\n", err.what());
+        exit(1);
+    }
+    if constexpr (std::is_same_v<T, TimingModel>) {
+        // misses are most of what timing is about
+        if (!mem.dcache)
+            mem.enableDCache(CacheConfig{});
+        if (!mem.icache)
+            mem.enableICache(CacheConfig::icache());
+        tracer->watchCaches(mem.icache.get(), mem.dcache.get());
+    }
+    std::unique_ptr<Profile> profile;
+    auto profilePath = ap.present<std::string>("--profile-out");
+    if (ap["--profile"] == true || profilePath)
+        profile = std::make_unique<Profile>(mem.size());
+    std::unique_ptr<CallStacks> stacks;
+    auto stacksPath = ap.present<std::string>("--stacks");
+    SymbolMap symbols;
+    if (stacksPath) {
+        stacks = std::make_unique<CallStacks>();
+        if (auto path = ap.present<std::string>("--symbols")) {
+            try {
+                symbols = SymbolMap(*path);
+            } catch (const std::runtime_error& err) {
+                fmt::print(stderr, "[!] {}\n", err.what());
+                exit(1);
+            }
+        }
+    }
+
+    std::unique_ptr<PerfCounters> counters;
+    if (ap["--counters"] == true) {
+        counters = std::make_unique<PerfCounters>();
+        const TimingModel* timing = nullptr;
+        if constexpr (std::is_same_v<T, TimingModel>)
+            timing = tracer.get();
+        counters->watch(timing, mem.icache.get(), mem.dcache.get());
+    }
+
     Debugger debugger(cpuState, mem, quitting);
-    CPUInstructionProxy iproxy(cpuState, mem, debugger, tracer);
+    CPUInstructionProxy<T> iproxy(cpuState, mem, debugger, tracer);
+    iproxy.countInto(counters.get());
     isa::PrintVisitor printvis(std::cout);
 
-    loadMemoryImage(mem, ap.get<std::string>("memory"));
+    loadMemoryImage(mem.mempool, ap.get<std::string>("memory"));
 
     if (auto path = ap.present<std::string>("--init-state")) {
-        initState(cpuState, *path);
+        initState({&cpuState}, *path);
+    }
+    if (auto path = ap.present<std::string>("--restore")) {
+        try {
+            restoreCheckpoint(*path, cpuState, mem);
+        } catch (const std::runtime_error& err) {
+            fmt::print(stderr, "[!] {}\n", err.what());
+            exit(1);
+        }
     }
+    auto checkpointAt = ap.present<size_t>("--checkpoint-at");
+    auto checkpointPath = ap.present<std::string>("--checkpoint-out");
+    if (checkpointAt.has_value() != checkpointPath.has_value()) {
+        fmt::print(stderr, "[!] --checkpoint-at and --checkpoint-out go "
+                           "together\n");
+        exit(1);
+    }
+    size_t retired = 0;
 
-    while (!cpuState.isHalted()) {
-        auto pc = cpuState.pc.getNewPC();
-        auto ir = mem.readInstruction(pc);
+    bool logExecution = ap["--log-execution"] == true;
+    auto poll = [&]() -> bool {
+        if (signal_flag == SIGINT) {
+            fmt::print(" simulation stopped by SIGINT\n");
+            signal_flag = 0;
+            // the trace should be caught up while we sit in the debugger
+            tracer->flush();
+            debugger.simHaltedByUser();
+        }
+        debugger.tick();
 
-        tracer->begin(pc, ir);
+        if (quitting) {
+            cpuState.dump();
+            return false;
+        }
+        return true;
+    };
+    auto step = [&](uint64_t pc, const DecodedInstruction<T>& inst) -> bool {
+        tracer->begin(pc, inst.ir);
+        if (mem.icache)
+            mem.fetchICache(pc);
+        if (profile)
+            profile->count(pc);
+        uint64_t cyclesBefore = 0;
+        if constexpr (std::is_same_v<T, TimingModel>)
+            cyclesBefore = tracer->cycles();
 
-        if (ap["--log-execution"] == true) {
-            fmt::print("pc={:#x} ir={:#x}\n", pc, ir);
+        if (logExecution) {
+            fmt::print("pc={:#x} ir={:#x}\n", pc, inst.ir);
             std::cout << "] ";
-            isa::decodeInstruction(printvis, bits<32>(ir));
+            isa::decodeInstruction(printvis, bits<32>(inst.ir));
             std::cout << '\n';
         }
 
         // execute instruction
-        isa::decodeInstruction(iproxy, bits<32>(ir));
+        inst.execute(iproxy);
+        if (counters)
+            counters->retire(inst.ir);
 
         tracer->end();
+        if (checkpointAt && ++retired == *checkpointAt) {
+            try {
+                saveCheckpoint(*checkpointPath, cpuState, mem);
+            } catch (const std::runtime_error& err) {
+                fmt::print(stderr, "[!] {}\n", err.what());
+                exit(1);
+            }
+            fmt::print(stderr, "checkpoint: saved after {} instructions to "
+                               "`{}`\n",
+                       retired, *checkpointPath);
+        }
+        if (stacks) {
+            uint64_t weight = 1;
+            if constexpr (std::is_same_v<T, TimingModel>)
+                weight = tracer->cycles() - cyclesBefore;
+            stacks->retire(pc, inst.ir, cpuState, weight);
+        }
+        return poll();
+    };
+
+    auto engine = ap.get<std::string>("--engine");
+    if (engine == "jit") {
+        // all of these watch every instruction, which jitted blocks don't
+        // stop for (--timing models the I-cache)
+        for (auto* option :
+             {"--trace", "--log-execution", "--icache", "--icache-geometry",
+              "--icache-index", "--timing", "--profile", "--profile-out",
+              "--stacks", "--counters", "--checkpoint-at"}) {
+            if (ap.is_used(option)) {
+                fmt::print(stderr,
+                           "[!] the JIT can't run with {}, running threaded "
+                           "instead\n",
+                           option);
+                engine = "threaded";
+                break;
+            }
+        }
+    }
+
+    try {
+        if (engine == "threaded" || engine == "jit") {
+            ThreadedEngine<T> threaded(cpuState, mem);
+            if (engine == "jit")
+                threaded.enableJit(iproxy);
+            threaded.run(step, poll);
+        } else if (engine == "interp") {
+            PredecodeCache<T> predecoded(mem);
+            while (!cpuState.isHalted()) {
+                auto pc = cpuState.pc.getNewPC();
+                // copy: the instruction may invalidate its own cache slot
+                auto inst = predecoded.fetch(pc);
+                if (!step(pc, inst))
+                    break;
+            }
+        } else {
+            fmt::print(stderr, "[!] unknown engine `{}`\n", engine);
+            exit(1);
+        }
+    } catch (...) {
+        // the trace leading up to a crash is the interesting part; don't
+        // leave it sitting in a buffer
+        tracer->flush();
+        throw;
+    }
+    if constexpr (std::is_same_v<T, FileTracer>)
+        tracer->close();
+
+    if (mem.dcache)
+        printCacheStats("dcache", *mem.dcache);
+    if (mem.icache) {
+        printCacheStats("icache", *mem.icache);
+        printICacheHotLines(mem, 10);
+    }
+    if (!mem.atomics.empty())
+        printAtomics(mem.atomics, 10);
+    if constexpr (std::is_same_v<T, TimingModel>)
+        printTiming(*tracer, 10);
+    if (profile) {
+        profile->writeReport(stderr, mem, 10);
+        if (profilePath)
+            writeProfile(*profile, mem, *profilePath);
+    }
+    if (stacks) {
+        std::ofstream out(*stacksPath);
+        if (!out.is_open()) {
+            fmt::print(stderr, "[!] can't open `{}`\n", *stacksPath);
+            exit(1);
+        }
+        stacks->writeFolded(out, symbols);
+    }
+    return 0;
+}
+
+/**
+ * --cores: every core runs the same image from 0, on its own thread, so
+ * they're told apart by --init-state (or by reading something a core sets).
+ * Nothing that watches every instruction goes with it.
+ */
+int simulateCores(argparse::ArgumentParser& ap, size_t nCores) {
+    for (auto* option :
+         {"--trace", "--log-execution", "--dcache", "--dcache-geometry",
+          "--dcache-index", "--icache", "--icache-geometry", "--icache-index",
+          "--profile", "--profile-out", "--stacks", "--counters", "--timing",
+          "--checkpoint-at", "--checkpoint-out", "--restore"}) {
+        if (ap.is_used(option)) {
+            fmt::print(stderr, "[!] {} only works with one core\n", option);
+            exit(1);
+        }
+    }
+    if (ap.is_used("--engine") &&
+        ap.get<std::string>("--engine") != "threaded")
+        fmt::print(stderr, "[!] --cores always runs the threaded engine\n");
+    auto quantum = ap.get<uint64_t>("--quantum");
+    if (quantum == 0) {
+        fmt::print(stderr, "[!] --quantum has to be at least 1\n");
+        exit(1);
+    }
+
+    // hardware_concurrency() is 0 if it can't tell, and so is one per core
+    auto hostThreads = ap.present<size_t>("--host-threads")
+                           .value_or(std::thread::hardware_concurrency());
+    if (ap.is_used("--host-threads") && hostThreads == 0) {
+        fmt::print(stderr, "[!] --host-threads has to be at least 1\n");
+        exit(1);
+    }
+    auto ordering = ap["--deterministic"] == true
+                        ? Card::Ordering::Deterministic
+                        : Card::Ordering::Host;
+
+    Card card(memorySize(ap), nCores, ordering);
+    loadMemoryImage(card.memory(), ap.get<std::string>("memory"));
+    if (auto path = ap.present<std::string>("--init-state")) {
+        std::vector<CPUState*> cpus;
+        for (size_t i = 0; i < nCores; i++)
+            cpus.push_back(&card.core(i).cpu);
+        initState(cpus, *path);
+    }
+
+    bool stopped = false;
+    card.run(quantum, hostThreads, [&] {
         if (signal_flag == SIGINT) {
             fmt::print(" simulation stopped by SIGINT\n");
             signal_flag = 0;
-            debugger.simHaltedByUser();
+            stopped = true;
         }
-        debugger.tick();
+        return !stopped;
+    });
 
-        if (quitting) {
-            cpuState.dump();
-            break;
+    for (size_t i = 0; i < nCores; i++) {
+        auto& core = card.core(i);
+        if (stopped || core.quitting) {
+            fmt::print("core {}\n", i);
+            core.cpu.dump();
         }
+        fmt::print(stderr, "core {}: {} at {:#x} after {} instructions\n", i,
+                   core.cpu.isHalted() ? "halted" : "stopped",
+                   core.cpu.pc.getCurrentPC(), core.retired);
     }
-
+    std::unordered_map<uint64_t, MemSystem::AtomicCounts> atomics;
+    for (size_t i = 0; i < nCores; i++) {
+        for (auto& [addr, counts] : card.core(i).mem.atomics) {
+            atomics[addr].ops += counts.ops;
+            atomics[addr].contended += counts.contended;
+        }
+    }
+    if (!atomics.empty())
+        printAtomics(atomics, 10);
     return 0;
 }
+
+int main(int argc, char* argv[]) {
+    auto ap = parseArgs(argc, argv);
+
+    std::signal(SIGINT, handle_sigint);
+
+    auto nCores = ap.get<size_t>("--cores");
+    if (nCores < 1 || nCores > Card::MAX_CORES) {
+        fmt::print(stderr, "[!] --cores has to be 1 to {}\n",
+                   Card::MAX_CORES);
+        exit(1);
+    }
+    if (nCores > 1)
+        return simulateCores(ap, nCores);
+
+    if (auto tracepath = ap.present<std::string>("--trace")) {
+        auto formatName = ap.get<std::string>("--trace-format");
+        TraceFormat format;
+        if (formatName == "text") {
+            format = TraceFormat::Text;
+        } else if (formatName == "binary") {
+            format = TraceFormat::Binary;
+        } else if (formatName == "compressed") {
+            format = TraceFormat::Compressed;
+        } else {
+            fmt::print(stderr, "[!] unknown trace format `{}`\n", formatName);
+            exit(1);
+        }
+        if (ap["--timing"] == true) {
+            fmt::print(stderr, "[!] --timing can't be used with --trace\n");
+            exit(1);
+        }
+        // opening or writing the tracefile
+        try {
+            return simulate(ap, std::make_shared<FileTracer>(
+                                    *tracepath, format,
+                                    ap["--trace-async"] == true,
+                                    parseTraceFilter(ap)));
+        } catch (const std::runtime_error& err) {
+            fmt::print(stderr, "[!] {}\n", err.what());
+            exit(1);
+        }
+    }
+    if (ap["--timing"] == true) {
+        TimingConfig config;
+        config.missPenalty = ap.get<uint32_t>("--miss-penalty");
+        return simulate(ap, std::make_shared<TimingModel>(config));
+    }
+    return simulate(ap, std::make_shared<NullTracer>());
+}
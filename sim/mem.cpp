@@ -6,22 +6,324 @@
 
 #include "trace.h"
 
-// stubs because we don't simulate caches yet
-void MemSystem::flushICache() {}
-void MemSystem::flushDCacheDirty() {}
-void MemSystem::flushDCacheClean() {}
-void MemSystem::flushDCacheLine(uint64_t at) {}
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fmt/format.h>
+
+static auto pageSize() -> size_t {
+    static const size_t size = sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+MemPool::MemPool(size_t words, Backing backing)
+    : words{words}, fd{-1}, privateView{false}, fileMapped{false} {
+    auto page = pageSize();
+    mappedBytes = std::max<size_t>((words * 4 + page - 1) / page * page, page);
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    if (backing == Backing::Shareable) {
+        fd = memfd_create("morph-mem", MFD_CLOEXEC);
+        if (fd < 0 || ftruncate(fd, off_t(mappedBytes)) != 0) {
+            auto err = std::strerror(errno);
+            if (fd >= 0)
+                close(fd);
+            throw std::runtime_error(fmt::format(
+                "can't make {} bytes of shared memory: {}", mappedBytes, err));
+        }
+        flags = MAP_SHARED;
+    }
+    // NORESERVE: a huge memory that's mostly untouched shouldn't need the
+    // swap to back all of it
+    void* p = mmap(nullptr, mappedBytes, PROT_READ | PROT_WRITE,
+                   flags | MAP_NORESERVE, fd, 0);
+    if (p == MAP_FAILED) {
+        auto err = std::strerror(errno);
+        if (fd >= 0)
+            close(fd);
+        throw std::runtime_error(fmt::format(
+            "can't map {} bytes of emulated memory: {}", mappedBytes, err));
+    }
+    base = static_cast<uint32_t*>(p);
+}
+
+MemPool::MemPool(const MemPool& memory, View view)
+    : words{memory.words}, mappedBytes{memory.mappedBytes}, fd{-1},
+      privateView{view == View::Private}, fileMapped{false} {
+    if (memory.fd < 0)
+        throw std::logic_error("only a shareable MemPool can have views");
+    fd = dup(memory.fd);
+    int flags = privateView ? MAP_PRIVATE : MAP_SHARED;
+    void* p = fd < 0 ? MAP_FAILED
+                     : mmap(nullptr, mappedBytes, PROT_READ | PROT_WRITE,
+                            flags | MAP_NORESERVE, fd, 0);
+    if (p == MAP_FAILED) {
+        auto err = std::strerror(errno);
+        if (fd >= 0)
+            close(fd);
+        throw std::runtime_error(
+            fmt::format("can't map a view of emulated memory: {}", err));
+    }
+    base = static_cast<uint32_t*>(p);
+}
+
+MemPool::~MemPool() {
+    munmap(base, mappedBytes);
+    if (fd >= 0)
+        close(fd);
+}
+
+auto MemPool::operator==(const MemPool& other) const -> bool {
+    return words == other.words &&
+           std::memcmp(base, other.base, words * 4) == 0;
+}
+
+auto MemPool::load(const std::string& path, uint64_t addr) -> uint64_t {
+    int file = open(path.c_str(), O_RDONLY);
+    if (file < 0)
+        throw std::runtime_error(fmt::format("can't open `{}`: {}", path,
+                                             std::strerror(errno)));
+    struct stat st;
+    if (fstat(file, &st) != 0) {
+        close(file);
+        throw std::runtime_error(fmt::format("can't stat `{}`: {}", path,
+                                             std::strerror(errno)));
+    }
+
+    uint64_t bytes = words * 4;
+    uint64_t len = addr < bytes ? std::min<uint64_t>(st.st_size, bytes - addr)
+                                : 0;
+    auto* dst = reinterpret_cast<char*>(base) + addr;
+
+    // only whole pages get mapped: the rest of a partial one might hold
+    // something loaded earlier. a shared pool's pages have to stay its own
+    uint64_t mapped = fd < 0 && addr % pageSize() == 0
+                          ? len / pageSize() * pageSize()
+                          : 0;
+    if (mapped > 0 && mmap(dst, mapped, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_FIXED, file, 0) == MAP_FAILED) {
+        close(file);
+        throw std::runtime_error(
+            fmt::format("can't map `{}`: {}", path, std::strerror(errno)));
+    }
+    fileMapped |= mapped > 0;
+
+    for (uint64_t done = mapped; done < len;) {
+        auto n = pread(file, dst + done, len - done, done);
+        if (n <= 0) {
+            close(file);
+            throw std::runtime_error(
+                fmt::format("can't read `{}`: {}", path,
+                            n < 0 ? std::strerror(errno) : "short read"));
+        }
+        done += n;
+    }
+
+    close(file);
+    return len;
+}
+
+auto MemPool::pageBytes() -> size_t { return pageSize(); }
+
+auto MemPool::writtenPages() const -> std::vector<uint64_t> {
+    // /proc/self/pagemap: one little-endian u64 per virtual page
+    constexpr uint64_t PRESENT = uint64_t(1) << 63;
+    constexpr uint64_t SWAPPED = uint64_t(1) << 62;
+    constexpr uint64_t FILE_PAGE = uint64_t(1) << 61;
+    constexpr uint64_t EXCLUSIVE = uint64_t(1) << 56;
+
+    auto page = pageSize();
+    uint64_t nPages = mappedBytes / page;
+    std::vector<uint64_t> pages;
+
+    // a private view's own pages aren't the file's, just like a private
+    // pool's, so pagemap tells them apart the same way
+    bool isPrivate = fd < 0 || privateView;
+    int pagemap = isPrivate ? open("/proc/self/pagemap", O_RDONLY) : -1;
+    if (pagemap >= 0) {
+        std::vector<uint64_t> entries(std::min<uint64_t>(nPages, 4096));
+        auto first = reinterpret_cast<uintptr_t>(base) / page;
+        bool ok = true;
+        for (uint64_t at = 0; ok && at < nPages; at += entries.size()) {
+            auto n = std::min<uint64_t>(entries.size(), nPages - at);
+            auto bytes = n * sizeof(uint64_t);
+            ok = pread(pagemap, entries.data(), bytes,
+                       (first + at) * sizeof(uint64_t)) == ssize_t(bytes);
+            for (uint64_t i = 0; ok && i < n; i++) {
+                // an untouched page isn't there, one that's only been read
+                // is the shared zero page, and one that's only been read
+                // from a mapped file is still the file's. anything else is
+                // our own copy, which only a write makes
+                auto e = entries[i];
+                if ((e & SWAPPED) ||
+                    ((e & PRESENT) && (e & EXCLUSIVE) && !(e & FILE_PAGE)))
+                    pages.push_back(at + i);
+            }
+        }
+        close(pagemap);
+        if (ok)
+            return pages;
+    }
+    return writtenPagesByContents();
+}
+
+auto MemPool::writtenPagesByContents() const -> std::vector<uint64_t> {
+    auto page = pageSize();
+    uint64_t nPages = mappedBytes / page;
+    std::vector<uint64_t> pages;
+
+    if (privateView || fileMapped) {
+        // a page written back to zero still has to be found, and so does
+        // one of a mapped file's that was zeroed
+        for (uint64_t i = 0; i < nPages; i++)
+            pages.push_back(i);
+        return pages;
+    }
+    auto* bytes = reinterpret_cast<const uint8_t*>(base);
+    for (uint64_t i = 0; i < nPages; i++) {
+        auto* p = bytes + i * page;
+        if (p[0] != 0 || std::memcmp(p, p + 1, page - 1) != 0)
+            pages.push_back(i);
+    }
+    return pages;
+}
+
+void MemPool::discard() {
+    if (!privateView)
+        throw std::logic_error("only a private view can discard its stores");
+    // a private file mapping goes back to the file's pages
+    if (madvise(base, mappedBytes, MADV_DONTNEED) != 0)
+        throw std::runtime_error(fmt::format(
+            "can't discard a view's stores: {}", std::strerror(errno)));
+}
+
+void MemPool::discard(const std::vector<uint64_t>& pages) {
+    if (!privateView)
+        throw std::logic_error("only a private view can discard its stores");
+    auto page = pageSize();
+    auto* bytes = reinterpret_cast<char*>(base);
+    // one madvise per run of pages next to each other
+    for (size_t i = 0; i < pages.size();) {
+        size_t n = 1;
+        while (i + n < pages.size() && pages[i + n] == pages[i] + n)
+            n++;
+        if (madvise(bytes + pages[i] * page, n * page, MADV_DONTNEED) != 0)
+            throw std::runtime_error(fmt::format(
+                "can't discard a view's stores: {}", std::strerror(errno)));
+        i += n;
+    }
+}
+
+/// the 64-bit slot a 36-bit word lives in, which is 8-aligned
+static auto atomicWord(MemPool& pool, uint64_t addr)
+    -> std::atomic_ref<uint64_t> {
+    return std::atomic_ref(*reinterpret_cast<uint64_t*>(&pool[addr / 4]));
+}
+
+auto MemSystem::fetchAdd36(uint64_t addr, uint64_t delta) -> uint64_t {
+    _check_addr(addr, 64);
+    if (dcache)
+        dcache->access(addr, true);
+    _notify_store(addr, 8);
+
+    auto word = atomicWord(mempool, addr);
+    auto& counts = atomics[addr];
+    counts.ops++;
+    // a plain fetch_add would carry out of the 36 bits
+    uint64_t old = word.load(), sum;
+    bool retried = false;
+    while (!word.compare_exchange_strong(old,
+                                         sum = (old + delta) & bits<36>::mask))
+        retried = true;
+    counts.contended += retried;
+
+    if (tracer) {
+        tracer->memRead36(addr, old);
+        tracer->memWrite(addr, u<36>(sum));
+    }
+    return old;
+}
+
+auto MemSystem::compareExchange36(uint64_t addr, uint64_t expected,
+                                  uint64_t desired) -> uint64_t {
+    _check_addr(addr, 64);
+    if (dcache)
+        dcache->access(addr, true);
+
+    auto word = atomicWord(mempool, addr);
+    auto& counts = atomics[addr];
+    counts.ops++;
+    uint64_t old = expected;
+    bool swapped =
+        word.compare_exchange_strong(old, desired & bits<36>::mask);
+    counts.contended += !swapped;
+
+    if (tracer)
+        tracer->memRead36(addr, old);
+    if (swapped) {
+        _notify_store(addr, 8);
+        if (tracer)
+            tracer->memWrite(addr, u<36>(desired));
+    } else if (trackWrites) {
+        // the host's compare-exchange writes even when it fails, which
+        // gives a private view its own copy of the page all the same
+        written.push_back(addr / pageSize());
+    }
+    return old;
+}
+
+void MemSystem::fetchICache(uint64_t pc) {
+    if (icache && !icache->access(pc & bits<36>::mask, false))
+        icacheMisses[pc]++;
+}
+
+void MemSystem::flushICache() {
+    if (codeObserver)
+        codeObserver->codeFlushed();
+    // nothing in it is ever dirty, so this is every line
+    if (icache)
+        icache->flushClean();
+}
+
+void MemSystem::flushDCacheDirty() {
+    if (dcache)
+        dcache->flushDirty();
+}
+
+void MemSystem::flushDCacheClean() {
+    if (dcache)
+        dcache->flushClean();
+}
+
+void MemSystem::flushDCacheLine(uint64_t at) {
+    if (dcache)
+        dcache->flushLine(at & bits<36>::mask);
+}
 
 void MemSystem::write(uint64_t addr, u<32> val) {
     _check_addr(addr, 32);
-    tracer->memWrite(addr, val);
+    if (tracer)
+        tracer->memWrite(addr, val);
+    if (dcache)
+        dcache->access(addr, true);
+    _notify_store(addr, 4);
 
     this->mempool[addr / 4] = val.raw();
 }
 
 void MemSystem::write(uint64_t addr, u<36> val) {
     _check_addr(addr, 64);
-    tracer->memWrite(addr, val);
+    if (tracer)
+        tracer->memWrite(addr, val);
+    if (dcache)
+        dcache->access(addr, true);
+    _notify_store(addr, 8);
 
     this->mempool[0 + addr / 4] = val.slice<31, 0>().raw();
     this->mempool[1 + addr / 4] = val.slice<35, 32>().raw();
@@ -29,7 +331,11 @@ void MemSystem::write(uint64_t addr, u<36> val) {
 
 void MemSystem::write(uint64_t addr, f32x4 val) {
     _check_addr(addr, 128);
-    tracer->memWrite(addr, val);
+    if (tracer)
+        tracer->memWrite(addr, val);
+    if (dcache)
+        dcache->access(addr, true);
+    _notify_store(addr, 16);
 
     size_t base = addr / 4;
     this->mempool[base + 0] = bit_cast<uint32_t>(val.x());
@@ -40,26 +346,34 @@ void MemSystem::write(uint64_t addr, f32x4 val) {
 
 auto MemSystem::read32(uint64_t addr) -> uint32_t {
     _check_addr(addr, 32);
+    if (dcache)
+        dcache->access(addr, false);
 
     auto val = this->mempool[addr / 4];
 
-    tracer->memRead32(addr, val);
+    if (tracer)
+        tracer->memRead32(addr, val);
     return val;
 }
 
 auto MemSystem::read36(uint64_t addr) -> uint64_t {
     _check_addr(addr, 64);
+    if (dcache)
+        dcache->access(addr, false);
 
     // little-endian
     uint64_t val = this->mempool[addr / 4]; // lower
     val |= static_cast<uint64_t>(this->mempool[1 + addr / 4]) << 32;
 
-    tracer->memRead36(addr, val);
+    if (tracer)
+        tracer->memRead36(addr, val);
     return val;
 }
 
 auto MemSystem::readVec(uint64_t addr) -> f32x4 {
     _check_addr(addr, 128);
+    if (dcache)
+        dcache->access(addr, false);
 
     size_t base = addr / 4;
     f32x4 vec{
@@ -69,23 +383,50 @@ auto MemSystem::readVec(uint64_t addr) -> f32x4 {
         bit_cast<float>(this->mempool[base + 3]),
     };
 
-    tracer->memReadVec(addr, vec);
+    if (tracer)
+        tracer->memReadVec(addr, vec);
     return vec;
 }
 
 auto MemSystem::readInstruction(uint64_t addr) -> uint32_t {
     _check_addr(addr, 32);
 
+    codeLo = std::min(codeLo, addr);
+    codeHi = std::max(codeHi, addr + 4);
+
     // /4 to get u32-addr instead of byte addr
     return this->mempool[addr / 4];
 }
 
+auto MemSystem::takeWrittenPages() -> std::vector<uint64_t> {
+    std::vector<uint64_t> pages;
+    pages.swap(written);
+    std::sort(pages.begin(), pages.end());
+    pages.erase(std::unique(pages.begin(), pages.end()), pages.end());
+    lastWritten = UINT64_MAX;
+    return pages;
+}
+
+void MemSystem::_notify_store(uint64_t addr, uint64_t len) {
+    if (trackWrites) {
+        // stores are aligned, so never straddle a page
+        auto page = addr / pageSize();
+        if (page != lastWritten)
+            written.push_back(lastWritten = page);
+    }
+    // cheap range test first; most stores are nowhere near the code
+    if (addr < codeHi && addr + len > codeLo && codeObserver)
+        codeObserver->codeModified(addr, len);
+}
+
 void MemSystem::_check_addr(uint64_t addr, uint32_t alignTo) const {
-    // alignTo in bits
-    if ((addr % (alignTo / 8)) != 0)
+    // alignTo in bits, and always a power of two
+    uint64_t bytes = alignTo / 8;
+    if ((addr & (bytes - 1)) != 0)
         panic("misaligned memory address");
 
-    if (addr > mempool.size())
+    // the whole access has to fit, in bytes (mempool counts words)
+    if (addr + bytes > size())
         panic("access past end of emulated memory");
 }
 
@@ -1,15 +1,132 @@
 #pragma once
 
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <morph/ty.h>
 
+#include "cache.h"
+
 struct Tracer;
 
+/**
+ * Something holding on to state derived from instruction memory (e.g. the
+ * predecode cache) that needs to hear about it going stale.
+ */
+struct CodeObserver {
+    virtual ~CodeObserver() = default;
+
+    /// a store hit [addr, addr+len) inside the range fetched from so far
+    virtual void codeModified(uint64_t addr, uint64_t len) = 0;
+    /// the program asked for the icache to be flushed
+    virtual void codeFlushed() = 0;
+};
+
+/**
+ * Backing store for emulated memory, as 32-bit words: one private anonymous
+ * mapping, so memory the program never touches costs nothing and reads as
+ * zero, however big it is.
+ *
+ * This is a sparse paged store without a page table of our own: the kernel
+ * allocates a page on the first write to it, reads of untouched pages all
+ * share its zero page, and the hardware TLB does the translation. So the
+ * footprint follows what's touched (in 4KiB pages), while accesses stay a
+ * plain index with no lookup in front of them.
+ *
+ * A Shareable pool is backed by a memfd instead, so other pools can be views
+ * of the same memory: that's how the cores of a Card share it. Shared pages
+ * are allocated on first touch rather than first write.
+ *
+ * A Private view is copy-on-write over the memory instead: it sees stores to
+ * the memory (until it writes the page itself), but its own stores stay in
+ * it until they're discard()ed.
+ */
+class MemPool {
+  public:
+    enum class Backing { Private, Shareable };
+    /// how a view sees the memory it's a view of
+    enum class View {
+        Shared,  // stores through any view are seen through all of them
+        Private, // stores through this view are only seen through it
+    };
+
+    explicit MemPool(size_t words, Backing backing = Backing::Private);
+    /// another view of `memory`, which has to be Shareable
+    MemPool(const MemPool& memory, View view);
+    ~MemPool();
+
+    MemPool(const MemPool&) = delete;
+    MemPool& operator=(const MemPool&) = delete;
+
+    auto size() const -> size_t { return words; }
+    auto data() -> uint32_t* { return base; }
+    auto data() const -> const uint32_t* { return base; }
+    auto begin() -> uint32_t* { return base; }
+    auto end() -> uint32_t* { return base + words; }
+
+    auto operator[](size_t i) -> uint32_t& { return base[i]; }
+    auto operator[](size_t i) const -> uint32_t { return base[i]; }
+    auto operator==(const MemPool& other) const -> bool;
+
+    /**
+     * Loads the file at `path` to byte address `addr`, as far as it fits.
+     * Page-aligned loads into a private pool map the file copy-on-write
+     * instead of reading it: that's constant time, pages are read in as
+     * they're touched, and stores never reach the file. Throws
+     * std::runtime_error if the file can't be opened or mapped.
+     * @return bytes loaded
+     */
+    auto load(const std::string& path, uint64_t addr) -> uint64_t;
+
+    /// the host's page size, which is what writtenPages() counts in
+    static auto pageBytes() -> size_t;
+    /**
+     * Indices of the pages that have been written since they were mapped:
+     * everything that isn't still zero or still exactly what load() mapped
+     * from a file. The kernel already knows which pages those are, since it
+     * had to copy them, so this asks it (/proc/self/pagemap) instead of
+     * tracking stores; where it can't (or the pool is shareable, which the
+     * kernel sees as one big file), it falls back to every page that isn't
+     * all zero (or every page at all, for a private view or once load() has
+     * mapped a file, whose pages may have been zeroed). Either way, it may
+     * include pages that weren't written.
+     */
+    [[nodiscard]] auto writtenPages() const -> std::vector<uint64_t>;
+    /// what writtenPages() falls back to when it can't ask the kernel
+    [[nodiscard]] auto writtenPagesByContents() const
+        -> std::vector<uint64_t>;
+    /// drops a private view's own stores, so it sees the memory as it is now
+    void discard();
+    /// ...on just `pages`, which have to take in every page it's written
+    void discard(const std::vector<uint64_t>& pages);
+
+  private:
+    uint32_t* base;
+    size_t words;
+    size_t mappedBytes; // whole pages
+    int fd;             // the memfd behind a shareable pool, or -1
+    bool privateView;
+    bool fileMapped; // whether load() has mapped a file into it
+};
+
 struct MemSystem {
+    /// in bytes: the whole 36-bit address space
+    static constexpr uint64_t MAX_SIZE = uint64_t(1) << 36;
+
     explicit MemSystem(size_t size) : MemSystem(size, nullptr) {}
     MemSystem(size_t size, std::shared_ptr<Tracer> tracer)
-        : mempool(size, 0), tracer{tracer} {}
+        : mempool(size), tracer{tracer}, codeObserver{nullptr},
+          codeLo{UINT64_MAX}, codeHi{0}, trackWrites{false},
+          lastWritten{UINT64_MAX} {}
+    /// a view of `memory`, for one of several cores sharing it
+    MemSystem(const MemPool& memory, MemPool::View view)
+        : mempool(memory, view), tracer{nullptr}, codeObserver{nullptr},
+          codeLo{UINT64_MAX}, codeHi{0},
+          trackWrites{view == MemPool::View::Private},
+          lastWritten{UINT64_MAX} {}
 
     auto size() const -> uint64_t;
 
@@ -23,14 +140,75 @@ struct MemSystem {
 
     auto readInstruction(uint64_t addr) -> uint32_t;
 
+    /**
+     * Atomic read-modify-writes of the 36-bit word at `addr` (a 64-bit slot,
+     * like ld36/st36), atomic with those of other cores on other views of
+     * the same memory, without a lock.
+     * @return the word before
+     */
+    auto fetchAdd36(uint64_t addr, uint64_t delta) -> uint64_t;
+    /// ...which is replaced by `desired` only if it was `expected`
+    auto compareExchange36(uint64_t addr, uint64_t expected, uint64_t desired)
+        -> uint64_t;
+
+    /**
+     * Counts an instruction fetch from `pc` against the I-cache model. The
+     * engines only read and decode an instruction the first time they see
+     * it, so they call this each time one is executed instead.
+     */
+    void fetchICache(uint64_t pc);
+
     void flushICache();
     void flushDCacheDirty();
     void flushDCacheClean();
     void flushDCacheLine(uint64_t at);
 
+    /**
+     * For a private view: the pages (as MemPool::writtenPages() counts them)
+     * stored to since the last call, sorted, so its stores can be found and
+     * discarded without looking at the rest of memory.
+     */
+    auto takeWrittenPages() -> std::vector<uint64_t>;
+
+    void setCodeObserver(CodeObserver* obs) { codeObserver = obs; }
+    /// start counting data accesses against a model of the card's D-cache
+    void enableDCache(CacheConfig config) {
+        dcache = std::make_unique<Cache>(config);
+    }
+    /// ...and instruction fetches against its I-cache
+    void enableICache(CacheConfig config) {
+        icache = std::make_unique<Cache>(config);
+    }
+
     // private:
     void _check_addr(uint64_t addr, uint32_t alignTo) const;
+    void _notify_store(uint64_t addr, uint64_t len);
 
-    std::vector<uint32_t> mempool;
+    MemPool mempool;
+    // nullptr when nothing is recording memory traffic
     std::shared_ptr<Tracer> tracer;
+
+    // instruction fetches seen so far lie within [codeLo, codeHi)
+    CodeObserver* codeObserver;
+    uint64_t codeLo, codeHi;
+
+    // a private view notes the pages it stores to, the last one first
+    bool trackWrites;
+    uint64_t lastWritten;
+    std::vector<uint64_t> written;
+
+    // nullptr unless the D-cache is being modelled
+    std::unique_ptr<Cache> dcache;
+    // likewise the I-cache, with its misses counted by the PC that missed
+    std::unique_ptr<Cache> icache;
+    std::unordered_map<uint64_t, uint64_t> icacheMisses;
+
+    struct AtomicCounts {
+        uint64_t ops = 0;
+        // ones that found another core in the way: a fetch-and-add that had
+        // to retry, or a compare-exchange that failed
+        uint64_t contended = 0;
+    };
+    // by address. every core counts its own, so they never contend on this
+    std::unordered_map<uint64_t, AtomicCounts> atomics;
 };
@@ -0,0 +1,512 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <morph/decoder.h>
+
+#include "iproxy.h"
+#include "mem.h"
+
+/**
+ * An instruction word that has already been through the decoder: the
+ * CPUInstructionProxy entry point to call for it, with its operands
+ * unpacked so executing it again is just an indirect call.
+ */
+template <typename T> struct DecodedInstruction {
+    using Handler = void (*)(CPUInstructionProxy<T>&,
+                             const DecodedInstruction&);
+
+    Handler handler; // nullptr if this slot hasn't been decoded (yet)
+    uint32_t ir;
+
+    // register operands, in the order the visitor method takes them
+    uint8_t r[4];
+    // vector mask
+    uint8_t mask;
+    // arith op / condition code / ld-st width / readC half
+    uint8_t op;
+    // control flow (or halt): nothing after this runs straight-line
+    bool endsBlock;
+    // immediate, sign extended. vswizzle packs its lane indices in here.
+    int32_t imm;
+
+    void execute(CPUInstructionProxy<T>& proxy) const {
+        handler(proxy, *this);
+    }
+};
+
+/**
+ * Visitor that, instead of executing an instruction, records which
+ * CPUInstructionProxy method the decoder picked and with what operands.
+ *
+ * The handlers use qualified calls, so there's no vtable hop when a cached
+ * instruction is run.
+ */
+template <typename T> class Predecoder final : public isa::InstructionVisitor {
+  public:
+    using P = CPUInstructionProxy<T>;
+    using D = DecodedInstruction<T>;
+
+    explicit Predecoder(D& out) : out{out} {}
+    ~Predecoder() override = default;
+
+    // misc
+    void nop() override {
+        out.handler = [](P& p, const D& d) { p.P::nop(); };
+    }
+    void halt() override {
+        out.handler = [](P& p, const D& d) { p.P::halt(); };
+        out.endsBlock = true;
+    }
+    void bkpt(bits<25> signal) override {
+        out.handler = [](P& p, const D& d) {
+            p.P::bkpt(bits<25>(static_cast<uint32_t>(d.imm)));
+        };
+        out.imm = static_cast<int32_t>(signal.inner);
+    }
+
+    // J
+    void jmp(s<25> imm) override {
+        out.handler = [](P& p, const D& d) { p.P::jmp(d.imm); };
+        out.imm = imm._sgn_inner();
+        out.endsBlock = true;
+    }
+    void jal(s<25> imm) override {
+        out.handler = [](P& p, const D& d) { p.P::jal(d.imm); };
+        out.imm = imm._sgn_inner();
+        out.endsBlock = true;
+    }
+
+    // JR
+    void jmpr(reg_idx rA, s<20> imm) override {
+        out.handler = [](P& p, const D& d) { p.P::jmpr(d.r[0], d.imm); };
+        regs(rA);
+        out.imm = imm._sgn_inner();
+        out.endsBlock = true;
+    }
+    void jalr(reg_idx rA, s<20> imm) override {
+        out.handler = [](P& p, const D& d) { p.P::jalr(d.r[0], d.imm); };
+        regs(rA);
+        out.imm = imm._sgn_inner();
+        out.endsBlock = true;
+    }
+
+    // BI
+    void branchimm(condition_t cond, s<22> imm) override {
+        out.handler = [](P& p, const D& d) {
+            p.P::branchimm(condition_t(d.op), d.imm);
+        };
+        out.op = static_cast<uint8_t>(cond);
+        out.imm = imm._sgn_inner();
+        out.endsBlock = true;
+    }
+    // BR
+    void branchreg(condition_t cond, reg_idx rA, s<17> imm) override {
+        out.handler = [](P& p, const D& d) {
+            p.P::branchreg(condition_t(d.op), d.r[0], d.imm);
+        };
+        out.op = static_cast<uint8_t>(cond);
+        regs(rA);
+        out.imm = imm._sgn_inner();
+        out.endsBlock = true;
+    }
+
+    // LI
+    void lil(reg_idx rD, s<18> imm) override {
+        out.handler = [](P& p, const D& d) { p.P::lil(d.r[0], d.imm); };
+        regs(rD);
+        out.imm = imm._sgn_inner();
+    }
+    void lih(reg_idx rD, s<18> imm) override {
+        out.handler = [](P& p, const D& d) { p.P::lih(d.r[0], d.imm); };
+        regs(rD);
+        out.imm = imm._sgn_inner();
+    }
+
+    // vector memory
+    void vldi(vreg_idx vD, reg_idx rA, s<11> imm, vmask_t mask) override {
+        out.handler = [](P& p, const D& d) {
+            p.P::vldi(d.r[0], d.r[1], d.imm, d.mask);
+        };
+        regs(vD, rA);
+        out.imm = imm._sgn_inner();
+        out.mask = mask.inner;
+    }
+    void vsti(s<11> imm, reg_idx rA, vreg_idx vB, vmask_t mask) override {
+        out.handler = [](P& p, const D& d) {
+            p.P::vsti(d.imm, d.r[0], d.r[1], d.mask);
+        };
+        regs(rA, vB);
+        out.imm = imm._sgn_inner();
+        out.mask = mask.inner;
+    }
+    void vldr(vreg_idx vD, reg_idx rA, reg_idx rB, vmask_t mask) override {
+        out.handler = [](P& p, const D& d) {
+            p.P::vldr(d.r[0], d.r[1], d.r[2], d.mask);
+        };
+        regs(vD, rA, rB);
+        out.mask = mask.inner;
+    }
+    void vstr(reg_idx rA, reg_idx rB, vreg_idx vA, vmask_t mask) override {
+        out.handler = [](P& p, const D& d) {
+            p.P::vstr(d.r[0], d.r[1], d.r[2], d.mask);
+        };
+        regs(rA, rB, vA);
+        out.mask = mask.inner;
+    }
+
+    // ML / MS
+    void ld(reg_idx rD, reg_idx rA, s<15> imm, bool b36) override {
+        out.handler = [](P& p, const D& d) {
+            p.P::ld(d.r[0], d.r[1], d.imm, d.op);
+        };
+        regs(rD, rA);
+        out.imm = imm._sgn_inner();
+        out.op = b36;
+    }
+    void st(reg_idx rA, reg_idx rB, s<15> imm, bool b36) override {
+        out.handler = [](P& p, const D& d) {
+            p.P::st(d.r[0], d.r[1], d.imm, d.op);
+        };
+        regs(rA, rB);
+        out.imm = imm._sgn_inner();
+        out.op = b36;
+    }
+
+    // A / AI
+    void scalarArithmetic(reg_idx rD, reg_idx rA, reg_idx rB,
+                          isa::ScalarArithmeticOp op) override {
+        out.handler = [](P& p, const D& d) {
+            p.P::scalarArithmetic(d.r[0], d.r[1], d.r[2],
+                                  isa::ScalarArithmeticOp(d.op));
+        };
+        regs(rD, rA, rB);
+        out.op = static_cast<uint8_t>(op);
+    }
+    void scalarArithmeticImmediate(reg_idx rD, reg_idx rA, s<15> imm,
+                                   isa::ScalarArithmeticOp op) override {
+        out.handler = [](P& p, const D& d) {
+            p.P::scalarArithmeticImmediate(d.r[0], d.r[1], d.imm,
+                                           isa::ScalarArithmeticOp(d.op));
+        };
+        regs(rD, rA);
+        out.imm = imm._sgn_inner();
+        out.op = static_cast<uint8_t>(op);
+    }
+
+    void cmpI(reg_idx rA, s<20> imm) override {
+        out.handler = [](P& p, const D& d) { p.P::cmpI(d.r[0], d.imm); };
+        regs(rA);
+        out.imm = imm._sgn_inner();
+    }
+    void arithmeticNot(reg_idx rD, reg_idx rA) override {
+        out.handler = [](P& p, const D& d) {
+            p.P::arithmeticNot(d.r[0], d.r[1]);
+        };
+        regs(rD, rA);
+    }
+    void floatArithmetic(reg_idx rD, reg_idx rA, reg_idx rB,
+                         isa::FloatArithmeticOp op) override {
+        out.handler = [](P& p, const D& d) {
+            p.P::floatArithmetic(d.r[0], d.r[1], d.r[2],
+                                 isa::FloatArithmeticOp(d.op));
+        };
+        regs(rD, rA, rB);
+        out.op = static_cast<uint8_t>(op);
+    }
+    void cmp(reg_idx rA, reg_idx rB) override {
+        out.handler = [](P& p, const D& d) { p.P::cmp(d.r[0], d.r[1]); };
+        regs(rA, rB);
+    }
+
+    // vector arithmetic
+    void vectorArithmetic(isa::LanewiseVectorOp op, vreg_idx vD, vreg_idx vA,
+                          vreg_idx vB, vmask_t mask) override {
+        out.handler = [](P& p, const D& d) {
+            p.P::vectorArithmetic(isa::LanewiseVectorOp(d.op), d.r[0], d.r[1],
+                                  d.r[2], d.mask);
+        };
+        regs(vD, vA, vB);
+        out.op = static_cast<uint8_t>(op);
+        out.mask = mask.inner;
+    }
+    void vdot(reg_idx rD, vreg_idx vA, vreg_idx vB) override {
+        out.handler = [](P& p, const D& d) {
+            p.P::vdot(d.r[0], d.r[1], d.r[2]);
+        };
+        regs(rD, vA, vB);
+    }
+    void vdota(reg_idx rD, reg_idx rA, vreg_idx vA, vreg_idx vB) override {
+        out.handler = [](P& p, const D& d) {
+            p.P::vdota(d.r[0], d.r[1], d.r[2], d.r[3]);
+        };
+        regs(rD, rA, vA, vB);
+    }
+    void vidx(reg_idx rD, vreg_idx vA, vlaneidx_t imm) override {
+        out.handler = [](P& p, const D& d) {
+            p.P::vidx(d.r[0], d.r[1], static_cast<uint64_t>(d.imm));
+        };
+        regs(rD, vA);
+        out.imm = static_cast<int32_t>(imm.inner);
+    }
+    void vreduce(reg_idx rD, vreg_idx vA, vmask_t mask) override {
+        out.handler = [](P& p, const D& d) {
+            p.P::vreduce(d.r[0], d.r[1], d.mask);
+        };
+        regs(rD, vA);
+        out.mask = mask.inner;
+    }
+    void vsplat(vreg_idx vD, reg_idx rA, vmask_t mask) override {
+        out.handler = [](P& p, const D& d) {
+            p.P::vsplat(d.r[0], d.r[1], d.mask);
+        };
+        regs(vD, rA);
+        out.mask = mask.inner;
+    }
+    void vswizzle(vreg_idx vD, vreg_idx vA, vlaneidx_t i0, vlaneidx_t i1,
+                  vlaneidx_t i2, vlaneidx_t i3, vmask_t mask) override {
+        out.handler = [](P& p, const D& d) {
+            auto lane = [&](int i) -> uint64_t {
+                return (d.imm >> (2 * i)) & 3;
+            };
+            p.P::vswizzle(d.r[0], d.r[1], lane(0), lane(1), lane(2), lane(3),
+                          d.mask);
+        };
+        regs(vD, vA);
+        out.imm = static_cast<int32_t>(i0.inner | (i1.inner << 2) |
+                                       (i2.inner << 4) | (i3.inner << 6));
+        out.mask = mask.inner;
+    }
+    void vectorScalarArithmetic(isa::VectorScalarOp op, vreg_idx vD, reg_idx rA,
+                                vreg_idx vB, vmask_t mask) override {
+        out.handler = [](P& p, const D& d) {
+            p.P::vectorScalarArithmetic(isa::VectorScalarOp(d.op), d.r[0],
+                                        d.r[1], d.r[2], d.mask);
+        };
+        regs(vD, rA, vB);
+        out.op = static_cast<uint8_t>(op);
+        out.mask = mask.inner;
+    }
+    void vsma(vreg_idx vD, reg_idx rA, vreg_idx vA, vreg_idx vB,
+              vmask_t mask) override {
+        out.handler = [](P& p, const D& d) {
+            p.P::vsma(d.r[0], d.r[1], d.r[2], d.r[3], d.mask);
+        };
+        regs(vD, rA, vA, vB);
+        out.mask = mask.inner;
+    }
+    void vcomp(vreg_idx vD, reg_idx rA, reg_idx rB, vreg_idx vB,
+               vmask_t mask) override {
+        out.handler = [](P& p, const D& d) {
+            p.P::vcomp(d.r[0], d.r[1], d.r[2], d.r[3], d.mask);
+        };
+        regs(vD, rA, rB, vB);
+        out.mask = mask.inner;
+    }
+
+    // systolic array
+    void matrixWrite(isa::MatrixWriteOp op, u<3> idx, vreg_idx vA,
+                     vreg_idx vB) override {
+        out.handler = [](P& p, const D& d) {
+            p.P::matrixWrite(isa::MatrixWriteOp(d.op),
+                             static_cast<uint64_t>(d.imm), d.r[0], d.r[1]);
+        };
+        regs(vA, vB);
+        out.op = static_cast<uint8_t>(op);
+        out.imm = static_cast<int32_t>(idx.inner);
+    }
+    void matmul() override {
+        out.handler = [](P& p, const D& d) { p.P::matmul(); };
+    }
+    void systolicstep() override {
+        out.handler = [](P& p, const D& d) { p.P::systolicstep(); };
+    }
+    void readC(vreg_idx vD, u<3> idx, bool high) override {
+        out.handler = [](P& p, const D& d) {
+            p.P::readC(d.r[0], static_cast<uint64_t>(d.imm), d.op);
+        };
+        regs(vD);
+        out.imm = static_cast<int32_t>(idx.inner);
+        out.op = high;
+    }
+
+    // cache control
+    void flushdirty() override {
+        out.handler = [](P& p, const D& d) { p.P::flushdirty(); };
+    }
+    void flushclean() override {
+        out.handler = [](P& p, const D& d) { p.P::flushclean(); };
+    }
+    void flushicache() override {
+        out.handler = [](P& p, const D& d) { p.P::flushicache(); };
+    }
+    void flushline(reg_idx rA, s<20> imm) override {
+        out.handler = [](P& p, const D& d) { p.P::flushline(d.r[0], d.imm); };
+        regs(rA);
+        out.imm = imm._sgn_inner();
+    }
+
+    // atomics
+    void fa(reg_idx rD, reg_idx rA, s<15> imm) override {
+        out.handler = [](P& p, const D& d) { p.P::fa(d.r[0], d.r[1], d.imm); };
+        regs(rD, rA);
+        out.imm = imm._sgn_inner();
+    }
+    void cmpx(reg_idx rD, reg_idx rA, s<15> imm) override {
+        out.handler = [](P& p, const D& d) {
+            p.P::cmpx(d.r[0], d.r[1], d.imm);
+        };
+        regs(rD, rA);
+        out.imm = imm._sgn_inner();
+    }
+
+    // float <-> int
+    void ftoi(reg_idx rD, reg_idx rA) override {
+        out.handler = [](P& p, const D& d) { p.P::ftoi(d.r[0], d.r[1]); };
+        regs(rD, rA);
+    }
+    void itof(reg_idx rD, reg_idx rA) override {
+        out.handler = [](P& p, const D& d) { p.P::itof(d.r[0], d.r[1]); };
+        regs(rD, rA);
+    }
+
+    // csrs
+    void wcsr(s<2> csr, reg_idx rA) override {
+        out.handler = [](P& p, const D& d) { p.P::wcsr(d.imm, d.r[0]); };
+        regs(rA);
+        out.imm = csr._sgn_inner();
+    }
+    void rcsr(s<2> csr, reg_idx rA) override {
+        out.handler = [](P& p, const D& d) { p.P::rcsr(d.imm, d.r[0]); };
+        regs(rA);
+        out.imm = csr._sgn_inner();
+    }
+
+    void cmpdec(reg_idx rD, reg_idx rA, reg_idx rB) override {
+        out.handler = [](P& p, const D& d) {
+            p.P::cmpdec(d.r[0], d.r[1], d.r[2]);
+        };
+        regs(rD, rA, rB);
+    }
+    void cmpinc(reg_idx rD, reg_idx rA, reg_idx rB) override {
+        out.handler = [](P& p, const D& d) {
+            p.P::cmpinc(d.r[0], d.r[1], d.r[2]);
+        };
+        regs(rD, rA, rB);
+    }
+
+  private:
+    template <typename... Rs> void regs(Rs... rs) {
+        size_t i = 0;
+        ((out.r[i++] = static_cast<uint8_t>(rs.inner)), ...);
+    }
+
+    D& out;
+};
+
+/**
+ * Caches decoded instructions by PC so the main loop only has to run the
+ * decoder the first time it sees an instruction word.
+ *
+ * Entries go stale when a store lands on an address we've fetched from, or
+ * when the program runs `flushicache`; MemSystem tells us about both.
+ *
+ * The cache is kept a page of code at a time, made the first time something
+ * on it is fetched, so code far up the 36-bit address space costs no more
+ * than code at 0.
+ */
+template <typename T> class PredecodeCache : public CodeObserver {
+  public:
+    static constexpr uint64_t PAGE_BYTES = 4096;
+
+    explicit PredecodeCache(MemSystem& mem) : mem{mem} {
+        mem.setCodeObserver(this);
+    }
+    ~PredecodeCache() override { mem.setCodeObserver(nullptr); }
+
+    PredecodeCache(const PredecodeCache&) = delete;
+    PredecodeCache& operator=(const PredecodeCache&) = delete;
+
+    auto fetch(uint64_t pc) -> const DecodedInstruction<T>& {
+        // straight-line code and loops stay on the page they were on
+        if ((pc % 4) == 0 && pc / PAGE_BYTES == lastPage) {
+            auto& entry = (*last)[pc % PAGE_BYTES / 4];
+            if (entry.handler)
+                return entry;
+        }
+
+        return fill(pc);
+    }
+
+    void codeModified(uint64_t addr, uint64_t len) override {
+        if (len == 0)
+            return;
+        uint64_t lo = addr / 4, hi = (addr + len + 3) / 4;
+        auto invalidate = [&](uint64_t page, Page& entries) {
+            uint64_t first = page * PAGE_INSTS;
+            uint64_t from = std::max(lo, first) - first;
+            uint64_t to = std::min(hi, first + PAGE_INSTS) - first;
+            for (auto idx = from; idx < to; idx++)
+                entries[idx].handler = nullptr;
+        };
+
+        uint64_t loPage = addr / PAGE_BYTES;
+        uint64_t hiPage = (addr + len - 1) / PAGE_BYTES;
+        if (hiPage - loPage < pages.size()) {
+            for (auto page = loPage; page <= hiPage; page++)
+                if (auto it = pages.find(page); it != pages.end())
+                    invalidate(page, *it->second);
+        } else {
+            for (auto& [page, entries] : pages)
+                if (page >= loPage && page <= hiPage)
+                    invalidate(page, *entries);
+        }
+    }
+
+    void codeFlushed() override {
+        pages.clear();
+        lastPage = NO_PAGE;
+        last = nullptr;
+    }
+
+    /// pages of code decoded, for tests
+    [[nodiscard]] auto nPages() const -> size_t { return pages.size(); }
+
+  private:
+    static constexpr uint64_t PAGE_INSTS = PAGE_BYTES / 4;
+    static constexpr uint64_t NO_PAGE = UINT64_MAX;
+    using Page = std::array<DecodedInstruction<T>, PAGE_INSTS>;
+
+    auto fill(uint64_t pc) -> const DecodedInstruction<T>& {
+        // does alignment + bounds checking for us
+        auto ir = mem.readInstruction(pc);
+
+        uint64_t page = pc / PAGE_BYTES;
+        if (page != lastPage) {
+            auto& entries = pages[page];
+            if (!entries)
+                entries = std::make_unique<Page>();
+            lastPage = page;
+            last = entries.get();
+        }
+
+        auto& slot = (*last)[pc % PAGE_BYTES / 4];
+        slot = DecodedInstruction<T>{};
+        slot.ir = ir;
+        Predecoder<T> predecoder(slot);
+        isa::decodeInstruction(predecoder, bits<32>(ir));
+
+        return slot;
+    }
+
+    MemSystem& mem;
+    std::unordered_map<uint64_t, std::unique_ptr<Page>> pages;
+    // the page the last fetch was on
+    uint64_t lastPage = NO_PAGE;
+    Page* last = nullptr;
+};
@@ -0,0 +1,159 @@
+#include "profile.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include <sys/mman.h>
+
+#include <fmt/format.h>
+#include <morph/decoder.h>
+
+static auto disassemble(uint32_t ir) -> std::string {
+    std::ostringstream os;
+    isa::PrintVisitor printvis(os);
+    isa::decodeInstruction(printvis, bits<32>(ir));
+    return os.str();
+}
+
+static auto opcodeAt(const MemSystem& mem, uint64_t pc) -> isa::Opcode {
+    return static_cast<isa::Opcode>(
+        isa::opcodeOf(bits<32>(mem.mempool[pc / 4])));
+}
+
+/// PCs of everything that ran, in order
+static auto ranPCs(const Profile& profile, const MemSystem& mem)
+    -> std::vector<uint64_t> {
+    std::vector<uint64_t> pcs;
+    for (uint64_t pc = mem.codeLo & ~uint64_t(3); pc < mem.codeHi; pc += 4)
+        if (profile.executed(pc))
+            pcs.push_back(pc);
+    return pcs;
+}
+
+Profile::Profile(uint64_t memBytes) {
+    mappedBytes = std::max<size_t>((memBytes + 3) / 4 * sizeof(uint64_t), 1);
+    void* p = mmap(nullptr, mappedBytes, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED)
+        throw std::runtime_error(fmt::format(
+            "can't map {} bytes of profile counts: {}", mappedBytes,
+            std::strerror(errno)));
+    counts = static_cast<uint64_t*>(p);
+}
+
+Profile::~Profile() { munmap(counts, mappedBytes); }
+
+auto Profile::blocks(const MemSystem& mem) const -> std::vector<Block> {
+    std::vector<Block> out;
+    bool open = false;
+    for (auto pc : ranPCs(*this, mem)) {
+        auto n = executed(pc);
+        if (!open || out.back().end != pc || out.back().entries != n) {
+            out.push_back(Block{pc, pc, n, 0});
+            open = true;
+        }
+        auto& b = out.back();
+        b.end = pc + 4;
+        b.insts += n;
+        open = !endsBlock(opcodeAt(mem, pc));
+    }
+    return out;
+}
+
+void Profile::writeReport(std::FILE* out, const MemSystem& mem,
+                          size_t n) const {
+    // long blocks (unrolled loops, say) only show this much of themselves
+    constexpr uint64_t BLOCK_LINES = 16;
+
+    auto pcs = ranPCs(*this, mem);
+    uint64_t total = 0;
+    for (auto pc : pcs)
+        total += executed(pc);
+    auto pct = [&](uint64_t count) {
+        return total ? 100.0 * double(count) / double(total) : 0.0;
+    };
+    fmt::print(out, "profile: {} instructions executed\n", total);
+
+    auto hotPCs = pcs;
+    auto nPCs = std::min(n, hotPCs.size());
+    std::partial_sort(hotPCs.begin(), hotPCs.begin() + nPCs, hotPCs.end(),
+                      [&](uint64_t a, uint64_t b) {
+                          return executed(a) != executed(b)
+                                     ? executed(a) > executed(b)
+                                     : a < b;
+                      });
+    if (nPCs)
+        fmt::print(out, "  hottest instructions:\n");
+    for (size_t i = 0; i < nPCs; i++) {
+        auto pc = hotPCs[i];
+        fmt::print(out, "    {:#x}: {:>12} ({:5.2f}%)  {}\n", pc, executed(pc),
+                   pct(executed(pc)), disassemble(mem.mempool[pc / 4]));
+    }
+
+    auto hotBlocks = blocks(mem);
+    auto nBlocks = std::min(n, hotBlocks.size());
+    std::partial_sort(hotBlocks.begin(), hotBlocks.begin() + nBlocks,
+                      hotBlocks.end(), [](const Block& a, const Block& b) {
+                          return a.insts != b.insts ? a.insts > b.insts
+                                                    : a.start < b.start;
+                      });
+    if (nBlocks)
+        fmt::print(out, "  hottest blocks:\n");
+    for (size_t i = 0; i < nBlocks; i++) {
+        auto& b = hotBlocks[i];
+        fmt::print(out, "    {:#x}-{:#x}: {} instructions ({:.2f}%) over {} "
+                        "runs\n",
+                   b.start, b.end, b.insts, pct(b.insts), b.entries);
+        auto last = std::min(b.end, b.start + BLOCK_LINES * 4);
+        for (uint64_t pc = b.start; pc < last; pc += 4)
+            fmt::print(out, "      {:#x}: {}\n", pc,
+                       disassemble(mem.mempool[pc / 4]));
+        if (last != b.end)
+            fmt::print(out, "      ... {} more\n", (b.end - last) / 4);
+    }
+}
+
+/// as a JSON string literal
+static auto jsonString(const std::string& s) -> std::string {
+    std::string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\')
+            out += '\\';
+        out += c;
+    }
+    return out + '"';
+}
+
+void Profile::writeJson(std::ostream& out, const MemSystem& mem) const {
+    out << "{\n  \"instructions\": [";
+    bool first = true;
+    for (auto pc : ranPCs(*this, mem)) {
+        out << (first ? "\n" : ",\n")
+            << fmt::format("    {{\"pc\": {}, \"count\": {}, \"asm\": {}}}",
+                           pc, executed(pc),
+                           jsonString(disassemble(mem.mempool[pc / 4])));
+        first = false;
+    }
+    out << "\n  ],\n  \"blocks\": [";
+    first = true;
+    for (auto& b : blocks(mem)) {
+        out << (first ? "\n" : ",\n")
+            << fmt::format("    {{\"start\": {}, \"end\": {}, \"entries\": {}, "
+                           "\"insts\": {}}}",
+                           b.start, b.end, b.entries, b.insts);
+        first = false;
+    }
+    out << "\n  ]\n}\n";
+}
+
+void Profile::writeCsv(std::ostream& out, const MemSystem& mem) const {
+    out << "pc,count,asm\n";
+    for (auto pc : ranPCs(*this, mem)) {
+        // disassembly has commas in it, but never quotes
+        out << fmt::format("{:#x},{},\"{}\"\n", pc, executed(pc),
+                           disassemble(mem.mempool[pc / 4]));
+    }
+}
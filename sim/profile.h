@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <ostream>
+#include <vector>
+
+#include <morph/opcodes.h>
+
+#include "mem.h"
+
+/// jumps, branches and halt: nothing after one of these runs straight-line
+inline auto endsBlock(isa::Opcode op) -> bool {
+    switch (op) {
+    case isa::Opcode::halt:
+    case isa::Opcode::jmp:
+    case isa::Opcode::jal:
+    case isa::Opcode::jmpr:
+    case isa::Opcode::jalr:
+    case isa::Opcode::bi:
+    case isa::Opcode::br:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/**
+ * How many times each instruction ran. The counts are one flat array indexed
+ * by pc/4, covering all of emulated memory, so counting is a single
+ * increment. Like MemPool it's a lazily-backed mapping, so only the pages
+ * around code that actually ran take up memory.
+ */
+class Profile {
+  public:
+    /// a straight-line run of instructions that all ran the same number of
+    /// times
+    struct Block {
+        uint64_t start;
+        uint64_t end; // PC just past the last instruction
+        uint64_t entries;
+        uint64_t insts; // executed, over all entries
+    };
+
+    /// counts for `memBytes` of emulated memory
+    explicit Profile(uint64_t memBytes);
+    ~Profile();
+
+    Profile(const Profile&) = delete;
+    Profile& operator=(const Profile&) = delete;
+
+    /// `pc` has to be an instruction fetch that succeeded
+    void count(uint64_t pc) { counts[pc / 4]++; }
+    [[nodiscard]] auto executed(uint64_t pc) const -> uint64_t {
+        return counts[pc / 4];
+    }
+
+    /**
+     * Splits everything that ran into blocks. A block ends after a jump,
+     * branch or halt, and before an instruction that ran a different number
+     * of times (so something jumped into or out of the middle). The code is
+     * read back out of `mem`; only what it has fetched is looked at.
+     */
+    [[nodiscard]] auto blocks(const MemSystem& mem) const -> std::vector<Block>;
+
+    /// the `n` hottest instructions and blocks, disassembled
+    void writeReport(std::FILE* out, const MemSystem& mem, size_t n) const;
+    /// every instruction that ran, and every block
+    void writeJson(std::ostream& out, const MemSystem& mem) const;
+    /// every instruction that ran: pc, count, disassembly
+    void writeCsv(std::ostream& out, const MemSystem& mem) const;
+
+  private:
+    uint64_t* counts;
+    size_t mappedBytes;
+};
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+/**
+ * Bounded, lock-free queue between exactly one producer thread and exactly
+ * one consumer thread. Neither side ever blocks: push() fails when full and
+ * front() returns nullptr when empty, and waiting is up to the caller.
+ *
+ * Each side keeps a stale copy of the other's index and only re-reads the
+ * shared one when the copy says it's out of room, so in steady state the
+ * two threads don't touch each other's cache lines.
+ */
+template <typename T, size_t N> class SpscRing {
+    static_assert(N > 0 && (N & (N - 1)) == 0, "ring size must be 2^n");
+
+  public:
+    static constexpr size_t CAPACITY = N;
+
+    SpscRing() : slots{std::make_unique<T[]>(N)} {}
+
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    // -- producer side
+
+    /// false (and nothing queued) if the ring is full
+    auto push(const T& v) -> bool {
+        auto h = head.load(std::memory_order_relaxed);
+        if (h - cachedTail == N) {
+            cachedTail = tail.load(std::memory_order_acquire);
+            if (h - cachedTail == N)
+                return false;
+        }
+        slots[h & (N - 1)] = v;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // -- consumer side
+
+    /// oldest queued entry, or nullptr if empty. valid until pop()
+    auto front() -> T* {
+        auto t = tail.load(std::memory_order_relaxed);
+        if (t == cachedHead) {
+            cachedHead = head.load(std::memory_order_acquire);
+            if (t == cachedHead)
+                return nullptr;
+        }
+        return &slots[t & (N - 1)];
+    }
+
+    /// drops front(), which must exist
+    void pop() {
+        tail.store(tail.load(std::memory_order_relaxed) + 1,
+                   std::memory_order_release);
+    }
+
+    // -- either side (exact only when the other side is idle)
+
+    auto size() const -> size_t {
+        return head.load(std::memory_order_acquire) -
+               tail.load(std::memory_order_acquire);
+    }
+    auto empty() const -> bool { return size() == 0; }
+
+  private:
+    // one cache line per side: the index it writes, and its copy of the
+    // index it reads
+    alignas(64) std::atomic<uint64_t> head{0};
+    uint64_t cachedTail = 0;
+    alignas(64) std::atomic<uint64_t> tail{0};
+    uint64_t cachedHead = 0;
+    alignas(64) std::unique_ptr<T[]> slots;
+};
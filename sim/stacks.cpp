@@ -0,0 +1,103 @@
+#include "stacks.h"
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include <fmt/format.h>
+#include <morph/opcodes.h>
+
+SymbolMap::SymbolMap(const std::string& path) {
+    std::ifstream in(path);
+    if (!in.is_open())
+        throw std::runtime_error(fmt::format("can't open `{}`", path));
+
+    std::string line;
+    for (size_t lineNo = 1; std::getline(in, line); lineNo++) {
+        if (line.empty())
+            continue;
+        std::istringstream fields(line);
+        std::string addr, name;
+        uint64_t value;
+        size_t used = 0;
+        try {
+            fields >> addr >> name;
+            value = std::stoull(addr, &used, 0);
+        } catch (const std::logic_error&) {
+            used = 0;
+        }
+        if (name.empty() || used != addr.size())
+            throw std::runtime_error(fmt::format(
+                "{}:{}: expected `ADDR NAME`, got `{}`", path, lineNo, line));
+        add(value, name);
+    }
+}
+
+void SymbolMap::add(uint64_t addr, std::string name) {
+    if (name.find('.') != std::string::npos)
+        return;
+    // first one wins, as asm lists labels at the same address by name
+    byAddr.emplace(addr, std::move(name));
+}
+
+auto SymbolMap::name(uint64_t pc) const -> std::string {
+    auto it = byAddr.upper_bound(pc);
+    if (it == byAddr.begin())
+        return fmt::format("{:#x}", pc);
+    return std::prev(it)->second;
+}
+
+CallStacks::CallStacks() : nodes{Node{0, 0, 0, {}}}, stack{} {}
+
+auto CallStacks::callee(size_t caller, uint64_t entry) -> size_t {
+    auto [it, added] = nodes[caller].callees.try_emplace(entry, nodes.size());
+    auto node = it->second;
+    // (invalidates `it`)
+    if (added)
+        nodes.push_back(Node{entry, caller, 0, {}});
+    return node;
+}
+
+void CallStacks::retire(uint64_t pc, uint32_t ir, const CPUState& cpu,
+                        uint64_t weight) {
+    if (stack.empty())
+        stack.push_back(Frame{callee(0, pc), 0});
+    nodes[stack.back().node].weight += weight;
+
+    switch (static_cast<isa::Opcode>(isa::opcodeOf(bits<32>(ir)))) {
+    case isa::Opcode::jal:
+    case isa::Opcode::jalr:
+        stack.push_back(Frame{callee(stack.back().node, cpu.pc.peekTaken()),
+                              cpu.pc.peekNotTaken()});
+        break;
+    case isa::Opcode::jmpr: {
+        // a jump somewhere else (a switch table, say) isn't a return
+        auto target = cpu.pc.peekTaken();
+        for (auto i = stack.size(); i-- > 1;) {
+            if (stack[i].returnTo == target) {
+                stack.resize(i);
+                break;
+            }
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+void CallStacks::writeFolded(std::ostream& out,
+                             const SymbolMap& symbols) const {
+    std::vector<std::string> paths(nodes.size());
+    std::map<std::string, uint64_t> folded;
+    // parents always come before their callees
+    for (size_t i = 1; i < nodes.size(); i++) {
+        auto& node = nodes[i];
+        auto name = symbols.name(node.entry);
+        paths[i] = node.parent ? paths[node.parent] + ';' + name : name;
+        if (node.weight)
+            folded[paths[i]] += node.weight;
+    }
+    for (auto& [path, weight] : folded)
+        out << path << ' ' << weight << '\n';
+}
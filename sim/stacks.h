@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "cpu.h"
+
+/**
+ * Addresses to names, from the sidecar `asm --symbols` writes. A PC is named
+ * after the closest function label at or below it; local labels
+ * (`parent.local`) never name anything, so a call into the middle of a
+ * function still gets the function's name.
+ */
+class SymbolMap {
+  public:
+    SymbolMap() = default;
+    /// throws std::runtime_error if `path` can't be read or parsed
+    explicit SymbolMap(const std::string& path);
+
+    void add(uint64_t addr, std::string name);
+    /// the symbol covering `pc`, or `pc` in hex if there isn't one
+    [[nodiscard]] auto name(uint64_t pc) const -> std::string;
+
+  private:
+    std::map<uint64_t, std::string> byAddr;
+};
+
+/**
+ * A call-stack profile. jal and jalr push a frame for their target; a jmpr
+ * to the return address of a frame on the stack pops back to it, however
+ * the return address got into the register. Every retired instruction adds
+ * its weight (1, or its cycles under --timing) to the stack it ran on.
+ *
+ * The stacks are kept as a tree, so each instruction costs an add and, on a
+ * call, one lookup among the caller's callees.
+ */
+class CallStacks {
+  public:
+    CallStacks();
+
+    /// `ir` at `pc` has just executed on `cpu`
+    void retire(uint64_t pc, uint32_t ir, const CPUState& cpu,
+                uint64_t weight);
+
+    /// how deep the stack is now; the frame the program started in is 1
+    [[nodiscard]] auto depth() const -> size_t { return stack.size(); }
+
+    /**
+     * Folded stacks, one `outer;inner;innermost weight` line per distinct
+     * stack, as read by flamegraph.pl and speedscope. Stacks that name the
+     * same functions are merged.
+     */
+    void writeFolded(std::ostream& out, const SymbolMap& symbols) const;
+
+  private:
+    struct Node {
+        uint64_t entry;
+        size_t parent;
+        uint64_t weight;
+        std::map<uint64_t, size_t> callees; // entry -> node
+    };
+    struct Frame {
+        size_t node;
+        uint64_t returnTo;
+    };
+
+    auto callee(size_t caller, uint64_t entry) -> size_t;
+
+    std::vector<Node> nodes; // nodes[0] is a root above the first frame
+    std::vector<Frame> stack;
+};
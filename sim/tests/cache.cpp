@@ -0,0 +1,192 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest.h"
+
+#include <stdexcept>
+
+#include "cache.h"
+#include "mem.h"
+
+/// the usual layout, so neighbouring lines land in different sets
+auto lowIndexed(uint32_t ways, uint32_t sets) -> CacheConfig {
+    CacheConfig config;
+    config.ways = ways;
+    config.sets = sets;
+    config.indexBit = 6;
+    return config;
+}
+
+TEST_CASE("hits and misses") {
+    Cache cache(lowIndexed(4, 256));
+    CHECK_FALSE(cache.access(0x1000, false));
+    CHECK(cache.access(0x1000, false));
+    // same line
+    CHECK(cache.access(0x1030, true));
+    // next line, next set
+    CHECK_FALSE(cache.access(0x1040, false));
+
+    auto& st = cache.stats();
+    CHECK(st.reads == 3);
+    CHECK(st.writes == 1);
+    CHECK(st.readMisses == 2);
+    CHECK(st.writeMisses == 0);
+    CHECK(st.writebacks == 0);
+}
+
+TEST_CASE("the default index is the top of the address") {
+    // data_cache_controller.sv indexes with addr[35:28], so everything in
+    // the low 256MiB shares set 0: five lines there are one too many
+    Cache cache{CacheConfig{}};
+    for (uint64_t line = 0; line < 5; line++)
+        cache.access(line * 64, false);
+    CHECK_FALSE(cache.access(0, false));
+
+    // ...while one 256MiB up is another set entirely
+    CHECK_FALSE(cache.access(uint64_t(1) << 28, false));
+    CHECK(cache.access(0, false));
+}
+
+TEST_CASE("pseudo-LRU replacement matches the RTL") {
+    // one set, so every line competes for the same 4 ways
+    Cache cache(lowIndexed(4, 1));
+    auto line = [](uint64_t n) { return n * 64; };
+
+    // invalid ways fill 3, 2, 1, 0. then at each level the tree points away
+    // from the more recent use: the 1x half (way 0 was last), then way 3
+    // (way 2 came after it)
+    for (uint64_t n = 0; n < 4; n++)
+        cache.access(line(n), false);
+    cache.access(line(4), false); // evicts way 3, which is line 0
+    CHECK(cache.access(line(1), false));
+    CHECK(cache.access(line(2), false));
+    CHECK(cache.access(line(3), false));
+    CHECK(cache.access(line(4), false));
+    CHECK_FALSE(cache.access(line(0), false));
+
+    // and again from the top, one more line in: 4 went to way 3, so the
+    // root points at the 1x half and the 0x side loses, where way 0 (line 3)
+    // is newer than way 1 (line 2)
+    Cache fresh(lowIndexed(4, 1));
+    for (uint64_t n = 0; n < 5; n++)
+        fresh.access(line(n), false);
+    fresh.access(line(5), false);
+    CHECK_FALSE(fresh.access(line(2), false));
+}
+
+TEST_CASE("write-back") {
+    Cache cache(lowIndexed(2, 1));
+
+    SUBCASE("dirty lines are written back when evicted") {
+        cache.access(0x000, true);
+        cache.access(0x040, false);
+        cache.access(0x080, false); // evicts the dirty one
+        CHECK(cache.stats().writebacks == 1);
+        cache.access(0x0c0, false); // and now a clean one
+        CHECK(cache.stats().writebacks == 1);
+    }
+
+    SUBCASE("flushdirty writes back and keeps lines") {
+        cache.access(0x000, true);
+        cache.access(0x040, true);
+        cache.flushDirty();
+        CHECK(cache.stats().writebacks == 2);
+        CHECK(cache.access(0x000, false));
+        cache.flushDirty();
+        CHECK(cache.stats().writebacks == 2);
+    }
+
+    SUBCASE("flushclean only drops clean lines") {
+        cache.access(0x000, true);
+        cache.access(0x040, false);
+        cache.flushClean();
+        CHECK(cache.stats().writebacks == 0);
+        CHECK(cache.access(0x000, false));
+        CHECK_FALSE(cache.access(0x040, false));
+    }
+
+    SUBCASE("flushline writes back and drops one line") {
+        cache.access(0x000, true);
+        cache.access(0x040, true);
+        cache.flushLine(0x010);
+        CHECK(cache.stats().writebacks == 1);
+        CHECK(cache.access(0x040, false));
+        CHECK_FALSE(cache.access(0x000, false));
+        // not cached: nothing to do
+        cache.flushLine(0x800);
+        CHECK(cache.stats().writebacks == 1);
+    }
+}
+
+TEST_CASE("unsupported shapes") {
+    auto config = [](uint32_t line, uint32_t ways, uint32_t sets) {
+        CacheConfig c;
+        c.lineBytes = line;
+        c.ways = ways;
+        c.sets = sets;
+        return c;
+    };
+    CHECK_THROWS_AS(Cache(config(48, 4, 256)), std::invalid_argument);
+    CHECK_THROWS_AS(Cache(config(8, 4, 256)), std::invalid_argument);
+    CHECK_THROWS_AS(Cache(config(64, 3, 256)), std::invalid_argument);
+    CHECK_THROWS_AS(Cache(config(64, 64, 256)), std::invalid_argument);
+    // 256 sets from bit 28 is all 36 bits; 512 would run past them
+    CHECK_THROWS_AS(Cache(config(64, 4, 512)), std::invalid_argument);
+    CHECK_NOTHROW(Cache(config(16, 32, 256)));
+}
+
+TEST_CASE("MemSystem counts data accesses against its cache") {
+    MemSystem mem(4096);
+    mem.enableDCache(lowIndexed(4, 64));
+
+    mem.write(0x100, u<32>(1));
+    mem.read32(0x104);
+    mem.readVec(0x110);
+    mem.read36(0x200);
+    // fetches aren't data accesses
+    mem.readInstruction(0x300);
+
+    auto& st = mem.dcache->stats();
+    CHECK(st.writes == 1);
+    CHECK(st.writeMisses == 1);
+    CHECK(st.reads == 3);
+    CHECK(st.readMisses == 1);
+
+    mem.flushDCacheLine(0x100);
+    CHECK(st.writebacks == 1);
+}
+
+TEST_CASE("the I-cache index leaves the top bit to the tag") {
+    // icache_controller.sv indexes with addr[34:28]. direct-mapped, so any
+    // two lines in one set evict each other
+    auto config = CacheConfig::icache();
+    config.ways = 1;
+    Cache cache(config);
+    cache.access(0, false);
+    cache.access(uint64_t(1) << 34, false);
+    CHECK(cache.access(0, false));
+    cache.access(uint64_t(1) << 35, false);
+    CHECK_FALSE(cache.access(0, false));
+}
+
+TEST_CASE("MemSystem counts fetches against its I-cache by PC") {
+    MemSystem mem(4096);
+    mem.enableICache(lowIndexed(4, 64));
+
+    // a loop over two lines, then a jump away
+    for (int i = 0; i < 3; i++)
+        for (uint64_t pc = 0x38; pc < 0x48; pc += 4)
+            mem.fetchICache(pc);
+    mem.fetchICache(0x800);
+
+    auto& st = mem.icache->stats();
+    CHECK(st.reads == 3 * 4 + 1);
+    CHECK(st.readMisses == 3);
+    CHECK(mem.icacheMisses.size() == 3);
+    CHECK(mem.icacheMisses[0x38] == 1);
+    CHECK(mem.icacheMisses[0x40] == 1);
+
+    // flushicache empties it
+    mem.flushICache();
+    mem.fetchICache(0x38);
+    CHECK(mem.icacheMisses[0x38] == 2);
+    CHECK(mem.dcache == nullptr);
+}
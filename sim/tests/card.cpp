@@ -0,0 +1,269 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest.h"
+
+#include <morph/encoder.h>
+#include <morph/util.h>
+
+#include "card.h"
+
+using isa::ScalarArithmeticOp;
+
+void load(Card& card, const std::vector<uint32_t>& code) {
+    std::copy(code.begin(), code.end(), card.memory().begin());
+}
+
+/// each core stores r1 + 1 to 0x1000 + 4*r1
+auto storeId() -> std::vector<uint32_t> {
+    isa::Emitter e;
+    e.loadImmediate(false, 2, 0x1000);
+    for (int i = 0; i < 4; i++)
+        e.scalarArithmetic(ScalarArithmeticOp::Add, 2, 2, 1);
+    e.scalarArithmeticImmediate(ScalarArithmeticOp::Add, 3, 1, 1);
+    e.storeScalar(false, 2, 3, 0);
+    e.halt();
+    return e.getData();
+}
+
+TEST_CASE("cores share memory") {
+    Card card(4096, 4);
+    load(card, storeId());
+    for (size_t i = 0; i < card.nCores(); i++)
+        card.core(i).cpu.r[1] = i;
+
+    CHECK(card.run(Card::DEFAULT_QUANTUM, 0, [] { return true; }));
+    for (size_t i = 0; i < card.nCores(); i++) {
+        CHECK(card.core(i).cpu.isHalted());
+        CHECK(card.core(i).retired == 8);
+        CHECK(card.memory()[0x1000 / 4 + i] == i + 1);
+    }
+}
+
+TEST_CASE("a core sees another's store") {
+    // core 0 counts down for a while, then sets the flag core 1 spins on
+    isa::Emitter e;
+    e.compareImm(1, 0);
+    e.branchImm(condition_t::nz, 8);
+    e.loadImmediate(false, 4, 1000);
+    e.scalarArithmeticImmediate(ScalarArithmeticOp::Sub, 4, 4, 1);
+    e.compareImm(4, 0);
+    e.branchImm(condition_t::nz, -3);
+    e.loadImmediate(false, 5, 0x2000);
+    e.loadImmediate(false, 6, 7);
+    e.storeScalar(false, 5, 6, 0);
+    e.halt();
+    // core 1
+    e.loadImmediate(false, 5, 0x2000);
+    e.loadScalar(false, 6, 5, 0);
+    e.compareImm(6, 0);
+    e.branchImm(condition_t::ez, -3);
+    e.halt();
+
+    Card card(4096, 2);
+    load(card, e.getData());
+    card.core(1).cpu.r[1] = 1;
+
+    size_t quanta = 0;
+    CHECK(card.run(100, 0, [&] {
+        quanta++;
+        return true;
+    }));
+    CHECK(card.core(1).cpu.r[6].inner == 7);
+    // core 0 took about 3000 instructions, and core 1 spun for as long
+    CHECK(quanta >= 29);
+    CHECK(card.core(1).retired >= 2900);
+}
+
+TEST_CASE("stopping a run, and a core that panics") {
+    isa::Emitter spin;
+    spin.branchImm(condition_t::nz, -1);
+    Card card(4096, 2);
+    load(card, spin.getData());
+
+    size_t quanta = 0;
+    CHECK(!card.run(10, 0, [&] { return ++quanta < 5; }));
+    CHECK(card.core(0).retired == 50);
+    CHECK(card.core(1).retired == 50);
+
+    // r1 is misaligned on core 1
+    isa::Emitter e;
+    e.loadScalar(true, 2, 1, 0);
+    e.halt();
+    Card crashing(4096, 2);
+    load(crashing, e.getData());
+    crashing.core(1).cpu.r[1] = 2;
+    CHECK_THROWS_AS(crashing.run(10, 0, [] { return true; }), Panic);
+    CHECK(crashing.core(0).cpu.isHalted());
+}
+
+TEST_CASE("held cores sit runs out, and a reset core starts over") {
+    Card card(4096, 2);
+    load(card, storeId());
+    card.core(0).cpu.r[1] = 0;
+    card.core(1).cpu.r[1] = 1;
+    card.core(1).held = true;
+
+    // all that's left to run is held
+    CHECK(!card.run(Card::DEFAULT_QUANTUM, 0, [] { return true; }));
+    CHECK(card.core(0).cpu.isHalted());
+    CHECK(card.core(1).retired == 0);
+    CHECK(card.memory()[0x1000 / 4 + 1] == 0);
+
+    card.core(1).held = false;
+    CHECK(card.run(Card::DEFAULT_QUANTUM, 0, [] { return true; }));
+    CHECK(card.memory()[0x1000 / 4 + 1] == 2);
+
+    // new code where the old was: a reset core runs it from the top, with
+    // r1 cleared
+    isa::Emitter e;
+    e.loadImmediate(false, 2, 0x1010);
+    e.storeScalar(false, 2, 1, 0);
+    e.halt();
+    load(card, e.getData());
+    card.reset(0);
+    CHECK(!card.core(0).cpu.isHalted());
+    card.memory()[0x1010 / 4] = 99;
+    CHECK(card.run(Card::DEFAULT_QUANTUM, 0, [] { return true; }));
+    CHECK(card.memory()[0x1010 / 4] == 0);
+    CHECK(card.core(0).cpu.pc.getCurrentPC() == 8);
+}
+
+/// every core adds r1 + 1 to each of 0x1000..0x1040 in turn, 200 times over,
+/// racing the others
+auto race() -> std::vector<uint32_t> {
+    isa::Emitter e;
+    e.loadImmediate(false, 7, 200);
+    e.loadImmediate(false, 2, 0x1000);
+    e.loadImmediate(false, 4, 16);
+    e.loadScalar(false, 3, 2, 0);
+    e.scalarArithmetic(ScalarArithmeticOp::Add, 3, 3, 1);
+    e.scalarArithmeticImmediate(ScalarArithmeticOp::Add, 3, 3, 1);
+    e.storeScalar(false, 2, 3, 0);
+    e.scalarArithmeticImmediate(ScalarArithmeticOp::Add, 2, 2, 4);
+    e.scalarArithmeticImmediate(ScalarArithmeticOp::Sub, 4, 4, 1);
+    e.compareImm(4, 0);
+    e.branchImm(condition_t::nz, -8);
+    e.scalarArithmeticImmediate(ScalarArithmeticOp::Sub, 7, 7, 1);
+    e.compareImm(7, 0);
+    e.branchImm(condition_t::nz, -13);
+    e.halt();
+    return e.getData();
+}
+
+auto runRace(size_t hostThreads, uint64_t quantum) -> std::vector<uint32_t> {
+    Card card(4096, 4, Card::Ordering::Deterministic);
+    load(card, race());
+    for (size_t i = 0; i < card.nCores(); i++)
+        card.core(i).cpu.r[1] = i;
+    REQUIRE(card.run(quantum, hostThreads, [] { return true; }));
+    return {card.memory().begin() + 0x1000 / 4,
+            card.memory().begin() + 0x1040 / 4};
+}
+
+TEST_CASE("deterministic ordering doesn't depend on the host threads") {
+    auto one = runRace(1, 37);
+    for (size_t threads : {2, 3, 4})
+        CHECK(runRace(threads, 37) == one);
+    // with racing cores, the counters lost some of the increments...
+    CHECK(one[0] < 200 * (1 + 2 + 3 + 4));
+    CHECK(one[0] > 0);
+
+    // ...but not with a quantum long enough for each core to finish alone:
+    // they all start from 0, and core 3 is written back last
+    auto whole = runRace(2, 1000000);
+    for (auto counter : whole)
+        CHECK(counter == 200 * 4);
+}
+
+TEST_CASE("a deterministic core sees another's store next quantum") {
+    isa::Emitter e;
+    e.compareImm(1, 0);
+    e.branchImm(condition_t::nz, 4);
+    e.loadImmediate(false, 5, 0x2000);
+    e.loadImmediate(false, 6, 7);
+    e.storeScalar(false, 5, 6, 0);
+    e.halt();
+    // core 1
+    e.loadImmediate(false, 5, 0x2000);
+    e.loadScalar(false, 6, 5, 0);
+    e.compareImm(6, 0);
+    e.branchImm(condition_t::ez, -3);
+    e.halt();
+
+    Card card(4096, 2, Card::Ordering::Deterministic);
+    load(card, e.getData());
+    card.core(1).cpu.r[1] = 1;
+    CHECK(card.run(20, 1, [] { return true; }));
+    CHECK(card.core(1).cpu.r[6].inner == 7);
+    // the whole first quantum spinning, and the load that saw it
+    CHECK(card.core(1).retired == 20 + 5);
+}
+
+/// takes the lock at 0x2000 with cmpx to add 1 to the plain word at 0x2008,
+/// 200 times
+auto locked() -> std::vector<uint32_t> {
+    isa::Emitter e;
+    e.loadImmediate(false, 10, 0x2000);
+    e.loadImmediate(false, 11, 0x2008);
+    e.loadImmediate(false, 12, 200);
+    e.loadImmediate(false, 13, 1);
+    e.loadImmediate(false, 14, 0);
+    e.cmpx(14, 10, 13);
+    e.branchImm(condition_t::nz, -3);
+    e.loadScalar(true, 15, 11, 0);
+    e.scalarArithmeticImmediate(ScalarArithmeticOp::Add, 15, 15, 1);
+    e.storeScalar(true, 11, 15, 0);
+    e.loadImmediate(false, 14, 0);
+    e.storeScalar(true, 10, 14, 0);
+    e.scalarArithmeticImmediate(ScalarArithmeticOp::Sub, 12, 12, 1);
+    e.compareImm(12, 0);
+    e.branchImm(condition_t::nz, -11);
+    e.halt();
+    return e.getData();
+}
+
+/// fetch-and-adds 1 to 0x2000, 1000 times
+auto counted() -> std::vector<uint32_t> {
+    isa::Emitter e;
+    e.loadImmediate(false, 10, 0x2000);
+    e.loadImmediate(false, 12, 1000);
+    e.fa(14, 10, 1);
+    e.scalarArithmeticImmediate(ScalarArithmeticOp::Sub, 12, 12, 1);
+    e.compareImm(12, 0);
+    e.branchImm(condition_t::nz, -4);
+    e.halt();
+    return e.getData();
+}
+
+TEST_CASE("atomics are atomic across cores") {
+    for (auto ordering :
+         {Card::Ordering::Host, Card::Ordering::Deterministic}) {
+        Card adding(4096, 4, ordering);
+        load(adding, counted());
+        CHECK(adding.run(50, 0, [] { return true; }));
+        CHECK(adding.memory()[0x2000 / 4] == 4000);
+
+        Card locking(4096, 4, ordering);
+        load(locking, locked());
+        CHECK(locking.run(50, 0, [] { return true; }));
+        CHECK(locking.memory()[0x2008 / 4] == 800);
+        CHECK(locking.memory()[0x2000 / 4] == 0);
+    }
+}
+
+TEST_CASE("deterministic atomics") {
+    auto run = [](size_t hostThreads) {
+        Card card(4096, 4, Card::Ordering::Deterministic);
+        load(card, locked());
+        REQUIRE(card.run(50, hostThreads, [] { return true; }));
+        std::vector<uint64_t> counts;
+        for (size_t i = 0; i < card.nCores(); i++) {
+            counts.push_back(card.core(i).retired);
+            counts.push_back(card.core(i).mem.atomics[0x2000].contended);
+        }
+        return counts;
+    };
+    auto one = run(1);
+    CHECK(run(3) == one);
+    // someone had to wait for the lock
+    CHECK(one[1] + one[3] + one[5] + one[7] > 0);
+}
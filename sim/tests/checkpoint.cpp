@@ -0,0 +1,81 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest.h"
+
+#include <filesystem>
+#include <fstream>
+
+#include <morph/encoder.h>
+
+#include "checkpoint.h"
+#include "machine.h"
+
+using isa::LanewiseVectorOp;
+using isa::ScalarArithmeticOp;
+
+/// stores r1 = 8..1 to 0x2000 + 4*r1 a page apart, with a vector op on the
+/// way round so there's more than scalar state to save
+auto program() -> std::vector<uint32_t> {
+    isa::Emitter e;
+    e.loadImmediate(false, 1, 8);
+    e.loadImmediate(false, 2, 0x2000);
+    e.vectorLanewiseArith(LanewiseVectorOp::Add, 1, 1, 2, 0b1111); // 0x8
+    e.storeScalar(false, 2, 1, 0);
+    e.scalarArithmeticImmediate(ScalarArithmeticOp::Add, 2, 2, 4096);
+    e.scalarArithmeticImmediate(ScalarArithmeticOp::Sub, 1, 1, 1);
+    e.compareImm(1, 0);
+    e.branchImm(condition_t::nz, -6);
+    e.halt();
+    return e.getData();
+}
+
+TEST_CASE("a restored run finishes the same as one straight through") {
+    auto path = std::filesystem::temp_directory_path() / "morph_test.ckpt";
+    auto code = program();
+
+    Machine straight(code, 16384);
+    straight.cpu.v[2] = f32x4(1, 2, 3, 4);
+    straight.run();
+
+    // stop on a taken branch, so there's a jump in flight
+    Machine before(code, 16384);
+    before.cpu.v[2] = f32x4(1, 2, 3, 4);
+    before.run(2 + 6 * 3);
+    REQUIRE(before.cpu.pc.wasTaken());
+    saveCheckpoint(path, before.cpu, before.mem);
+
+    Machine after(code, 16384);
+    restoreCheckpoint(path, after.cpu, after.mem);
+    CHECK(after.mem.mempool == before.mem.mempool);
+    after.run();
+
+    CHECK(after.cpu.isHalted());
+    CHECK(after.cpu.pc.getCurrentPC() == straight.cpu.pc.getCurrentPC());
+    for (size_t i = 0; i < ScalarRegisterFile::N_REGS; i++)
+        REQUIRE(after.cpu.r[i].inner == straight.cpu.r[i].inner);
+    CHECK(after.cpu.v[1][3] == 4 * 8);
+    CHECK(after.cpu.v[1][0] == straight.cpu.v[1][0]);
+    CHECK(after.mem.mempool == straight.mem.mempool);
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("bad checkpoints") {
+    auto path = std::filesystem::temp_directory_path() / "morph_test.ckpt";
+    Machine m(program(), 4096);
+
+    CHECK_THROWS_AS(restoreCheckpoint(path, m.cpu, m.mem), std::runtime_error);
+
+    saveCheckpoint(path, m.cpu, m.mem);
+    Machine bigger(program(), 8192);
+    CHECK_THROWS_AS(restoreCheckpoint(path, bigger.cpu, bigger.mem),
+                    std::runtime_error);
+
+    std::filesystem::resize_file(path, 100);
+    CHECK_THROWS_AS(restoreCheckpoint(path, m.cpu, m.mem), std::runtime_error);
+
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out << "not a checkpoint at all";
+    }
+    CHECK_THROWS_AS(restoreCheckpoint(path, m.cpu, m.mem), std::runtime_error);
+    std::filesystem::remove(path);
+}
@@ -0,0 +1,88 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest.h"
+
+#include <morph/encoder.h>
+
+#include "counters.h"
+#include "machine.h"
+
+using isa::CsrOp;
+using isa::LanewiseVectorOp;
+using isa::ScalarArithmeticOp;
+
+/// runs `e` to completion counting into `counters`, and returns the registers
+auto counted(isa::Emitter& e, PerfCounters& counters) -> ScalarRegisterFile {
+    Machine m(e.getData());
+    m.iproxy.countInto(&counters);
+    m.run(SIZE_MAX, [&](uint64_t, const DecodedInstruction<NullTracer>& inst) {
+        counters.retire(inst.ir);
+    });
+    return m.cpu.r;
+}
+
+/// selects `counter` and zeroes it, using r20
+void start(isa::Emitter& e, Counter counter) {
+    e.loadImmediate(false, 20, static_cast<uint32_t>(counter));
+    e.csr(CsrOp::Wcsr, 20, PerfCounters::CSR_SELECT);
+    e.loadImmediate(false, 20, 0);
+    e.csr(CsrOp::Wcsr, 20, PerfCounters::CSR_VALUE);
+}
+
+TEST_CASE("a program reads what its region cost") {
+    isa::Emitter e;
+    e.loadImmediate(false, 1, 0x100);
+    start(e, Counter::Loads);
+    e.loadScalar(false, 2, 1, 0);
+    e.loadScalar(false, 3, 1, 4);
+    e.loadVectorImmStride(1, 1, 1, 0b1111);
+    e.storeScalar(false, 1, 2, 8);
+    e.csr(CsrOp::Rcsr, 4, PerfCounters::CSR_VALUE);
+    e.csr(CsrOp::Rcsr, 5, PerfCounters::CSR_SELECT);
+    e.halt();
+
+    PerfCounters counters;
+    auto r = counted(e, counters);
+    CHECK(r[4].inner == 3);
+    CHECK(r[5].inner == static_cast<uint64_t>(Counter::Loads));
+
+    // zeroing one counter leaves the rest alone
+    CHECK(counters.read(Counter::Instructions) == e.getData().size());
+    CHECK(counters.read(Counter::Stores) == 1);
+    CHECK(counters.read(Counter::Loads) == 3);
+}
+
+TEST_CASE("vector ops and systolic steps") {
+    isa::Emitter e;
+    e.vectorLanewiseArith(LanewiseVectorOp::Add, 1, 2, 3, 0b1111);
+    e.vectorLanewiseArith(LanewiseVectorOp::Add, 4, 1, 3, 0b1111);
+    e.systolicStep();
+    e.scalarArithmetic(ScalarArithmeticOp::Add, 1, 1, 1);
+    e.halt();
+
+    PerfCounters counters;
+    counted(e, counters);
+    CHECK(counters.read(Counter::VectorOps) == 2);
+    CHECK(counters.read(Counter::SystolicSteps) == 1);
+    CHECK(counters.read(Counter::Instructions) == 5);
+}
+
+TEST_CASE("counters that aren't there panic") {
+    PerfCounters counters;
+    CHECK_THROWS_AS((void)counters.read(Counter::Cycles), Panic);
+    CHECK_THROWS_AS((void)counters.read(Counter::DCacheMisses), Panic);
+
+    Cache dcache(CacheConfig{});
+    counters.watch(nullptr, nullptr, &dcache);
+    CHECK(counters.read(Counter::DCacheMisses) == 0);
+
+    counters.writeCsr(PerfCounters::CSR_SELECT, N_COUNTERS);
+    CHECK_THROWS_AS((void)counters.readCsr(PerfCounters::CSR_VALUE), Panic);
+    CHECK_THROWS_AS((void)counters.readCsr(2), Panic);
+
+    // and without any counters, so do the CSRs
+    isa::Emitter e;
+    e.csr(CsrOp::Rcsr, 1, PerfCounters::CSR_VALUE);
+    e.halt();
+    Machine m(e.getData());
+    CHECK_THROWS_AS(m.run(1), Panic);
+}
@@ -0,0 +1,76 @@
+// instructions/second through the simulator's fetch-decode-execute loop,
+// decoding through the virtual InstructionVisitor entry point, through the
+// templated one, and (for reference) from the predecode cache.
+#include <chrono>
+#include <cstdlib>
+
+#include <fmt/core.h>
+#include <morph/encoder.h>
+
+#include "machine.h"
+
+using isa::ScalarArithmeticOp;
+
+/// `makeStep(sim)` returns the loop body to time
+template <typename F>
+void measure(const char* name, const std::vector<uint32_t>& code,
+             F&& makeStep) {
+    Machine sim(code);
+    auto step = makeStep(sim);
+    uint64_t n = 0;
+    auto start = std::chrono::steady_clock::now();
+    while (!sim.cpu.isHalted()) {
+        step();
+        n++;
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    fmt::print("{:>10}: {} instructions in {:.3f}s, {:.1f}M IPS\n", name, n,
+               elapsed.count(), n / elapsed.count() / 1e6);
+}
+
+int main(int argc, char* argv[]) {
+    uint64_t iters = argc > 1 ? std::strtoull(argv[1], nullptr, 0) : 1 << 18;
+
+    // an ALU-heavy loop, the common case for the interpreter
+    isa::Emitter e;
+    e.loadImmediate(false, 30, iters & 0x3ffff);
+    e.loadImmediate(true, 30, iters >> 18);
+    for (int i = 0; i < 6; i++) {
+        e.scalarArithmeticImmediate(ScalarArithmeticOp::Add, 1 + i, 1 + i,
+                                    i + 1);
+        e.scalarArithmetic(ScalarArithmeticOp::Xor, 10, 10, 1 + i);
+    }
+    e.scalarArithmeticImmediate(ScalarArithmeticOp::Sub, 30, 30, 1);
+    e.compareImm(30, 0);
+    e.branchImm(condition_t::nz, -15);
+    e.halt();
+    const auto& code = e.getData();
+
+    measure("virtual", code, [](Machine<>& sim) {
+        return [&sim] {
+            auto pc = sim.cpu.pc.getNewPC();
+            auto ir = sim.mem.readInstruction(pc);
+            isa::decodeInstruction(
+                static_cast<isa::InstructionVisitor&>(sim.iproxy),
+                bits<32>(ir));
+        };
+    });
+    measure("template", code, [](Machine<>& sim) {
+        return [&sim] {
+            auto pc = sim.cpu.pc.getNewPC();
+            auto ir = sim.mem.readInstruction(pc);
+            isa::decodeInstruction(sim.iproxy, bits<32>(ir));
+        };
+    });
+    measure("predecoded", code, [](Machine<>& sim) {
+        return [&sim,
+                cache = std::make_shared<PredecodeCache<NullTracer>>(sim.mem)] {
+            auto pc = sim.cpu.pc.getNewPC();
+            auto inst = cache->fetch(pc);
+            inst.execute(sim.iproxy);
+        };
+    });
+
+    return 0;
+}
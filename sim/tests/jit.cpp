@@ -0,0 +1,219 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest.h"
+
+#include <cstring>
+#include <random>
+
+#include <morph/encoder.h>
+
+#include "machine.h"
+
+using isa::LanewiseVectorOp;
+using isa::ScalarArithmeticOp;
+
+void checkSameState(Machine<>& a, Machine<>& b) {
+    for (size_t i = 0; i < ScalarRegisterFile::N_REGS; i++) {
+        INFO("r", i);
+        CHECK(a.cpu.r[i].inner == b.cpu.r[i].inner);
+    }
+    for (size_t i = 0; i < VectorRegisterFile::N_REGS; i++) {
+        INFO("v", i);
+        CHECK(std::memcmp(&a.cpu.v[i], &b.cpu.v[i], sizeof(f32x4)) == 0);
+    }
+    CHECK(a.cpu.f.zero == b.cpu.f.zero);
+    CHECK(a.cpu.f.sign == b.cpu.f.sign);
+    CHECK(a.cpu.f.overflow == b.cpu.f.overflow);
+    CHECK(a.cpu.pc.getCurrentPC() == b.cpu.pc.getCurrentPC());
+    CHECK(a.cpu.halted == b.cpu.halted);
+    CHECK(a.mem.mempool == b.mem.mempool);
+}
+
+void seed(Machine<>& h, uint64_t s) {
+    std::mt19937_64 rng(s);
+    for (size_t i = 0; i < ScalarRegisterFile::N_REGS; i++)
+        h.cpu.r[i] = rng() & bits<36>::mask;
+    std::uniform_real_distribution<float> dist(-100.f, 100.f);
+    for (size_t i = 0; i < VectorRegisterFile::N_REGS; i++)
+        h.cpu.v[i] = f32x4(dist(rng), dist(rng), dist(rng), dist(rng));
+}
+
+TEST_CASE("jitted blocks match the threaded engine") {
+    std::mt19937 rng(554);
+    auto reg = [&] { return reg_idx(1 + rng() % 20); };
+    auto sop = [&] { return ScalarArithmeticOp(rng() % 8); };
+
+    for (int trial = 0; trial < 20; trial++) {
+        isa::Emitter e;
+        e.loadImmediate(false, 30, 100);
+        e.loadImmediate(true, 30, 0);
+        size_t body = 24;
+        for (size_t i = 0; i < body; i++) {
+            switch (rng() % 9) {
+            case 0:
+            case 1: {
+                auto op = sop();
+                // mul has no immediate form
+                if (op == ScalarArithmeticOp::Mul)
+                    op = ScalarArithmeticOp::Add;
+                int64_t imm = (op == ScalarArithmeticOp::Shl ||
+                               op == ScalarArithmeticOp::Shr)
+                                  ? rng() % 40
+                                  : int64_t(rng() % 0x7fff) - 0x3fff;
+                e.scalarArithmeticImmediate(op, reg(), reg(), imm);
+                break;
+            }
+            case 2:
+            case 3:
+                e.scalarArithmetic(sop(), reg(), reg(), reg());
+                break;
+            case 4:
+                e.scalarArithmeticNot(reg(), reg());
+                break;
+            case 5:
+                e.loadImmediate(rng() % 2, reg(), rng() % (1 << 18));
+                break;
+            case 6:
+                if (rng() % 2)
+                    e.compareReg(reg(), reg());
+                else
+                    e.compareImm(reg(), int64_t(rng() % 0xfffff) - 0x7ffff);
+                break;
+            case 7:
+                e.compareAndMutate(rng() % 2
+                                       ? isa::CmpMutateDirection::Increment
+                                       : isa::CmpMutateDirection::Decrement,
+                                   reg(), reg(), reg());
+                break;
+            case 8:
+                e.vectorLanewiseArith(LanewiseVectorOp(rng() % 4), reg(), reg(),
+                                      reg(), rng() % 3 ? 0xf : rng() % 16);
+                break;
+            }
+        }
+        // loop back `body` instructions while --r30 != 0
+        e.scalarArithmeticImmediate(ScalarArithmeticOp::Sub, 30, 30, 1);
+        e.compareImm(30, 0);
+        e.branchImm(condition_t::nz, -int64_t(body + 3));
+        e.halt();
+
+        INFO("trial ", trial);
+        Machine threaded(e.getData()), jit(e.getData());
+        seed(threaded, trial);
+        seed(jit, trial);
+        threaded.runThreaded(false);
+        jit.runThreaded(true);
+        checkSameState(threaded, jit);
+    }
+}
+
+TEST_CASE("jitted block that stores over itself") {
+    isa::Emitter patch;
+    patch.scalarArithmeticImmediate(ScalarArithmeticOp::Add, 2, 2, 100);
+
+    isa::Emitter e;
+    e.loadImmediate(false, 30, 100);   // 0x00
+    e.loadImmediate(false, 10, 0xf0);  // 0x04
+    e.loadImmediate(false, 11, 0x100); // 0x08
+    // loop:
+    e.scalarArithmeticImmediate(ScalarArithmeticOp::Add, 6, 6, 1); // 0x0c
+    // r7 = r6 < 64 ? 0x100 : 0x10
+    e.scalarArithmeticImmediate(ScalarArithmeticOp::Shr, 8, 6, 6); // 0x10
+    e.scalarArithmetic(ScalarArithmeticOp::Mul, 9, 8, 10);         // 0x14
+    e.scalarArithmetic(ScalarArithmeticOp::Sub, 7, 11, 9);         // 0x18
+    // harmless, until it starts hitting 0x20
+    e.storeScalar(false, 7, 3, 0x10);                              // 0x1c
+    e.scalarArithmeticImmediate(ScalarArithmeticOp::Add, 2, 2, 3); // 0x20
+    e.scalarArithmeticImmediate(ScalarArithmeticOp::Sub, 30, 30, 1);
+    e.compareImm(30, 0);
+    e.branchImm(condition_t::nz, -9);
+    e.halt();
+
+    Machine threaded(e.getData()), jit(e.getData());
+    threaded.cpu.r[3] = patch.getData()[0];
+    jit.cpu.r[3] = patch.getData()[0];
+    threaded.runThreaded(false);
+    jit.runThreaded(true);
+
+    checkSameState(threaded, jit);
+    CHECK(jit.cpu.r[2].inner == 63 * 3 + 37 * 100);
+}
+
+TEST_CASE("errors in called-out instructions come out of jitted blocks") {
+    isa::Emitter e;
+    e.loadImmediate(false, 30, 100);
+    // loop: ld32 from r6 >> 6, which is misaligned from iteration 64 on
+    e.scalarArithmeticImmediate(ScalarArithmeticOp::Add, 6, 6, 1);
+    e.scalarArithmeticImmediate(ScalarArithmeticOp::Shr, 7, 6, 6);
+    e.loadScalar(false, 8, 7, 0);
+    e.scalarArithmeticImmediate(ScalarArithmeticOp::Sub, 30, 30, 1);
+    e.compareImm(30, 0);
+    e.branchImm(condition_t::nz, -6);
+    e.halt();
+
+    Machine threaded(e.getData()), jit(e.getData());
+    CHECK_THROWS(threaded.runThreaded(false));
+    CHECK_THROWS(jit.runThreaded(true));
+    checkSameState(threaded, jit);
+    CHECK(jit.cpu.r[6].inner == 64);
+}
+
+TEST_CASE("jitted loads and stores match the threaded engine") {
+    // memory is 4KiB. streams from 0x400 and 0x800 into 0xc00 and 0xa00,
+    // with a scalar load and store of each width alongside
+    auto program = [](uint32_t iterations, uint32_t stride) {
+        isa::Emitter e;
+        // seed() leaves junk in the high bits
+        auto li = [&](reg_idx rD, uint32_t v) {
+            e.loadImmediate(false, rD, v);
+            e.loadImmediate(true, rD, 0);
+        };
+        li(30, iterations);
+        li(1, 0x400);
+        li(2, 0x800);
+        li(3, 0xc00);
+        li(4, stride);
+        li(5, 0xa00);
+        // loop:
+        e.loadVectorRegStride(1, 1, 4, 0xf);
+        e.loadVectorImmStride(2, 2, 1, 0xf);
+        e.vectorLanewiseArith(LanewiseVectorOp::Add, 3, 1, 2, 0xf);
+        e.storeVectorRegStride(3, 4, 3, 0xf);
+        e.storeVectorImmStride(5, 1, 1, 0b0101);
+        e.loadScalar(false, 6, 3, -16);
+        e.loadScalar(true, 7, 3, -8);
+        e.storeScalar(false, 1, 7, 4);
+        e.storeScalar(true, 2, 6, 8);
+        e.scalarArithmeticImmediate(ScalarArithmeticOp::Sub, 30, 30, 1);
+        e.compareImm(30, 0);
+        e.branchImm(condition_t::nz, -12);
+        e.halt();
+        return e.getData();
+    };
+
+    auto compare = [](const std::vector<uint32_t>& code, bool throws) {
+        Machine threaded(code), jit(code);
+        seed(threaded, 9);
+        seed(jit, 9);
+        for (size_t i = 0x100; i < 1024; i++)
+            threaded.mem.mempool[i] = jit.mem.mempool[i] = i * 0x9e3779b9;
+        if (throws) {
+            CHECK_THROWS(threaded.runThreaded(false));
+            CHECK_THROWS(jit.runThreaded(true));
+        } else {
+            threaded.runThreaded(false);
+            jit.runThreaded(true);
+        }
+        checkSameState(threaded, jit);
+    };
+
+    SUBCASE("in bounds") {
+        // right up to the last vector in memory
+        compare(program(64, 16), false);
+    }
+    SUBCASE("walking off the end") {
+        compare(program(100, 16), true);
+    }
+    SUBCASE("misaligned") {
+        compare(program(60, 8), true);
+    }
+}
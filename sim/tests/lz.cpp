@@ -0,0 +1,83 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest.h"
+
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include "lz.h"
+
+auto roundTrip(const std::vector<uint8_t>& data) -> size_t {
+    std::vector<uint8_t> packed(lz::bound(data.size()));
+    auto size = lz::compress(data.data(), data.size(), packed.data());
+    REQUIRE(size <= packed.size());
+
+    std::vector<uint8_t> back(data.size());
+    lz::decompress(packed.data(), size, back.data(), back.size());
+    CHECK(back == data);
+    return size;
+}
+
+TEST_CASE("round trips") {
+    std::mt19937 rng(7);
+
+    SUBCASE("empty and tiny") {
+        for (size_t n = 0; n < 32; n++)
+            roundTrip(std::vector<uint8_t>(n, 0x5a));
+    }
+
+    SUBCASE("runs compress") {
+        std::vector<uint8_t> zeros(1 << 16);
+        CHECK(roundTrip(zeros) < 300);
+    }
+
+    SUBCASE("random data doesn't grow much") {
+        std::vector<uint8_t> noise(100000);
+        for (auto& b : noise)
+            b = rng();
+        CHECK(roundTrip(noise) <= lz::bound(noise.size()));
+    }
+
+    SUBCASE("repeats with changes, past the window") {
+        std::vector<uint8_t> data;
+        std::vector<uint8_t> pattern(300);
+        for (auto& b : pattern)
+            b = rng() % 4;
+        for (int i = 0; i < 1000; i++) {
+            pattern[rng() % pattern.size()] = rng();
+            data.insert(data.end(), pattern.begin(), pattern.end());
+        }
+        CHECK(roundTrip(data) < data.size() / 4);
+    }
+}
+
+TEST_CASE("corrupt blocks throw") {
+    std::vector<uint8_t> data(4096);
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = i % 13;
+    std::vector<uint8_t> packed(lz::bound(data.size()));
+    packed.resize(lz::compress(data.data(), data.size(), packed.data()));
+    std::vector<uint8_t> out(data.size());
+
+    // cut short
+    for (size_t n : {size_t(0), size_t(1), packed.size() / 2,
+                     packed.size() - 1})
+        CHECK_THROWS_AS(
+            lz::decompress(packed.data(), n, out.data(), out.size()),
+            std::runtime_error);
+    // wrong size
+    CHECK_THROWS_AS(lz::decompress(packed.data(), packed.size(), out.data(),
+                                   out.size() - 1),
+                    std::runtime_error);
+
+    // garbage never reads or writes out of bounds, whatever else it does
+    std::mt19937 rng(3);
+    for (int i = 0; i < 1000; i++) {
+        auto bad = packed;
+        bad[rng() % bad.size()] = rng();
+        try {
+            lz::decompress(bad.data(), bad.size(), out.data(), out.size());
+        } catch (const std::runtime_error&) {
+        }
+    }
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include "cpu.h"
+#include "debugger.h"
+#include "iproxy.h"
+#include "predecode.h"
+#include "threaded.h"
+#include "trace.h"
+
+/**
+ * A CPU and memory with some code loaded, put together the way sim's main
+ * loop does it, for tests to run programs on. Like sim, memory only reports
+ * its traffic to a tracer that records something, so with a NullTracer the
+ * jit can do loads and stores inline.
+ */
+template <typename T = NullTracer> struct Machine {
+    /// `code` at 0 in `words` of memory, with `tracer` watching it run
+    explicit Machine(const std::vector<uint32_t>& code, size_t words = 1024,
+                     std::shared_ptr<T> tracer = std::make_shared<T>())
+        : tracer{tracer},
+          mem(words, std::is_same_v<T, NullTracer> ? nullptr : tracer),
+          debugger(cpu, mem, quitting), iproxy(cpu, mem, debugger, tracer) {
+        load(code, 0);
+    }
+
+    /// puts `code` at byte address `at`
+    void load(const std::vector<uint32_t>& code, uint64_t at) {
+        std::copy(code.begin(), code.end(), mem.mempool.begin() + at / 4);
+    }
+
+    /**
+     * Runs up to `n` instructions through the predecode cache, stopping at a
+     * halt, and calls `after(pc, inst)` once each one has run. The cache
+     * carries over from one run() to the next.
+     */
+    template <typename After> void run(size_t n, After&& after) {
+        if (!predecoded)
+            predecoded = std::make_unique<PredecodeCache<T>>(mem);
+        for (size_t i = 0; i < n && !cpu.isHalted(); i++) {
+            auto pc = cpu.pc.getNewPC();
+            // copy: the instruction may invalidate its own cache slot
+            auto inst = predecoded->fetch(pc);
+            tracer->begin(pc, inst.ir);
+            inst.execute(iproxy);
+            tracer->end();
+            after(pc, inst);
+        }
+    }
+    void run(size_t n = SIZE_MAX) {
+        run(n, [](uint64_t, const DecodedInstruction<T>&) {});
+    }
+
+    /// runs to a halt on a ThreadedEngine (with the JIT, if `jit`)
+    /// @return how many blocks it translated
+    auto runThreaded(bool jit = false) -> size_t {
+        ThreadedEngine<T> engine(cpu, mem);
+        if (jit)
+            engine.enableJit(iproxy);
+        engine.run([&](uint64_t pc, const DecodedInstruction<T>& inst) {
+            inst.execute(iproxy);
+            return true;
+        });
+        return engine.nBlocks();
+    }
+
+    std::shared_ptr<T> tracer;
+    CPUState cpu;
+    MemSystem mem;
+    bool quitting = false;
+    Debugger debugger;
+    CPUInstructionProxy<T> iproxy;
+    // made on the first run(), so it doesn't get in an engine's way
+    std::unique_ptr<PredecodeCache<T>> predecoded;
+};
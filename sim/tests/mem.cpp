@@ -0,0 +1,310 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <morph/util.h>
+
+#include "mem.h"
+
+auto writeImage(const std::filesystem::path& path, size_t words,
+                uint32_t seed) -> std::vector<uint32_t> {
+    std::vector<uint32_t> image(words);
+    for (size_t i = 0; i < words; i++)
+        image[i] = seed + i;
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(image.data()), words * 4);
+    return image;
+}
+
+TEST_CASE("untouched memory reads as zero") {
+    // far more than we'd want to zero-fill up front
+    MemPool pool(size_t(1) << 30);
+    CHECK(pool.size() == size_t(1) << 30);
+    CHECK(pool[0] == 0);
+    CHECK(pool[pool.size() - 1] == 0);
+    pool[12345] = 7;
+    CHECK(pool[12345] == 7);
+}
+
+/// peak resident set, in KiB
+auto maxRss() -> long {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+TEST_CASE("the whole address space costs only what's touched") {
+    auto before = maxRss();
+    MemPool pool(MemSystem::MAX_SIZE / 4);
+    CHECK(pool.size() == MemSystem::MAX_SIZE / 4);
+    // a few hundred pages scattered across all 64GiB
+    for (size_t i = 0; i < pool.size(); i += pool.size() / 256)
+        pool[i] = static_cast<uint32_t>(i);
+    pool[pool.size() - 1] = 1;
+    for (size_t i = 0; i < pool.size(); i += pool.size() / 256)
+        REQUIRE(pool[i] == static_cast<uint32_t>(i));
+    CHECK(pool[pool.size() / 3 + 5] == 0);
+    CHECK(pool[pool.size() - 1] == 1);
+    CHECK(maxRss() - before < 64 * 1024);
+}
+
+TEST_CASE("loading images") {
+    size_t page = sysconf(_SC_PAGESIZE);
+    auto path = std::filesystem::temp_directory_path() / "morph_mem_test.bin";
+    // a few pages and a bit
+    size_t words = (3 * page + 100) / 4;
+    auto image = writeImage(path, words, 0x1000);
+
+    SUBCASE("mapped, copy-on-write") {
+        MemPool pool(words * 4);
+        CHECK(pool.load(path.string(), page) == words * 4);
+        CHECK(pool[page / 4 - 1] == 0);
+        for (size_t i = 0; i < words; i++)
+            REQUIRE(pool[page / 4 + i] == image[i]);
+        CHECK(pool[page / 4 + words] == 0);
+
+        // stores stay in memory
+        pool[page / 4] = 0xdead;
+        CHECK(pool[page / 4] == 0xdead);
+        std::ifstream in(path, std::ios::binary);
+        uint32_t first;
+        in.read(reinterpret_cast<char*>(&first), 4);
+        CHECK(first == image[0]);
+    }
+
+    SUBCASE("unaligned") {
+        MemPool pool(words * 4);
+        CHECK(pool.load(path.string(), 16) == words * 4);
+        CHECK(pool[3] == 0);
+        for (size_t i = 0; i < words; i++)
+            REQUIRE(pool[4 + i] == image[i]);
+    }
+
+    SUBCASE("clipped to the end of memory") {
+        MemPool pool(page / 4 + 8);
+        CHECK(pool.load(path.string(), page) == 32);
+        CHECK(pool[page / 4 + 7] == image[7]);
+        CHECK(pool.load(path.string(), 2 * page) == 0);
+    }
+
+    SUBCASE("doesn't clobber neighbours in a partial page") {
+        MemPool pool(words * 8);
+        auto other = std::filesystem::temp_directory_path() /
+                     "morph_mem_test2.bin";
+        // ends inside the page the first image's tail is in
+        writeImage(other, 4, 0xabc0);
+        CHECK(pool.load(other.string(), 4 * page + 200) == 16);
+        CHECK(pool.load(path.string(), page) == words * 4);
+        CHECK(pool[(4 * page + 200) / 4] == 0xabc0);
+        CHECK(pool[page / 4 + words - 1] == image.back());
+        std::filesystem::remove(other);
+    }
+
+    SUBCASE("missing file") {
+        MemPool pool(16);
+        CHECK_THROWS_AS(pool.load("/nonexistent/morph", 0),
+                        std::runtime_error);
+    }
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("MemSystem reads what was loaded") {
+    auto path = std::filesystem::temp_directory_path() / "morph_mem_test.bin";
+    auto image = writeImage(path, 1024, 0x20);
+
+    MemSystem mem(4096);
+    mem.mempool.load(path.string(), 0);
+    CHECK(mem.read32(0) == 0x20);
+    CHECK(mem.readInstruction(4 * 1000) == 0x20 + 1000);
+    mem.write(8, u<32>(5));
+    CHECK(mem.read32(8) == 5);
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("MemSystem bounds are in bytes") {
+    MemSystem mem(1024);
+    // all the way to the last byte...
+    mem.write(4096 - 16, f32x4(1.f, 2.f, 3.f, 4.f));
+    CHECK(mem.readVec(4096 - 16).w() == 4.f);
+    mem.write(4096 - 8, u<36>(0xfffffffffULL));
+    CHECK(mem.read36(4096 - 8) == 0xfffffffffULL);
+    CHECK(mem.read32(4096 - 4) == 0xf);
+    // ...but not past it
+    CHECK_THROWS_AS(mem.read32(4096), Panic);
+    CHECK_THROWS_AS(mem.readVec(4096), Panic);
+    CHECK_THROWS_AS(mem.write(4096, u<32>(1)), Panic);
+    CHECK_THROWS_AS(mem.read32(2), Panic);
+}
+
+TEST_CASE("written pages") {
+    size_t page = sysconf(_SC_PAGESIZE);
+    auto path = std::filesystem::temp_directory_path() / "morph_mem_test.bin";
+    writeImage(path, 2 * page / 4, 1);
+
+    MemPool pool(64 * page / 4);
+    pool.load(path.string(), 0);
+    // only read: still the file's, and the zero page
+    CHECK(pool[0] == 1);
+    CHECK(pool[10 * page / 4] == 0);
+    pool[page / 4] = 5;
+    pool[20 * page / 4 + 3] = 9;
+
+    auto pages = pool.writtenPages();
+    auto has = [&](uint64_t p) {
+        return std::find(pages.begin(), pages.end(), p) != pages.end();
+    };
+    CHECK(has(1));
+    CHECK(has(20));
+    CHECK(!has(10));
+    CHECK(pages.size() <= 3);
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("written pages without pagemap") {
+    size_t page = sysconf(_SC_PAGESIZE);
+    auto path = std::filesystem::temp_directory_path() / "morph_mem_test.bin";
+    writeImage(path, 2 * page / 4, 1);
+
+    MemPool plain(64 * page / 4);
+    plain[20 * page / 4 + 3] = 9;
+    CHECK(plain.writtenPagesByContents() == std::vector<uint64_t>{20});
+
+    // a mapped page the program zeroed is all zero, but not what load()
+    // mapped, so it has to be saved too
+    MemPool pool(64 * page / 4);
+    pool.load(path.string(), 0);
+    std::fill(pool.begin(), pool.begin() + page / 4, 0);
+    auto pages = pool.writtenPagesByContents();
+    CHECK(std::find(pages.begin(), pages.end(), 0) != pages.end());
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("shared views") {
+    size_t page = sysconf(_SC_PAGESIZE);
+    auto path = std::filesystem::temp_directory_path() / "morph_mem_test.bin";
+    auto image = writeImage(path, 2 * page / 4, 1);
+
+    MemPool memory(64 * page / 4, MemPool::Backing::Shareable);
+    memory.load(path.string(), 0);
+    MemPool a(memory, MemPool::View::Shared), b(memory, MemPool::View::Shared);
+    CHECK(a[page / 4] == image[page / 4]);
+
+    a[3] = 99;
+    b[40 * page / 4] = 7;
+    CHECK(b[3] == 99);
+    CHECK(memory[3] == 99);
+    CHECK(a[40 * page / 4] == 7);
+
+    MemPool notShareable(page / 4);
+    CHECK_THROWS_AS(MemPool(notShareable, MemPool::View::Shared),
+                    std::logic_error);
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("private views") {
+    size_t page = sysconf(_SC_PAGESIZE);
+    MemPool memory(64 * page / 4, MemPool::Backing::Shareable);
+    memory[0] = 1;
+    memory[30 * page / 4] = 2;
+    MemPool view(memory, MemPool::View::Private);
+
+    view[0] = 10;
+    view[5 * page / 4] = 3;
+    CHECK(memory[0] == 1);
+    CHECK(memory[5 * page / 4] == 0);
+    // stores to memory show through, on pages the view hasn't written
+    memory[20 * page / 4] = 4;
+    CHECK(view[20 * page / 4] == 4);
+    CHECK(view[30 * page / 4] == 2);
+
+    auto pages = view.writtenPages();
+    auto has = [&](uint64_t p) {
+        return std::find(pages.begin(), pages.end(), p) != pages.end();
+    };
+    CHECK(has(0));
+    CHECK(has(5));
+    CHECK(!has(20));
+    CHECK(!has(30));
+
+    view.discard();
+    CHECK(view[0] == 1);
+    CHECK(view[5 * page / 4] == 0);
+    CHECK(view.writtenPages().size() <= 1);
+    CHECK_THROWS_AS(memory.discard(), std::logic_error);
+}
+
+TEST_CASE("a private view's MemSystem notes the pages it stores to") {
+    size_t page = sysconf(_SC_PAGESIZE);
+    MemPool memory(64 * page / 4, MemPool::Backing::Shareable);
+    MemSystem view(memory, MemPool::View::Private);
+
+    view.write(8 * page, u<32>(1));
+    view.write(3 * page + 16, u<36>(2));
+    view.write(8 * page + 4, u<32>(3));
+    view.write(4 * page, f32x4(1, 2, 3, 4));
+    // a compare-exchange that fails still takes its own copy of the page
+    view.compareExchange36(40 * page, 5, 6);
+    auto pages = view.takeWrittenPages();
+    CHECK(pages == std::vector<uint64_t>{3, 4, 8, 40});
+    CHECK(view.takeWrittenPages().empty());
+
+    memory[40 * page / 4] = 7;
+    view.mempool.discard(pages);
+    CHECK(view.read32(8 * page) == 0);
+    CHECK(view.read32(40 * page) == 7);
+    CHECK(view.mempool.writtenPages().size() <= 1);
+
+    // only views keep track
+    MemSystem mem(1024);
+    mem.write(0x100, u<32>(1));
+    CHECK(mem.takeWrittenPages().empty());
+}
+
+TEST_CASE("atomics") {
+    MemSystem mem(1024);
+    mem.write(0x100, u<36>(0xffffffffe));
+    CHECK(mem.fetchAdd36(0x100, 3) == 0xffffffffe);
+    CHECK(mem.read36(0x100) == 1); // wrapped at 36 bits
+    CHECK(mem.fetchAdd36(0x100, uint64_t(-1)) == 1);
+    CHECK(mem.read36(0x100) == 0);
+
+    CHECK(mem.compareExchange36(0x100, 0, 7) == 0);
+    CHECK(mem.read36(0x100) == 7);
+    CHECK(mem.compareExchange36(0x100, 0, 9) == 7);
+    CHECK(mem.read36(0x100) == 7);
+    CHECK(mem.atomics[0x100].ops == 4);
+    CHECK(mem.atomics[0x100].contended == 1);
+
+    CHECK_THROWS_AS(mem.fetchAdd36(0x104, 1), Panic);
+}
+
+TEST_CASE("atomics through shared views stay atomic") {
+    MemPool memory(1024, MemPool::Backing::Shareable);
+    std::vector<std::unique_ptr<MemSystem>> views;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        views.push_back(
+            std::make_unique<MemSystem>(memory, MemPool::View::Shared));
+        threads.emplace_back([&mem = *views.back()] {
+            for (int i = 0; i < 100000; i++)
+                mem.fetchAdd36(0x40, 1);
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+    CHECK(memory[0x40 / 4] == 400000);
+}
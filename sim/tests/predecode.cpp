@@ -0,0 +1,78 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest.h"
+
+#include <morph/encoder.h>
+
+#include "machine.h"
+
+TEST_CASE("predecoded instructions execute like decoded ones") {
+    isa::Emitter e;
+    e.scalarArithmeticImmediate(isa::ScalarArithmeticOp::Add, 1, 1, 5);
+    e.scalarArithmeticImmediate(isa::ScalarArithmeticOp::Sub, 2, 2, 3);
+    e.scalarArithmetic(isa::ScalarArithmeticOp::Mul, 3, 1, 2);
+    e.halt();
+
+    Machine h(e.getData(), 256);
+    h.run();
+
+    CHECK(h.cpu.r[1].raw() == 5);
+    CHECK(h.cpu.r[2].asSigned()._sgn_inner() == -3);
+    CHECK(h.cpu.r[3].asSigned()._sgn_inner() == -15);
+}
+
+TEST_CASE("predecode cache goes stale on stores and flushicache") {
+    isa::Emitter patch;
+    patch.scalarArithmeticImmediate(isa::ScalarArithmeticOp::Add, 4, 4, 7);
+
+    isa::Emitter e;
+    // 0x0: loop body we'll overwrite
+    e.scalarArithmeticImmediate(isa::ScalarArithmeticOp::Add, 4, 4, 1);
+    e.halt();
+
+    Machine h(e.getData(), 256);
+    h.run(1);
+    CHECK(h.cpu.r[4].raw() == 1);
+
+    SUBCASE("store into fetched code") {
+        h.cpu.r[5] = patch.getData()[0];
+        // st32 [r0+0], r5
+        h.mem.write(0x0, h.cpu.r[5].slice<31, 0>());
+    }
+
+    SUBCASE("flushicache after a raw patch") {
+        h.mem.mempool[0] = patch.getData()[0];
+        h.mem.flushICache();
+    }
+
+    h.cpu.pc.reset();
+    h.run(1);
+    CHECK(h.cpu.r[4].raw() == 8);
+}
+
+TEST_CASE("predecoding code at the top of a full-size memory") {
+    isa::Emitter e;
+    e.scalarArithmeticImmediate(isa::ScalarArithmeticOp::Add, 1, 1, 9);
+    e.halt();
+    auto code = e.getData();
+    uint64_t at = MemSystem::MAX_SIZE - PredecodeCache<NullTracer>::PAGE_BYTES;
+
+    Machine m({}, MemSystem::MAX_SIZE / 4);
+    m.load(code, at);
+    m.cpu.pc.setTakenPC(int64_t(at));
+    m.cpu.pc.setTaken(true);
+    m.run();
+    CHECK(m.cpu.r[1].raw() == 9);
+    CHECK(m.predecoded->nPages() == 1);
+
+    // a store there still goes stale
+    m.mem.write(at, u<32>(code[1]));
+    m.cpu.halted = false;
+    m.cpu.pc.setTakenPC(int64_t(at));
+    m.cpu.pc.setTaken(true);
+    m.run(1);
+    CHECK(m.cpu.isHalted());
+    CHECK(m.cpu.r[1].raw() == 9);
+
+    m.predecoded->codeFlushed();
+    CHECK(m.predecoded->nPages() == 0);
+}
@@ -0,0 +1,81 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <sstream>
+
+#include <morph/encoder.h>
+
+#include "profile.h"
+
+using isa::ScalarArithmeticOp;
+
+/// `code` loaded at 0, with the profile counting `pcs` as if they ran
+struct Ran {
+    Ran(const std::vector<uint32_t>& code, const std::vector<uint64_t>& pcs)
+        : mem(1024), profile(mem.size()) {
+        std::copy(code.begin(), code.end(), mem.mempool.begin());
+        for (auto pc : pcs) {
+            mem.readInstruction(pc);
+            profile.count(pc);
+        }
+    }
+
+    MemSystem mem;
+    Profile profile;
+};
+
+/// 0x0: li; loop at 0x4..0x10 (sub, cmpi, bi); 0x10: halt
+auto loop() -> std::vector<uint32_t> {
+    isa::Emitter e;
+    e.loadImmediate(false, 1, 3);
+    e.scalarArithmeticImmediate(ScalarArithmeticOp::Sub, 1, 1, 1);
+    e.compareImm(1, 0);
+    e.branchImm(condition_t::nz, -3);
+    e.halt();
+    return e.getData();
+}
+
+TEST_CASE("blocks split where counts change and after branches") {
+    Ran ran(loop(), {0x0, 0x4, 0x8, 0xc, 0x4, 0x8, 0xc, 0x4, 0x8, 0xc, 0x10});
+    CHECK(ran.profile.executed(0x4) == 3);
+    CHECK(ran.profile.executed(0x14) == 0);
+
+    auto blocks = ran.profile.blocks(ran.mem);
+    REQUIRE(blocks.size() == 3);
+    CHECK(blocks[0].start == 0x0);
+    CHECK(blocks[0].end == 0x4);
+    CHECK(blocks[1].start == 0x4);
+    CHECK(blocks[1].end == 0x10);
+    CHECK(blocks[1].entries == 3);
+    CHECK(blocks[1].insts == 9);
+    CHECK(blocks[2].start == 0x10);
+
+    // the same counts either side of a branch are still two blocks
+    Ran twice(loop(), {0x8, 0xc, 0x10});
+    CHECK(twice.profile.blocks(twice.mem).size() == 2);
+}
+
+TEST_CASE("reports and dumps") {
+    Ran ran(loop(), {0x0, 0x4, 0x8, 0xc, 0x4, 0x8, 0xc, 0x10});
+
+    std::ostringstream json;
+    ran.profile.writeJson(json, ran.mem);
+    CHECK(json.str().find("{\"pc\": 4, \"count\": 2, \"asm\": \"") !=
+          std::string::npos);
+    CHECK(json.str().find("{\"start\": 4, \"end\": 16, \"entries\": 2, "
+                          "\"insts\": 6}") != std::string::npos);
+
+    std::ostringstream csv;
+    ran.profile.writeCsv(csv, ran.mem);
+    auto text = csv.str();
+    CHECK(std::count(text.begin(), text.end(), '\n') == 1 + 5);
+    CHECK(text.rfind("pc,count,asm\n0x0,1,\"", 0) == 0);
+    CHECK(text.find("\n0x8,2,\"") != std::string::npos);
+
+    // just has to not fall over; it's for people
+    std::FILE* devnull = std::fopen("/dev/null", "w");
+    ran.profile.writeReport(devnull, ran.mem, 2);
+    std::fclose(devnull);
+}
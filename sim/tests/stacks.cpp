@@ -0,0 +1,90 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest.h"
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+#include <morph/encoder.h>
+
+#include "machine.h"
+#include "stacks.h"
+
+using isa::ScalarArithmeticOp;
+
+/// runs `e` to completion, one instruction per unit of weight
+auto profiled(isa::Emitter& e) -> CallStacks {
+    Machine m(e.getData());
+    CallStacks stacks;
+    m.run(SIZE_MAX,
+          [&](uint64_t pc, const DecodedInstruction<NullTracer>& inst) {
+              stacks.retire(pc, inst.ir, m.cpu, 1);
+          });
+    return stacks;
+}
+
+auto folded(const CallStacks& stacks, const SymbolMap& symbols) -> std::string {
+    std::ostringstream out;
+    stacks.writeFolded(out, symbols);
+    return out.str();
+}
+
+/**
+ * 0x00 main: jal leaf; jal mid; halt
+ * 0x0c leaf: add; jmpr r31
+ * 0x14 mid:  mov r30, r31; jal leaf; jmpr r30
+ */
+auto calls() -> isa::Emitter {
+    isa::Emitter e;
+    e.jumpPCRel(2, true);
+    e.jumpPCRel(3, true);
+    e.halt();
+    e.scalarArithmetic(ScalarArithmeticOp::Add, 1, 1, 1);
+    e.jumpRegRel(31, 0, false);
+    e.scalarArithmeticImmediate(ScalarArithmeticOp::Add, 30, 31, 0);
+    e.jumpPCRel(-4, true);
+    e.jumpRegRel(30, 0, false);
+    return e;
+}
+
+TEST_CASE("calls and returns, through whatever register") {
+    auto e = calls();
+    auto stacks = profiled(e);
+    CHECK(stacks.depth() == 1);
+
+    SymbolMap symbols;
+    symbols.add(0x0, "main");
+    symbols.add(0xc, "leaf");
+    symbols.add(0x10, "leaf.ret"); // local, so doesn't name anything
+    symbols.add(0x14, "mid");
+    CHECK(symbols.name(0x10) == "leaf");
+    CHECK(folded(stacks, symbols) == "main 3\n"
+                                     "main;leaf 2\n"
+                                     "main;mid 3\n"
+                                     "main;mid;leaf 2\n");
+
+    // with nothing to go on, functions are their entry points
+    CHECK(folded(stacks, SymbolMap{}) == "0x0 3\n"
+                                         "0x0;0x14 3\n"
+                                         "0x0;0x14;0xc 2\n"
+                                         "0x0;0xc 2\n");
+}
+
+TEST_CASE("symbol sidecars") {
+    auto path = std::filesystem::temp_directory_path() / "morph_symbols.sym";
+    {
+        std::ofstream out(path);
+        out << "0x0 main\n0x20 f\n0x24 f.loop\n";
+    }
+    SymbolMap symbols(path);
+    CHECK(symbols.name(0x1c) == "main");
+    CHECK(symbols.name(0x28) == "f");
+
+    {
+        std::ofstream out(path);
+        out << "0x0 main\nnonsense\n";
+    }
+    CHECK_THROWS_AS(SymbolMap{path}, std::runtime_error);
+    std::filesystem::remove(path);
+    CHECK_THROWS_AS(SymbolMap{path}, std::runtime_error);
+}
@@ -0,0 +1,79 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest.h"
+
+#include <morph/encoder.h>
+
+#include "machine.h"
+
+using isa::ScalarArithmeticOp;
+
+auto countdownLoop(bool selfModifying) -> std::vector<uint32_t> {
+    isa::Emitter e;
+    e.loadImmediate(false, 1, 3);                                 // 0x00
+    e.scalarArithmeticImmediate(ScalarArithmeticOp::Add, 2, 2, 3); // 0x04
+    if (selfModifying)
+        e.storeScalar(false, 0, 3, 4); // 0x08: st32 [r0+4], r3
+    else
+        e.nop();
+    e.scalarArithmeticImmediate(ScalarArithmeticOp::Sub, 1, 1, 1); // 0x0c
+    e.compareImm(1, 0);                                            // 0x10
+    e.branchImm(condition_t::nz, -5);                              // 0x14
+    e.halt();                                                      // 0x18
+    return e.getData();
+}
+
+TEST_CASE("threaded engine matches the interpreter") {
+    bool selfModifying = false;
+    SUBCASE("plain loop") {}
+    SUBCASE("loop that patches its own body") { selfModifying = true; }
+
+    isa::Emitter patch;
+    patch.scalarArithmeticImmediate(ScalarArithmeticOp::Add, 2, 2, 100);
+
+    auto code = countdownLoop(selfModifying);
+    Machine interp(code, 256), threaded(code, 256);
+    interp.cpu.r[3] = patch.getData()[0];
+    threaded.cpu.r[3] = patch.getData()[0];
+
+    interp.run();
+    auto nBlocks = threaded.runThreaded();
+
+    for (size_t i = 0; i < ScalarRegisterFile::N_REGS; i++)
+        CHECK(interp.cpu.r[i].raw() == threaded.cpu.r[i].raw());
+    CHECK(interp.cpu.pc.getCurrentPC() == threaded.cpu.pc.getCurrentPC());
+    CHECK(interp.mem.mempool == threaded.mem.mempool);
+
+    if (selfModifying) {
+        CHECK(threaded.cpu.r[2].raw() == 3 + 100 + 100);
+    } else {
+        CHECK(threaded.cpu.r[2].raw() == 3 * 3);
+        // entry block, loop body, exit
+        CHECK(nBlocks == 3);
+    }
+}
+
+TEST_CASE("self-modifying code at the top of a full-size memory") {
+    isa::Emitter patch;
+    patch.scalarArithmeticImmediate(ScalarArithmeticOp::Add, 2, 2, 1);
+
+    isa::Emitter e;
+    e.loadImmediate(false, 1, 3);
+    e.scalarArithmeticImmediate(ScalarArithmeticOp::Add, 2, 2, 3);
+    e.storeScalar(false, 5, 3, 4); // st32 [r5+4], r3
+    e.scalarArithmeticImmediate(ScalarArithmeticOp::Sub, 1, 1, 1);
+    e.compareImm(1, 0);
+    e.branchImm(condition_t::nz, -5);
+    e.halt();
+    auto code = e.getData();
+    uint64_t at = MemSystem::MAX_SIZE - 4096;
+
+    Machine m({}, MemSystem::MAX_SIZE / 4);
+    m.load(code, at);
+    m.cpu.r[3] = patch.getData()[0];
+    m.cpu.r[5] = at;
+    m.cpu.pc.setTakenPC(int64_t(at));
+    m.cpu.pc.setTaken(true);
+    m.runThreaded();
+    // 3 the first time round, then the patched 1 twice
+    CHECK(m.cpu.r[2].raw() == 5);
+}
@@ -0,0 +1,114 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest.h"
+
+#include <functional>
+
+#include <morph/encoder.h>
+
+#include "machine.h"
+#include "timing.h"
+
+using isa::LanewiseVectorOp;
+using isa::ScalarArithmeticOp;
+
+/// runs `e` to completion under a TimingModel, with the D-cache modelled if
+/// `dcache` is set
+auto timed(isa::Emitter& e, bool dcache = false)
+    -> std::shared_ptr<TimingModel> {
+    Machine m(e.getData(), 1024, std::make_shared<TimingModel>(TimingConfig{}));
+    if (dcache) {
+        CacheConfig config;
+        config.indexBit = 6;
+        m.mem.enableDCache(config);
+    }
+    m.tracer->watchCaches(nullptr, m.mem.dcache.get());
+    m.run();
+    return m.tracer;
+}
+
+/// cycles `body` takes beyond one per instruction, after a few independent
+/// instructions to set things up
+auto stalls(const std::function<void(isa::Emitter&)>& body) -> int64_t {
+    isa::Emitter e;
+    e.loadImmediate(false, 1, 0x100);
+    e.loadImmediate(false, 2, 3);
+    e.loadImmediate(false, 3, 4);
+    body(e);
+    e.halt();
+    auto timing = timed(e);
+    return int64_t(timing->cycles()) - int64_t(timing->instructions());
+}
+
+TEST_CASE("independent instructions issue one a cycle") {
+    CHECK(stalls([](isa::Emitter& e) {
+              e.scalarArithmetic(ScalarArithmeticOp::Add, 4, 2, 3);
+              e.scalarArithmetic(ScalarArithmeticOp::Add, 5, 4, 3); // ex->ex
+              e.scalarArithmetic(ScalarArithmeticOp::Add, 6, 4, 5);
+          }) == 0);
+}
+
+TEST_CASE("a load's result is a cycle late for the next instruction") {
+    CHECK(stalls([](isa::Emitter& e) {
+              e.loadScalar(false, 4, 1, 0);
+              e.scalarArithmetic(ScalarArithmeticOp::Add, 5, 4, 3);
+          }) == 1);
+    // ...but not if something else goes in between
+    CHECK(stalls([](isa::Emitter& e) {
+              e.loadScalar(false, 4, 1, 0);
+              e.scalarArithmetic(ScalarArithmeticOp::Add, 6, 2, 3);
+              e.scalarArithmetic(ScalarArithmeticOp::Add, 5, 4, 3);
+          }) == 0);
+}
+
+TEST_CASE("the vector pipeline doesn't forward") {
+    // a dependent vector op waits for the whole pipeline to drain
+    CHECK(stalls([](isa::Emitter& e) {
+              e.vectorLanewiseArith(LanewiseVectorOp::Add, 1, 2, 3, 0b1111);
+              e.vectorLanewiseArith(LanewiseVectorOp::Add, 4, 1, 3, 0b1111);
+          }) == 9);
+    // and so does one going into it that needs a scalar result, which
+    // would have been forwarded to a scalar op
+    CHECK(stalls([](isa::Emitter& e) {
+              e.scalarArithmetic(ScalarArithmeticOp::Add, 4, 2, 3);
+              e.vsplat(1, 4, 0b1111);
+          }) == 2);
+}
+
+TEST_CASE("taken branches and blocks") {
+    // 0x0: li r1; 0x4: loop (sub, cmpi, bi); 0x10: halt
+    isa::Emitter e;
+    e.loadImmediate(false, 1, 10);
+    e.scalarArithmeticImmediate(ScalarArithmeticOp::Sub, 1, 1, 1);
+    e.compareImm(1, 0);
+    e.branchImm(condition_t::nz, -3);
+    e.halt();
+    auto timing = timed(e);
+
+    // taken 9 times, each costing a refetch
+    CHECK(timing->instructions() == 1 + 3 * 10 + 1);
+    CHECK(timing->cycles() == timing->instructions() + 9);
+
+    // the first time round the loop is part of the block at 0x0
+    auto& blocks = timing->blocks();
+    REQUIRE(blocks.size() == 3);
+    CHECK(blocks.at(0x0).insts == 4);
+    auto& loop = blocks.at(0x4);
+    CHECK(loop.end == 0x10);
+    CHECK(loop.entries == 9);
+    CHECK(loop.insts == 27);
+    CHECK(loop.cycles == 27 + 9);
+    CHECK(blocks.at(0x10).entries == 1);
+}
+
+TEST_CASE("cache misses stall") {
+    isa::Emitter e;
+    e.loadImmediate(false, 1, 0x100);
+    e.loadScalar(false, 2, 1, 0);  // miss
+    e.loadScalar(false, 3, 1, 4);  // hit
+    e.storeScalar(false, 1, 2, 8); // hit
+    e.halt();
+
+    auto uncached = timed(e);
+    auto cached = timed(e, true);
+    CHECK(cached->cycles() == uncached->cycles() + TimingConfig{}.missPenalty);
+}
@@ -0,0 +1,318 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#include <morph/encoder.h>
+
+#include "machine.h"
+#include "ring.h"
+#include "trace.h"
+
+using isa::ScalarArithmeticOp;
+
+auto slurp(const std::filesystem::path& path) -> std::string {
+    std::ifstream in(path, std::ios::binary);
+    std::ostringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+
+/// runs `code` to completion, tracing it to `path`
+void trace(const std::vector<uint32_t>& code, const std::filesystem::path& path,
+           TraceFormat format, bool async = false, TraceFilter filter = {}) {
+    Machine m(code, 256,
+              std::make_shared<FileTracer>(path.string(), format, async,
+                                           std::move(filter)));
+    m.run();
+}
+
+TEST_CASE("binary traces render to the same text") {
+    // something from most record kinds: scalar and vector in/out, memory both
+    // ways, flags, control flow, masks, swizzles
+    isa::Emitter e;
+    e.loadImmediate(false, 1, 3);
+    e.loadImmediate(false, 2, 0x80);
+    e.scalarArithmeticImmediate(ScalarArithmeticOp::Add, 3, 3, 7);
+    e.storeScalar(false, 2, 3, 0);
+    e.loadScalar(true, 4, 2, 0);
+    e.vsplat(1, 1, 0b1011);
+    e.vswizzle(2, 1, 3, 2, 1, 0, 0b1111);
+    e.storeVectorImmStride(2, 2, 0, 0b1111);
+    e.loadVectorImmStride(3, 2, 0, 0b0111);
+    e.scalarArithmeticImmediate(ScalarArithmeticOp::Sub, 1, 1, 1);
+    e.compareImm(1, 0);
+    e.branchImm(condition_t::nz, -3);
+    e.halt();
+
+    auto dir = std::filesystem::temp_directory_path();
+    auto textPath = dir / "morph_trace_test.trace";
+    auto binPath = dir / "morph_trace_test.bin";
+    trace(e.getData(), textPath, TraceFormat::Text);
+    trace(e.getData(), binPath, TraceFormat::Binary);
+
+    auto text = slurp(textPath);
+    auto bin = slurp(binPath);
+    std::filesystem::remove(textPath);
+    std::filesystem::remove(binPath);
+
+    TraceFileHeader header;
+    REQUIRE(bin.size() >= sizeof header);
+    std::memcpy(&header, bin.data(), sizeof header);
+    CHECK(std::memcmp(header.magic, TraceFileHeader::MAGIC, 4) == 0);
+    CHECK(header.version == TraceFileHeader::VERSION);
+    CHECK(header.recordSize == sizeof(TraceRecord));
+
+    auto nRecords = (bin.size() - sizeof header) / sizeof(TraceRecord);
+    REQUIRE((bin.size() - sizeof header) % sizeof(TraceRecord) == 0);
+    CHECK(nRecords == 9 + 3 * 3 + 1);
+
+    TraceTextFormatter formatter;
+    fmt::memory_buffer rendered;
+    for (size_t i = 0; i < nRecords; i++) {
+        TraceRecord rec;
+        std::memcpy(&rec, bin.data() + sizeof header + i * sizeof rec,
+                    sizeof rec);
+        formatter.format(rec, rendered);
+    }
+
+    CHECK(std::string(rendered.data(), rendered.size()) == text);
+    CHECK(text.find("vector_store: 0x80 = ") != std::string::npos);
+    CHECK(text.find("scalar_load: 36 : 0x80 = 0x7") != std::string::npos);
+}
+
+TEST_CASE("async traces match synchronous ones") {
+    // a few times the ring's worth of records, so the simulator has to wait
+    // on the writer thread
+    isa::Emitter e;
+    e.loadImmediate(false, 1, 20000);
+    e.loadImmediate(false, 2, 0x80);
+    e.storeScalar(false, 2, 1, 0);
+    e.scalarArithmeticImmediate(ScalarArithmeticOp::Sub, 1, 1, 1);
+    e.compareImm(1, 0);
+    e.branchImm(condition_t::nz, -4);
+    e.halt();
+
+    auto dir = std::filesystem::temp_directory_path();
+    for (auto format : {TraceFormat::Binary, TraceFormat::Text}) {
+        auto syncPath = dir / "morph_trace_test.sync";
+        auto asyncPath = dir / "morph_trace_test.async";
+        trace(e.getData(), syncPath, format);
+        trace(e.getData(), asyncPath, format, true);
+
+        auto expected = slurp(syncPath);
+        auto actual = slurp(asyncPath);
+        std::filesystem::remove(syncPath);
+        std::filesystem::remove(asyncPath);
+
+        if (format == TraceFormat::Binary)
+            CHECK(expected.size() ==
+                  sizeof(TraceFileHeader) +
+                      (2 + 4 * 20000 + 1) * sizeof(TraceRecord));
+        CHECK(actual == expected);
+    }
+}
+
+TEST_CASE("SpscRing hands everything over in order") {
+    SpscRing<uint64_t, 64> ring;
+    constexpr uint64_t N = 1 << 20;
+
+    std::thread consumer([&] {
+        uint64_t expect = 0;
+        while (expect < N) {
+            if (auto* v = ring.front()) {
+                if (*v != expect)
+                    break;
+                ring.pop();
+                expect++;
+            } else {
+                std::this_thread::yield();
+            }
+        }
+        CHECK(expect == N);
+    });
+
+    for (uint64_t i = 0; i < N; i++)
+        while (!ring.push(i))
+            std::this_thread::yield();
+    consumer.join();
+    CHECK(ring.empty());
+}
+
+/// every record of the trace at `path`, through TraceReader
+auto readAll(const std::filesystem::path& path) -> std::vector<TraceRecord> {
+    TraceReader reader(path.string());
+    std::vector<TraceRecord> recs(reader.size());
+    CHECK(reader.read(recs.data(), recs.size()) == recs.size());
+    return recs;
+}
+
+auto sameRecords(const std::vector<TraceRecord>& a,
+                 const std::vector<TraceRecord>& b) -> bool {
+    return a.size() == b.size() &&
+           std::memcmp(a.data(), b.data(), a.size() * sizeof(TraceRecord)) ==
+               0;
+}
+
+TEST_CASE("compressed traces") {
+    isa::Emitter e;
+    e.loadImmediate(false, 1, 5000);
+    e.loadImmediate(false, 2, 0x80);
+    e.storeScalar(false, 2, 1, 0);
+    e.scalarArithmeticImmediate(ScalarArithmeticOp::Sub, 1, 1, 1);
+    e.compareImm(1, 0);
+    e.branchImm(condition_t::nz, -4);
+    e.halt();
+    const uint64_t N = 2 + 4 * 5000 + 1;
+
+    auto dir = std::filesystem::temp_directory_path();
+    auto binPath = dir / "morph_trace_test.bin";
+    auto zPath = dir / "morph_trace_test.z";
+    trace(e.getData(), binPath, TraceFormat::Binary);
+    trace(e.getData(), zPath, TraceFormat::Compressed);
+
+    auto expected = readAll(binPath);
+    REQUIRE(expected.size() == N);
+    CHECK(std::filesystem::file_size(zPath) <
+          std::filesystem::file_size(binPath) / 10);
+
+    SUBCASE("read back the same") {
+        CHECK(sameRecords(readAll(zPath), expected));
+    }
+
+    SUBCASE("seek") {
+        TraceReader reader(zPath.string());
+        CHECK(reader.size() == N);
+        CHECK_FALSE(reader.truncated());
+        for (uint64_t at : {N - 1, uint64_t(0), uint64_t(TraceBlock::RECORDS),
+                            uint64_t(TraceBlock::RECORDS - 3), N / 2}) {
+            reader.seek(at);
+            TraceRecord recs[8];
+            auto n = reader.read(recs, 8);
+            CHECK(n == std::min<uint64_t>(8, N - at));
+            CHECK(std::memcmp(recs, &expected[at], n * sizeof recs[0]) == 0);
+        }
+    }
+
+    SUBCASE("cut short") {
+        // as if sim died partway through a block: no index, and a partial
+        // block after the complete ones
+        auto size = std::filesystem::file_size(zPath);
+        std::filesystem::resize_file(zPath, size * 2 / 3);
+        TraceReader reader(zPath.string());
+        CHECK(reader.truncated());
+        CHECK(reader.size() > 0);
+        CHECK(reader.size() < N);
+        CHECK(reader.size() % TraceBlock::RECORDS == 0);
+
+        std::vector<TraceRecord> recs(reader.size());
+        CHECK(reader.read(recs.data(), recs.size()) == recs.size());
+        CHECK(std::memcmp(recs.data(), expected.data(),
+                          recs.size() * sizeof(TraceRecord)) == 0);
+    }
+
+    std::filesystem::remove(binPath);
+    std::filesystem::remove(zPath);
+}
+
+TEST_CASE("trace filters") {
+    // 0x0: li r1; 0x4: li r2; loop at 0x8..0x14 (st, sub, cmpi, bi); halt
+    isa::Emitter e;
+    e.loadImmediate(false, 1, 100);
+    e.loadImmediate(false, 2, 0x80);
+    e.storeScalar(false, 2, 1, 0);
+    e.scalarArithmeticImmediate(ScalarArithmeticOp::Sub, 1, 1, 1);
+    e.compareImm(1, 0);
+    e.branchImm(condition_t::nz, -4);
+    e.halt();
+
+    auto path = std::filesystem::temp_directory_path() / "morph_trace_test.f";
+    auto traced = [&](TraceFilter filter) {
+        trace(e.getData(), path, TraceFormat::Binary, false, filter);
+        auto recs = readAll(path);
+        std::filesystem::remove(path);
+        return recs;
+    };
+
+    SUBCASE("everything by default") {
+        CHECK(traced({}).size() == 2 + 4 * 100 + 1);
+    }
+
+    SUBCASE("window") {
+        TraceFilter filter;
+        filter.first = 10;
+        filter.last = 20;
+        auto recs = traced(filter);
+        REQUIRE(recs.size() == 10);
+        // 10th executed: li, li, then 2 whole iterations in
+        CHECK(recs[0].pc == 0x8);
+        CHECK(recs[9].pc == 0xc);
+    }
+
+    SUBCASE("pcs") {
+        TraceFilter filter;
+        filter.pcs = {{0x0, 0x4}, {0xc, 0x10}};
+        auto recs = traced(filter);
+        CHECK(recs.size() == 1 + 100);
+        for (auto& rec : recs)
+            CHECK((rec.pc == 0x0 || rec.pc == 0xc));
+    }
+
+    SUBCASE("categories") {
+        TraceFilter filter;
+        filter.categories = 1u << static_cast<unsigned>(isa::Category::Memory);
+        auto recs = traced(filter);
+        CHECK(recs.size() == 100);
+        for (auto& rec : recs)
+            CHECK(rec.store.kind == TraceRecord::MemAccess::Kind::Scalar32);
+    }
+
+    SUBCASE("all at once") {
+        TraceFilter filter;
+        filter.categories = ~0u;
+        filter.pcs = {{0x8, 0x18}};
+        filter.first = 2 + 4 * 50;
+        auto recs = traced(filter);
+        CHECK(recs.size() == 4 * 50);
+    }
+}
+
+TEST_CASE("a tracefile that runs out of room is an error") {
+    // /dev/full opens fine, then fails every write, like a full disk
+    TraceRecord rec{};
+    rec.pc = 0x40;
+
+    // when the buffer fills...
+    TraceSink filling("/dev/full", TraceFormat::Binary);
+    auto fill = [&] {
+        for (size_t i = 0; i <= TraceWriter::BUFFER_SIZE / sizeof rec; i++)
+            filling.write(rec);
+    };
+    CHECK_THROWS_AS(fill(), std::runtime_error);
+
+    // ...or when it's flushed
+    for (auto format :
+         {TraceFormat::Text, TraceFormat::Binary, TraceFormat::Compressed}) {
+        TraceSink sink("/dev/full", format);
+        sink.write(rec);
+        CHECK_THROWS_AS(sink.flush(), std::runtime_error);
+        CHECK_THROWS_AS(sink.close(), std::runtime_error);
+    }
+}
+
+TEST_CASE("drain() rethrows what the writer thread died of") {
+    TraceSink sink("/dev/full", TraceFormat::Binary);
+    AsyncTraceSink async(sink);
+    TraceRecord rec{};
+    // more than the writer's buffer holds, so it fails on the writer thread,
+    // and the simulator only hears about it here
+    for (size_t i = 0; i <= TraceWriter::BUFFER_SIZE / sizeof rec; i++)
+        async.push(rec);
+    CHECK_THROWS_AS(async.drain(), std::runtime_error);
+    // and keeps hearing about it
+    CHECK_THROWS_AS(async.drain(), std::runtime_error);
+}
@@ -0,0 +1,255 @@
+#pragma once
+
+#include <algorithm>
+#include <bitset>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "cpu.h"
+#include "jit.h"
+#include "mem.h"
+#include "predecode.h"
+
+/**
+ * A straight-line run of predecoded instructions, ending at the first
+ * control-flow instruction (J/JR/BI/BR formats) or halt.
+ */
+template <typename T> struct BasicBlock {
+    uint64_t start;
+    uint64_t end; // PC just past the last instruction
+    std::vector<DecodedInstruction<T>> insts;
+
+    // last blocks we left this one for: [0] falls through, [1] is whatever
+    // the terminating jump/branch went to most recently.
+    BasicBlock* succ[2] = {nullptr, nullptr};
+
+    // times entered, until it's hot enough to hand to the JIT
+    uint32_t hits = 0;
+    NativeBlock<T> native = nullptr;
+};
+
+/**
+ * Execution engine that translates code into basic blocks of direct-threaded
+ * handlers the first time it's reached, then runs whole blocks without going
+ * back through fetch/decode, following cached successor links between them.
+ *
+ * Architectural behaviour (and so the trace) matches the interpreter loop:
+ * the PC is still advanced per instruction, and a block is abandoned as soon
+ * as anything inside it goes stale.
+ *
+ * With the JIT enabled, blocks that have run JIT_THRESHOLD times are compiled
+ * to native code, which skips the per-instruction step entirely; that's only
+ * correct when nothing (tracing, --log-execution) needs to see each
+ * instruction go by.
+ */
+template <typename T> class ThreadedEngine : public CodeObserver {
+  public:
+    static constexpr size_t MAX_BLOCK_LEN = 64;
+    static constexpr uint32_t JIT_THRESHOLD = 32;
+
+    ThreadedEngine(CPUState& cpu, MemSystem& mem)
+        : cpu{cpu}, mem{mem}, blocks{}, retired{}, covered{}, epoch{0},
+          jit{nullptr}, jitProxy{nullptr} {
+        mem.setCodeObserver(this);
+    }
+    ~ThreadedEngine() override { mem.setCodeObserver(nullptr); }
+
+    ThreadedEngine(const ThreadedEngine&) = delete;
+    ThreadedEngine& operator=(const ThreadedEngine&) = delete;
+
+    /// compile hot blocks, which will run against `proxy`. does nothing if
+    /// the host can't run generated code.
+    void enableJit(CPUInstructionProxy<T>& proxy) {
+        if (!x64::hostSupported())
+            return;
+        jit = std::make_unique<JitCompiler<T>>(cpu, mem, epoch);
+        jitProxy = &proxy;
+    }
+
+    /**
+     * Run until the CPU halts or `step` returns false. `step(pc, inst)` is
+     * responsible for actually executing `inst` (plus any tracing etc.) so
+     * the engine and the interpreter share one per-instruction path.
+     *
+     * Compiled blocks don't go through `step`; `poll()` gets called after
+     * each of them instead, and can also stop the run by returning false.
+     */
+    template <typename Step, typename Poll>
+    void run(Step&& step, Poll&& poll) {
+        BasicBlock<T>* block = nullptr;
+
+        while (!cpu.isHalted()) {
+            retired.clear(); // nothing's running out of these any more
+
+            uint64_t pc = cpu.pc.getNewPC();
+            block = lookup(block, pc);
+
+            if (jit && !block->native && ++block->hits == JIT_THRESHOLD)
+                block->native = jit->compile(block->start, block->insts);
+            if (block->native) {
+                if (!block->native(&cpu, jitProxy)) {
+                    jit->rethrowPending();
+                    block = nullptr; // bailed because the block went stale
+                }
+                if (!poll())
+                    return;
+                continue;
+            }
+
+            auto startEpoch = epoch;
+            for (size_t i = 0;;) {
+                if (!step(pc, block->insts[i]))
+                    return;
+
+                if (epoch != startEpoch) {
+                    // a store or flushicache killed this block under us
+                    block = nullptr;
+                    break;
+                }
+                if (++i == block->insts.size() || cpu.isHalted())
+                    break;
+                pc = cpu.pc.getNewPC();
+            }
+        }
+    }
+
+    template <typename Step> void run(Step&& step) {
+        run(step, [] { return true; });
+    }
+
+    void codeModified(uint64_t addr, uint64_t len) override {
+        if (len == 0 || !isCovered(addr / 4, (addr + len + 3) / 4))
+            return;
+
+        for (auto it = blocks.begin(); it != blocks.end();) {
+            auto& b = it->second;
+            if (b->start < addr + len && addr < b->end) {
+                retired.push_back(std::move(b));
+                it = blocks.erase(it);
+            } else {
+                it++;
+            }
+        }
+        unlinkAll();
+    }
+
+    void codeFlushed() override {
+        for (auto& [start, b] : blocks)
+            retired.push_back(std::move(b));
+        blocks.clear();
+        covered.clear();
+        epoch++;
+    }
+
+    [[nodiscard]] auto nBlocks() const -> size_t { return blocks.size(); }
+
+  private:
+    auto lookup(BasicBlock<T>* prev, uint64_t pc) -> BasicBlock<T>* {
+        if (prev) {
+            for (auto* s : prev->succ)
+                if (s && s->start == pc)
+                    return s;
+        }
+
+        BasicBlock<T>* next;
+        if (auto it = blocks.find(pc); it != blocks.end())
+            next = it->second.get();
+        else
+            next = translate(pc);
+
+        if (prev)
+            prev->succ[pc == prev->end ? 0 : 1] = next;
+        return next;
+    }
+
+    auto translate(uint64_t pc) -> BasicBlock<T>* {
+        auto b = std::make_unique<BasicBlock<T>>();
+        b->start = pc;
+
+        uint64_t at = pc;
+        while (b->insts.size() < MAX_BLOCK_LEN) {
+            DecodedInstruction<T> inst{};
+            if (b->insts.empty()) {
+                // let fetch/decode errors surface exactly like they would
+                // in the interpreter
+                decodeInto(inst, at);
+            } else {
+                // ...but further ahead this might be data, or past the end
+                // of memory; just end the block and find out if we get there.
+                try {
+                    decodeInto(inst, at);
+                } catch (const std::logic_error&) {
+                    break;
+                }
+            }
+
+            b->insts.push_back(inst);
+            at += 4;
+            if (inst.endsBlock)
+                break;
+        }
+        b->end = at;
+
+        for (uint64_t idx = pc / 4; idx < at / 4; idx++)
+            covered[idx / PAGE_WORDS].set(idx % PAGE_WORDS);
+
+        auto* raw = b.get();
+        blocks.emplace(pc, std::move(b));
+        return raw;
+    }
+
+    /// whether any word in [lo, hi) is (or was) part of some block
+    auto isCovered(uint64_t lo, uint64_t hi) const -> bool {
+        auto hitIn = [&](uint64_t page, const std::bitset<PAGE_WORDS>& bits) {
+            uint64_t first = page * PAGE_WORDS;
+            uint64_t to = std::min(hi, first + PAGE_WORDS);
+            for (auto idx = std::max(lo, first); idx < to; idx++)
+                if (bits[idx - first])
+                    return true;
+            return false;
+        };
+
+        uint64_t loPage = lo / PAGE_WORDS, hiPage = (hi - 1) / PAGE_WORDS;
+        if (hiPage - loPage < covered.size()) {
+            for (auto page = loPage; page <= hiPage; page++)
+                if (auto it = covered.find(page); it != covered.end())
+                    if (hitIn(page, it->second))
+                        return true;
+        } else {
+            for (const auto& [page, bits] : covered)
+                if (page >= loPage && page <= hiPage && hitIn(page, bits))
+                    return true;
+        }
+        return false;
+    }
+
+    void decodeInto(DecodedInstruction<T>& inst, uint64_t pc) {
+        inst.ir = mem.readInstruction(pc);
+        Predecoder<T> predecoder(inst);
+        isa::decodeInstruction(predecoder, bits<32>(inst.ir));
+    }
+
+    void unlinkAll() {
+        for (auto& [start, b] : blocks)
+            b->succ[0] = b->succ[1] = nullptr;
+        epoch++;
+    }
+
+    CPUState& cpu;
+    MemSystem& mem;
+
+    std::unordered_map<uint64_t, std::unique_ptr<BasicBlock<T>>> blocks;
+    // invalidated while possibly still executing; freed at the next block
+    std::vector<std::unique_ptr<BasicBlock<T>>> retired;
+    // words that are (or were) part of some block, a page of code at a time
+    // so code far up memory doesn't need a bit for everything below it
+    static constexpr uint64_t PAGE_WORDS = 1024;
+    std::unordered_map<uint64_t, std::bitset<PAGE_WORDS>> covered;
+    // bumped whenever blocks are invalidated
+    uint64_t epoch;
+
+    std::unique_ptr<JitCompiler<T>> jit;
+    CPUInstructionProxy<T>* jitProxy;
+};
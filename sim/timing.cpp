@@ -0,0 +1,111 @@
+#include "timing.h"
+
+#include <algorithm>
+#include <bit>
+
+#include "profile.h"
+
+TimingModel::TimingModel(TimingConfig config)
+    : cfg{config}, icache{nullptr}, dcache{nullptr}, now{0}, retired{0}, r{},
+      v{}, flags{}, matrixFree{0}, op{}, scalarIn{0}, vectorIn{0},
+      scalarOut{0}, vectorOut{0}, readsFlags{false}, writesFlags{false},
+      loads{false}, redirected{false}, fetchMissesBefore{0},
+      dataMissesBefore{0}, byBlock{}, block{nullptr}, nextPC{0},
+      blockEnds{true} {}
+
+void TimingModel::watchCaches(const Cache* icache, const Cache* dcache) {
+    this->icache = icache;
+    this->dcache = dcache;
+}
+
+auto TimingModel::missesNow() const -> uint64_t {
+    if (!dcache)
+        return 0;
+    auto& st = dcache->stats();
+    return st.readMisses + st.writeMisses + st.writebacks;
+}
+
+void TimingModel::begin(uint64_t pc, uint64_t ir) {
+    op = static_cast<isa::Opcode>(isa::opcodeOf(bits<32>(ir)));
+    scalarIn = vectorIn = scalarOut = vectorOut = 0;
+    readsFlags = writesFlags = loads = false;
+
+    // the I-cache model counts this fetch after we get here
+    fetchMissesBefore = icache ? icache->stats().readMisses : 0;
+    dataMissesBefore = missesNow();
+
+    redirected = retired != 0 && pc != nextPC;
+    if (blockEnds || redirected) {
+        block = &byBlock[pc];
+        block->entries++;
+    }
+    nextPC = pc + 4;
+    block->end = std::max(block->end, nextPC);
+}
+
+void TimingModel::scalarRegInput(CPUState& cpu, const char* name,
+                                 reg_idx r) {
+    // rD (or vD) only shows up as an input so traces can show the old
+    // value; the hardware doesn't read it (control_unit.sv)
+    if (name[1] != 'D')
+        scalarIn |= uint32_t(1) << r;
+}
+
+void TimingModel::vectorRegInput(CPUState& cpu, const char* name,
+                                 vreg_idx r) {
+    if (name[1] != 'D')
+        vectorIn |= uint32_t(1) << r;
+}
+
+void TimingModel::end() {
+    auto category = isa::opcodeInfo[static_cast<size_t>(op)].category;
+    bool vectorPipe = category == isa::Category::Vector ||
+                      category == isa::Category::Float ||
+                      category == isa::Category::Matrix;
+
+    uint64_t issue = now + 1;
+    if (redirected)
+        issue += cfg.redirectPenalty;
+    if (icache)
+        issue += (icache->stats().readMisses - fetchMissesBefore) *
+                 cfg.missPenalty;
+
+    for (auto in = scalarIn; in; in &= in - 1) {
+        auto& ready = r[std::countr_zero(in)];
+        issue = std::max(issue, vectorPipe ? ready.wb : ready.fwd);
+    }
+    for (auto in = vectorIn; in; in &= in - 1)
+        issue = std::max(issue, v[std::countr_zero(in)].wb);
+    if (readsFlags)
+        issue = std::max(issue, vectorPipe ? flags.wb : flags.fwd);
+    if (category == isa::Category::Matrix && op != isa::Opcode::systolicstep)
+        issue = std::max(issue, matrixFree);
+
+    // misses stall everything behind this instruction too, so just count
+    // them as this instruction taking longer
+    uint64_t done = issue + (missesNow() - dataMissesBefore) * cfg.missPenalty;
+
+    // the scalar pipeline's ex and mem stages forward; a result is through
+    // both of them 3 cycles in. the vector pipeline doesn't forward at all
+    Ready ready;
+    if (vectorPipe)
+        ready.fwd = ready.wb = done + cfg.vectorDepth + 1;
+    else
+        ready = {done + (loads ? 2 : 1), done + 3};
+    for (auto out = scalarOut; out; out &= out - 1)
+        r[std::countr_zero(out)] = ready;
+    for (auto out = vectorOut; out; out &= out - 1)
+        v[std::countr_zero(out)] = ready;
+    if (writesFlags)
+        flags = ready;
+    if (op == isa::Opcode::matmul)
+        matrixFree = done + MatrixUnit::SYSTOLIC_CYCLES;
+
+    block->insts++;
+    block->cycles += done - now;
+    // jumps, branches and halt end a block, as in ThreadedEngine; so does
+    // landing anywhere but the next PC (see begin())
+    blockEnds = endsBlock(op);
+    now = done;
+    retired++;
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <unordered_map>
+
+#include <morph/opcodes.h>
+
+#include "cache.h"
+#include "trace.h"
+
+struct TimingConfig {
+    // hazard_detection_unit.sv's DEPTH: stages in the vector pipeline, none
+    // of which forward
+    uint32_t vectorDepth = 9;
+    // cycles lost to each cache fill and each writeback
+    uint32_t missPenalty = 40;
+    // cycles thrown away fetching down the wrong path after a jump or taken
+    // branch
+    uint32_t redirectPenalty = 1;
+};
+
+/// what one dynamic basic block (by start PC) cost over the whole run
+struct BlockTiming {
+    uint64_t end = 0; // PC just past the last instruction seen in it
+    uint64_t entries = 0;
+    uint64_t insts = 0;
+    uint64_t cycles = 0;
+};
+
+/**
+ * Cycle-approximate timing for the card's pipeline, following the stall rules
+ * in hazard_detection_unit.sv. It watches execution as a Tracer, so it sees
+ * each instruction's register reads and writes without decoding anything
+ * itself.
+ *
+ * One instruction issues per cycle, unless:
+ * - a scalar-pipeline instruction needs a load's result straight away
+ *   (mem_to_ex_hazard): one bubble, since ex->ex forwarding can't help;
+ * - an instruction depends on something still in the vector pipeline, or is
+ *   bound for the vector pipeline itself (vector, float and matrix ops) and
+ *   depends on anything in flight: nothing forwards there, so it waits for
+ *   the writeback;
+ * - the matrix unit is still busy with a matmul (SYSTOLIC_CYCLES);
+ * - the fetch was redirected, or missed the I-cache;
+ * - a load or store missed the D-cache or caused a writeback, which stalls
+ *   the whole pipeline (full_stall).
+ *
+ * Cache misses come from MemSystem's cache models, when they're on.
+ */
+class TimingModel final : public Tracer {
+  public:
+    explicit TimingModel(TimingConfig config);
+
+    /// charge misses from these (either may be nullptr)
+    void watchCaches(const Cache* icache, const Cache* dcache);
+
+    [[nodiscard]] auto cycles() const -> uint64_t { return now; }
+    [[nodiscard]] auto instructions() const -> uint64_t { return retired; }
+    [[nodiscard]] auto blocks() const
+        -> const std::unordered_map<uint64_t, BlockTiming>& {
+        return byBlock;
+    }
+
+    void begin(uint64_t pc, uint64_t ir) override;
+    void end() override;
+    void flush() {}
+
+    void immInput(int64_t imm) override {}
+    void vectorMask(vmask_t mask) override {}
+    void branchCondcode(condition_t cond) override { readsFlags = true; }
+    void swizzleInput(vlaneidx_t i0, vlaneidx_t i1, vlaneidx_t i2,
+                      vlaneidx_t i3) override {}
+
+    void scalarRegInput(CPUState& cpu, const char* name, reg_idx r) override;
+    void vectorRegInput(CPUState& cpu, const char* name, vreg_idx r) override;
+    void scalarRegOutput(CPUState& cpu, const char* name, reg_idx r) override {
+        scalarOut |= uint32_t(1) << r;
+    }
+    void vectorRegOutput(CPUState& cpu, const char* name,
+                         vreg_idx r) override {
+        vectorOut |= uint32_t(1) << r;
+    }
+
+    void flagsWriteback(ConditionFlags flags) override { writesFlags = true; }
+    void controlFlow(PC& pc) override {}
+
+    void memWrite(uint64_t addr, u<32> val) override {}
+    void memWrite(uint64_t addr, u<36> val) override {}
+    void memWrite(uint64_t addr, f32x4 val) override {}
+    void memRead32(uint64_t addr, uint32_t val) override { loads = true; }
+    void memRead36(uint64_t addr, uint64_t val) override { loads = true; }
+    void memReadVec(uint64_t addr, f32x4 val) override { loads = true; }
+
+  private:
+    // earliest cycles a consumer of some result can issue: `fwd` for
+    // scalar-pipeline instructions, which can take it off a forwarding
+    // path, `wb` for everything else
+    struct Ready {
+        uint64_t fwd = 0, wb = 0;
+    };
+
+    auto missesNow() const -> uint64_t;
+
+    TimingConfig cfg;
+    const Cache* icache;
+    const Cache* dcache;
+
+    uint64_t now; // cycle the last instruction issued
+    uint64_t retired;
+    std::array<Ready, 32> r, v;
+    Ready flags;
+    uint64_t matrixFree;
+
+    // the instruction in flight, between begin() and end()
+    isa::Opcode op;
+    uint32_t scalarIn, vectorIn, scalarOut, vectorOut;
+    bool readsFlags, writesFlags, loads, redirected;
+    uint64_t fetchMissesBefore, dataMissesBefore;
+
+    std::unordered_map<uint64_t, BlockTiming> byBlock;
+    BlockTiming* block;
+    uint64_t nextPC;
+    bool blockEnds;
+};
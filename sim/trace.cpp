@@ -1,52 +1,525 @@
 #include "trace.h"
 
-#include <fmt/ostream.h>
+#include <algorithm>
+#include <csignal>
+#include <cstring>
+#include <sstream>
+
+#include <fmt/compile.h>
+#include <fmt/format.h>
 
 #include <morph/decoder.h>
 
+#include "lz.h"
+
 #define INDENT "    "
 
-std::ostream& operator<<(std::ostream& os, const InstructionTrace& trace) {
-    fmt::print(os, "*** {:#x}: {:#x} ***\n", trace.pc, trace.ir);
-    os << "    inputs:";
-    for (auto& s : trace.inputs)
-        os << " " << s;
-    os << '\n';
+// compiled format strings: the runtime-parsed kind cost several times as
+// much, which adds up over every field of every instruction
+#define FORMAT(out, f, ...)                                                    \
+    fmt::format_to(std::back_inserter(out), FMT_COMPILE(f), __VA_ARGS__)
+
+using Out = fmt::memory_buffer;
+
+static void append(Out& out, std::string_view s) {
+    out.append(s.data(), s.data() + s.size());
+}
+
+static void formatVec(Out& out, const float (&v)[4]) {
+    // same as f32x4's operator<<
+    FORMAT(out, "({},{},{},{})", v[0], v[1], v[2], v[3]);
+}
+
+static void formatOperand(Out& out, const TraceRecord::Operand& op) {
+    using Kind = TraceRecord::Operand::Kind;
+    auto name = std::string_view(op.name, 2);
+
+    switch (op.kind) {
+    case Kind::Imm:
+        FORMAT(out, "imm={}", op.imm);
+        break;
+    case Kind::Swizzle:
+        FORMAT(out, "i0={} i1={} i2={} i3={}", op.lanes[0], op.lanes[1],
+               op.lanes[2], op.lanes[3]);
+        break;
+    case Kind::Scalar:
+        FORMAT(out, "{}=r{}={:#x}", name, op.idx, op.scalar);
+        break;
+    case Kind::Vector:
+        FORMAT(out, "{}=v{}=", name, op.idx);
+        formatVec(out, op.vec);
+        break;
+    case Kind::None:
+        break;
+    }
+}
+
+static void formatScalarMem(Out& out, std::string_view what,
+                            const TraceRecord::MemAccess& m) {
+    using Kind = TraceRecord::MemAccess::Kind;
+    if (m.kind == Kind::Scalar32 || m.kind == Kind::Scalar36)
+        FORMAT(out, INDENT "scalar_{}: {} : {:#x} = {:#x}\n", what,
+               m.kind == Kind::Scalar32 ? 32 : 36, m.addr, m.scalar);
+}
+
+static void formatVectorMem(Out& out, std::string_view what,
+                            const TraceRecord::MemAccess& m) {
+    if (m.kind != TraceRecord::MemAccess::Kind::Vector)
+        return;
+    FORMAT(out, INDENT "vector_{}: {:#x} = ", what, m.addr);
+    formatVec(out, m.vec);
+    out.push_back('\n');
+}
 
-    if (trace.vectorMask)
-        fmt::print(os, INDENT "vector_mask: {:#b}\n", trace.vectorMask->raw());
+static auto condName(uint8_t cond) -> std::string_view {
+    switch (condition_t(cond)) {
+    case condition_t::nz:
+        return "nz";
+    case condition_t::ez:
+        return "ez";
+    case condition_t::lz:
+        return "lz";
+    case condition_t::gz:
+        return "gz";
+    case condition_t::le:
+        return "le";
+    case condition_t::ge:
+        return "ge";
+    }
+    return "";
+}
+
+void TraceTextFormatter::format(const TraceRecord& rec, Out& out) {
+    using OpKind = TraceRecord::Operand::Kind;
 
-    if (trace.condcode)
-        os << INDENT "branch_condition_code: " << *trace.condcode << '\n';
+    FORMAT(out, "*** {:#x}: {:#x} ***\n", rec.pc, rec.ir);
+    append(out, INDENT "inputs:");
+    for (size_t i = 0; i < rec.nInputs; i++) {
+        out.push_back(' ');
+        formatOperand(out, rec.inputs[i]);
+    }
+    out.push_back('\n');
 
-    if (trace.controlFlow)
-        os << INDENT "control_flow: " << *trace.controlFlow << '\n';
+    if (rec.present & TraceRecord::VectorMask)
+        FORMAT(out, INDENT "vector_mask: {:#b}\n", rec.vectorMask);
 
-    if (trace.flagsWriteback)
-        os << INDENT "flag_writeback: " << *trace.flagsWriteback << '\n';
+    if (rec.present & TraceRecord::Condcode)
+        FORMAT(out, INDENT "branch_condition_code: {}\n",
+               condName(rec.condcode));
 
-    if (trace.scalarRegOutput)
-        os << INDENT "scalar_writeback: " << *trace.scalarRegOutput << '\n';
+    if (rec.present & TraceRecord::ControlFlow)
+        FORMAT(out,
+               INDENT "control_flow: taken={} taken_addr={:#x} "
+                      "not_taken_addr={:#x}\n",
+               rec.taken, rec.takenAddr, rec.notTakenAddr);
 
-    if (trace.vectorRegOutput)
-        os << INDENT "vector_writeback: " << *trace.vectorRegOutput << '\n';
+    if (rec.present & TraceRecord::Flags)
+        FORMAT(out, INDENT "flag_writeback: {}{}{}\n",
+               rec.flags & 1 ? "Z" : "", rec.flags & 2 ? "S" : "",
+               rec.flags & 4 ? "O" : "");
 
-    if (trace.scalarLoad)
-        os << INDENT "scalar_load: " << *trace.scalarLoad << '\n';
+    if (rec.scalarOutput.kind != OpKind::None) {
+        append(out, INDENT "scalar_writeback: ");
+        formatOperand(out, rec.scalarOutput);
+        out.push_back('\n');
+    }
 
-    if (trace.scalarStore)
-        os << INDENT "scalar_store: " << *trace.scalarStore << '\n';
+    if (rec.vectorOutput.kind != OpKind::None) {
+        append(out, INDENT "vector_writeback: ");
+        formatOperand(out, rec.vectorOutput);
+        out.push_back('\n');
+    }
 
-    if (trace.vectorLoad)
-        os << INDENT "vector_load: " << *trace.vectorLoad << '\n';
+    formatScalarMem(out, "load", rec.load);
+    formatScalarMem(out, "store", rec.store);
+    formatVectorMem(out, "load", rec.load);
+    formatVectorMem(out, "store", rec.store);
 
-    if (trace.vectorStore)
-        os << INDENT "vector_store: " << *trace.vectorStore << '\n';
+    append(out, INDENT "asm: ");
+    append(out, disassemble(rec.ir));
+    append(out, "\n\n\n");
+}
 
-    os << "    asm: ";
+auto TraceTextFormatter::disassemble(uint32_t ir) -> const std::string& {
+    // bounded, in case the program keeps generating new code
+    if (disasm.size() > (1 << 16))
+        disasm.clear();
+
+    if (auto at = disasm.find(ir); at != disasm.end())
+        return at->second;
+
+    std::ostringstream os;
     isa::PrintVisitor printvis(os);
-    isa::decodeInstruction(printvis, bits<32>(trace.ir));
-    os << '\n';
+    isa::decodeInstruction(printvis, bits<32>(ir));
+    return disasm.emplace(ir, os.str()).first->second;
+}
+
+TraceWriter::TraceWriter(const std::string& filename)
+    : filename{filename}, buf(BUFFER_SIZE),
+      out(filename, std::ios::binary | std::ios::trunc) {
+    if (!out.is_open())
+        throw std::runtime_error(
+            fmt::format("can't open tracefile `{}`", filename));
+    setp(buf.data(), buf.data() + buf.size());
+}
+
+void TraceWriter::write(const char* data, std::streamsize n) {
+    if (sputn(data, n) != n)
+        failed();
+}
+
+void TraceWriter::flush() {
+    if (!writeOut())
+        failed();
+}
+
+auto TraceWriter::writeOut() -> bool {
+    out.write(pbase(), pptr() - pbase());
+    flushed += pptr() - pbase();
+    out.flush();
+    setp(buf.data(), buf.data() + buf.size());
+    return static_cast<bool>(out);
+}
+
+void TraceWriter::failed() const {
+    throw std::runtime_error(
+        fmt::format("can't write tracefile `{}`", filename));
+}
+
+auto TraceWriter::overflow(int_type c) -> int_type {
+    if (!writeOut())
+        return traits_type::eof();
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+    }
+    return traits_type::not_eof(c);
+}
+
+auto TraceWriter::sync() -> int { return writeOut() ? 0 : -1; }
+
+TraceSink::TraceSink(const std::string& filename, TraceFormat format)
+    : format{format}, writer(filename) {
+    if (format != TraceFormat::Text) {
+        TraceFileHeader header{};
+        std::copy_n(TraceFileHeader::MAGIC, 4, header.magic);
+        header.version = TraceFileHeader::VERSION;
+        header.recordSize = sizeof(TraceRecord);
+        if (format == TraceFormat::Compressed)
+            header.flags = TraceFileHeader::COMPRESSED;
+        writer.write(reinterpret_cast<const char*>(&header), sizeof header);
+    }
+    if (format == TraceFormat::Compressed) {
+        block.reserve(TraceBlock::RECORDS);
+        packed.resize(lz::bound(TraceBlock::RECORDS * sizeof(TraceRecord)));
+    }
+}
+
+TraceSink::~TraceSink() {
+    try {
+        close();
+    } catch (const std::runtime_error&) {
+        // whoever wanted to know called close() themselves
+    }
+}
+
+void TraceSink::write(const TraceRecord& rec) {
+    switch (format) {
+    case TraceFormat::Binary:
+        writer.write(reinterpret_cast<const char*>(&rec), sizeof rec);
+        break;
+    case TraceFormat::Compressed:
+        block.push_back(rec);
+        if (block.size() == TraceBlock::RECORDS)
+            writeBlock();
+        break;
+    case TraceFormat::Text:
+        text.clear();
+        formatter.format(rec, text);
+        writer.write(text.data(), static_cast<std::streamsize>(text.size()));
+        break;
+    }
+}
+
+void TraceSink::flush() {
+    // a short block costs a little compression, but the records it has
+    // need to be readable
+    if (format == TraceFormat::Compressed)
+        writeBlock();
+    writer.flush();
+}
+
+void TraceSink::close() {
+    if (closed)
+        return;
+    closed = true;
+
+    if (format == TraceFormat::Compressed) {
+        writeBlock();
+        writer.write(reinterpret_cast<const char*>(index.data()),
+                     static_cast<std::streamsize>(index.size() *
+                                                  sizeof(TraceIndex::Entry)));
+        TraceIndex::Footer footer{};
+        footer.nBlocks = index.size();
+        footer.nRecords = nRecords;
+        std::copy_n(TraceIndex::MAGIC, 4, footer.magic);
+        writer.write(reinterpret_cast<const char*>(&footer), sizeof footer);
+    }
+    writer.flush();
+}
+
+void TraceSink::writeBlock() {
+    if (block.empty())
+        return;
+
+    index.push_back({writer.offset(), nRecords});
+    TraceBlock header{};
+    header.nRecords = static_cast<uint32_t>(block.size());
+    header.compressedSize = static_cast<uint32_t>(
+        lz::compress(reinterpret_cast<const uint8_t*>(block.data()),
+                     block.size() * sizeof(TraceRecord), packed.data()));
+    writer.write(reinterpret_cast<const char*>(&header), sizeof header);
+    writer.write(reinterpret_cast<const char*>(packed.data()),
+                 header.compressedSize);
+
+    nRecords += block.size();
+    block.clear();
+}
+
+TraceReader::TraceReader(const std::string& filename)
+    : in(filename, std::ios::binary) {
+    if (!in.is_open())
+        throw std::runtime_error(fmt::format("can't open `{}`", filename));
+
+    TraceFileHeader header{};
+    in.read(reinterpret_cast<char*>(&header), sizeof header);
+    if (!in || std::memcmp(header.magic, TraceFileHeader::MAGIC, 4) != 0)
+        throw std::runtime_error(
+            fmt::format("`{}` isn't a binary tracefile", filename));
+    // version 1 is the same, less the flags
+    if ((header.version != 1 && header.version != TraceFileHeader::VERSION) ||
+        header.recordSize != sizeof(TraceRecord) ||
+        (header.flags & ~TraceFileHeader::COMPRESSED))
+        throw std::runtime_error(fmt::format(
+            "`{}` is trace version {} ({}-byte records, flags {:#x}); this "
+            "build reads version {} ({}-byte records)",
+            filename, header.version, header.recordSize, header.flags,
+            TraceFileHeader::VERSION, sizeof(TraceRecord)));
+    compressed = header.flags & TraceFileHeader::COMPRESSED;
+
+    in.seekg(0, std::ios::end);
+    uint64_t fileSize = in.tellg();
+
+    if (!compressed) {
+        auto bytes = fileSize - sizeof header;
+        nRecords = bytes / sizeof(TraceRecord);
+        cutShort = bytes % sizeof(TraceRecord) != 0;
+        seek(0);
+        return;
+    }
+
+    TraceIndex::Footer footer{};
+    bool indexed = false;
+    if (fileSize >= sizeof header + sizeof footer) {
+        in.seekg(fileSize - sizeof footer);
+        in.read(reinterpret_cast<char*>(&footer), sizeof footer);
+        auto indexSize = footer.nBlocks * sizeof(TraceIndex::Entry);
+        indexed = in &&
+                  std::memcmp(footer.magic, TraceIndex::MAGIC, 4) == 0 &&
+                  indexSize <= fileSize - sizeof header - sizeof footer;
+        if (indexed) {
+            index.resize(footer.nBlocks);
+            in.seekg(fileSize - sizeof footer - indexSize);
+            in.read(reinterpret_cast<char*>(index.data()),
+                    static_cast<std::streamsize>(indexSize));
+            indexed = bool(in);
+            nRecords = footer.nRecords;
+        }
+    }
+    if (!indexed)
+        scanBlocks(fileSize);
+
+    block.reserve(TraceBlock::RECORDS);
+    seek(0);
+}
+
+/// rebuilds the index of a compressed trace that doesn't have one
+void TraceReader::scanBlocks(uint64_t fileSize) {
+    index.clear();
+    in.clear();
+    uint64_t offset = sizeof(TraceFileHeader);
+    nRecords = 0;
+    while (offset < fileSize) {
+        TraceBlock header{};
+        in.seekg(offset);
+        in.read(reinterpret_cast<char*>(&header), sizeof header);
+        if (!in || header.nRecords == 0 ||
+            header.nRecords > TraceBlock::RECORDS ||
+            offset + sizeof header + header.compressedSize > fileSize) {
+            cutShort = true;
+            break;
+        }
+        index.push_back({offset, nRecords});
+        nRecords += header.nRecords;
+        offset += sizeof header + header.compressedSize;
+    }
+    in.clear();
+}
+
+void TraceReader::seek(uint64_t record) { pos = std::min(record, nRecords); }
+
+auto TraceReader::read(TraceRecord* out, size_t n) -> size_t {
+    n = static_cast<size_t>(std::min<uint64_t>(n, nRecords - pos));
+
+    if (!compressed) {
+        in.seekg(sizeof(TraceFileHeader) + pos * sizeof(TraceRecord));
+        in.read(reinterpret_cast<char*>(out),
+                static_cast<std::streamsize>(n * sizeof(TraceRecord)));
+        if (!in)
+            throw std::runtime_error("tracefile read failed");
+        pos += n;
+        return n;
+    }
+
+    size_t done = 0;
+    while (done < n) {
+        // last block starting at or before pos
+        auto it = std::upper_bound(
+            index.begin(), index.end(), pos,
+            [](uint64_t r, const TraceIndex::Entry& e) {
+                return r < e.firstRecord;
+            });
+        auto idx = static_cast<size_t>(it - index.begin()) - 1;
+        loadBlock(idx);
+
+        auto skip = pos - index[idx].firstRecord;
+        if (skip >= block.size())
+            throw std::runtime_error("tracefile index doesn't match blocks");
+        auto count = std::min<size_t>(n - done, block.size() - skip);
+        std::copy_n(block.begin() + skip, count, out + done);
+        done += count;
+        pos += count;
+    }
+    return done;
+}
+
+void TraceReader::loadBlock(size_t idx) {
+    if (idx == blockIdx)
+        return;
+
+    TraceBlock header{};
+    in.seekg(index[idx].offset);
+    in.read(reinterpret_cast<char*>(&header), sizeof header);
+    if (!in || header.nRecords > TraceBlock::RECORDS)
+        throw std::runtime_error("corrupt tracefile block header");
+    packed.resize(header.compressedSize);
+    in.read(reinterpret_cast<char*>(packed.data()), header.compressedSize);
+    if (!in)
+        throw std::runtime_error("tracefile read failed");
+
+    block.resize(header.nRecords);
+    lz::decompress(packed.data(), packed.size(),
+                   reinterpret_cast<uint8_t*>(block.data()),
+                   block.size() * sizeof(TraceRecord));
+    blockIdx = idx;
+}
+
+AsyncTraceSink::AsyncTraceSink(TraceSink& sink)
+    : sink{sink}, writer([this] { run(); }) {}
+
+AsyncTraceSink::~AsyncTraceSink() {
+    waitForWriter(0);
+    stopping.store(true, std::memory_order_release);
+    wakeWriter();
+    writer.join();
+    try {
+        sink.flush();
+    } catch (const std::runtime_error&) {
+        // drain() is where the simulator hears about it
+    }
+}
+
+void AsyncTraceSink::drain() {
+    waitForWriter(0);
+    if (failed.load(std::memory_order_acquire))
+        std::rethrow_exception(error);
+    sink.flush();
+}
+
+void AsyncTraceSink::pushFull(const TraceRecord& rec) {
+    // let the writer get a good way ahead, rather than waking up for
+    // every record it frees
+    while (!ring.push(rec))
+        waitForWriter(RING_SIZE - WAKE_AT);
+}
+
+/// sleeps until there are at most `queued` records in the ring
+void AsyncTraceSink::waitForWriter(size_t queued) {
+    auto done = [&] { return ring.size() <= queued; };
+
+    while (!done()) {
+        auto seen = simulatorSignal.load(std::memory_order_acquire);
+        simulatorAsleep.store(true, std::memory_order_relaxed);
+        // pairs with the fence in run(): either we see the ring drained, or
+        // the writer sees we're asleep
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        wakeWriter();
+        if (!done())
+            simulatorSignal.wait(seen, std::memory_order_acquire);
+        simulatorAsleep.store(false, std::memory_order_relaxed);
+    }
+}
+
+void AsyncTraceSink::wakeWriter() {
+    writerSignal.fetch_add(1, std::memory_order_release);
+    writerSignal.notify_one();
+}
+
+void AsyncTraceSink::wakeSimulator() {
+    simulatorSignal.fetch_add(1, std::memory_order_release);
+    simulatorSignal.notify_one();
+}
+
+void AsyncTraceSink::run() {
+    // SIGINT is for the simulator thread's handler
+    sigset_t all;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, nullptr);
+
+    while (true) {
+        while (auto* rec = ring.front()) {
+            if (!failed.load(std::memory_order_relaxed)) {
+                try {
+                    sink.write(*rec);
+                } catch (...) {
+                    error = std::current_exception();
+                    failed.store(true, std::memory_order_release);
+                }
+            }
+            ring.pop();
+            if (simulatorAsleep.load(std::memory_order_relaxed) &&
+                ring.size() <= RING_SIZE - WAKE_AT &&
+                simulatorAsleep.exchange(false, std::memory_order_relaxed))
+                wakeSimulator();
+        }
+
+        auto seen = writerSignal.load(std::memory_order_acquire);
+        writerAsleep.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (simulatorAsleep.exchange(false, std::memory_order_relaxed))
+            wakeSimulator();
+        if (ring.empty()) {
+            if (stopping.load(std::memory_order_acquire))
+                break;
+            writerSignal.wait(seen, std::memory_order_acquire);
+        }
+        writerAsleep.store(false, std::memory_order_relaxed);
+    }
+}
 
-    return os;
+FileTracer::FileTracer(const std::string& filename, TraceFormat format,
+                       bool async, TraceFilter filter)
+    : filter{std::move(filter)}, rec{}, sink(filename, format) {
+    if (async)
+        this->async = std::make_unique<AsyncTraceSink>(sink);
 }
@@ -1,13 +1,26 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
+#include <exception>
 #include <fstream>
 #include <iostream>
-#include <optional>
+#include <memory>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+#include <fmt/format.h>
+
 #include "cpu.h"
+#include "ring.h"
+#include <morph/opcodes.h>
 #include <morph/ty.h>
+#include <morph/util.h>
 
 struct Tracer {
     virtual ~Tracer() = default;
@@ -51,13 +64,15 @@ struct Tracer {
     virtual void memReadVec(uint64_t addr, f32x4 val) = 0;
 };
 
-struct NullTracer : public Tracer {
+struct NullTracer final : public Tracer {
     virtual ~NullTracer() = default;
 
     void begin(uint64_t pc, uint64_t ir) override {}
 
     void end() override {}
 
+    void flush() {}
+
     void vectorMask(vmask_t mask) override {}
     void immInput(int64_t imm) override {}
     void branchCondcode(condition_t cond) override {}
@@ -82,124 +97,511 @@ struct NullTracer : public Tracer {
     void memReadVec(uint64_t addr, f32x4 val) override {}
 };
 
-struct InstructionTrace {
+/**
+ * One instruction's worth of trace, in the fixed-size plain-data layout
+ * binary tracefiles store it in. Rendering it (see operator<< below) gives
+ * the text format from docs/trace.md.
+ */
+struct TraceRecord {
+    static constexpr size_t MAX_INPUTS = 4;
+
+    /// a register or immediate read by the instruction, or a register it
+    /// wrote back
+    struct Operand {
+        enum class Kind : uint8_t { None, Imm, Swizzle, Scalar, Vector };
+
+        Kind kind;
+        char name[2]; // "rD", "vA", ...; unused for Imm/Swizzle
+        uint8_t idx;
+        union {
+            int64_t imm;
+            uint64_t scalar;
+            float vec[4];
+            uint8_t lanes[4];
+        };
+    };
+
+    struct MemAccess {
+        enum class Kind : uint8_t { None, Scalar32, Scalar36, Vector };
+
+        Kind kind;
+        uint64_t addr;
+        union {
+            uint64_t scalar;
+            float vec[4];
+        };
+    };
+
+    // which of the optional fields below are set
+    enum Present : uint8_t {
+        VectorMask = 1 << 0,
+        Condcode = 1 << 1,
+        Flags = 1 << 2,
+        ControlFlow = 1 << 3,
+    };
+
     uint64_t pc;
-    uint64_t ir;
-    std::vector<std::string> inputs;
-    std::optional<condition_t> condcode;
-    std::optional<std::string> scalarRegOutput;
-    std::optional<std::string> vectorRegOutput;
-    std::optional<vmask_t> vectorMask;
-    std::optional<condition_t> branchConditionCode;
-    std::optional<ConditionFlags> flagsWriteback;
-    std::optional<std::string> controlFlow;
-
-    std::optional<std::string> scalarLoad, scalarStore, vectorLoad, vectorStore;
-
-    friend std::ostream& operator<<(std::ostream& os,
-                                    const InstructionTrace& trace);
+    uint32_t ir;
+    uint8_t present;
+    uint8_t nInputs;
+    uint8_t vectorMask;
+    uint8_t condcode;
+    uint8_t flags; // Z, S, O from bit 0 up
+    uint8_t taken;
+    uint64_t takenAddr, notTakenAddr;
+
+    Operand inputs[MAX_INPUTS];
+    Operand scalarOutput, vectorOutput;
+    MemAccess load, store;
+};
+
+static_assert(std::is_trivially_copyable_v<TraceRecord>);
+
+/**
+ * Renders TraceRecords in the text format from docs/trace.md, one
+ * instruction followed by a blank line at a time. Formats into a buffer
+ * rather than through iostreams, and keeps the disassembly of every
+ * instruction word it's seen, which is where most of the time would go.
+ */
+class TraceTextFormatter {
+  public:
+    void format(const TraceRecord& rec, fmt::memory_buffer& out);
+
+  private:
+    auto disassemble(uint32_t ir) -> const std::string&;
+
+    std::unordered_map<uint32_t, std::string> disasm;
+};
+
+/**
+ * Starts every binary tracefile. Then either back-to-back TraceRecords or,
+ * if COMPRESSED, TraceBlocks and a TraceIndex.
+ */
+struct TraceFileHeader {
+    static constexpr char MAGIC[4] = {'M', 'T', 'R', 'C'};
+    // 2 added `flags`, which used to be reserved
+    static constexpr uint32_t VERSION = 2;
+    static constexpr uint32_t COMPRESSED = 1;
+
+    char magic[4];
+    uint32_t version;
+    uint32_t recordSize;
+    uint32_t flags;
+};
+
+/**
+ * Up to RECORDS records, compressed together with lz::compress. Blocks
+ * stand alone, so any one can be decompressed without the rest.
+ */
+struct TraceBlock {
+    static constexpr uint32_t RECORDS = 1024; // 256KiB uncompressed
+
+    uint32_t compressedSize; // of what follows
+    uint32_t nRecords;
+};
+
+/**
+ * Ends a compressed tracefile: where every block is, so readers can seek
+ * straight to an instruction. A trace cut short (e.g. by a crash) has no
+ * index, but its blocks can still be found by walking them from the start.
+ */
+struct TraceIndex {
+    static constexpr char MAGIC[4] = {'M', 'T', 'R', 'I'};
+
+    struct Entry {
+        uint64_t offset; // of the TraceBlock in the file
+        uint64_t firstRecord;
+    };
+
+    // follows the entries
+    struct Footer {
+        uint64_t nBlocks;
+        uint64_t nRecords;
+        char magic[4];
+        uint32_t reserved;
+    };
 };
 
-struct FileTracer : public Tracer {
+/**
+ * Streambuf over a file with a large buffer of its own, so tracing doesn't
+ * pay for a write (or a flush) per instruction.
+ */
+class TraceWriter : public std::streambuf {
+  public:
+    static constexpr size_t BUFFER_SIZE = 1 << 20;
+
+    explicit TraceWriter(const std::string& filename);
+    // too late to report anything: flush() first to hear about errors
+    ~TraceWriter() override { writeOut(); }
+
+    TraceWriter(const TraceWriter&) = delete;
+    TraceWriter& operator=(const TraceWriter&) = delete;
+
+    /// throws std::runtime_error if the file can't take it, e.g. disk full
+    void write(const char* data, std::streamsize n);
+    void flush();
+
+    /// bytes written so far, including ones still in the buffer
+    auto offset() const -> uint64_t { return flushed + (pptr() - pbase()); }
+
+  protected:
+    auto overflow(int_type c) -> int_type override;
+    auto sync() -> int override;
+
+  private:
+    /// @return whether the file took everything buffered
+    auto writeOut() -> bool;
+    [[noreturn]] void failed() const;
+
+    std::string filename;
+    std::vector<char> buf;
+    std::ofstream out;
+    uint64_t flushed = 0;
+};
+
+enum class TraceFormat { Text, Binary, Compressed };
+
+/**
+ * The end of the line for TraceRecords: writes the binary header up front,
+ * then each record either as-is, rendered as text, or into compressed
+ * blocks.
+ */
+class TraceSink {
+  public:
+    TraceSink(const std::string& filename, TraceFormat format);
+    /// close()s, if nobody did, but can't report errors
+    ~TraceSink();
+
+    // all of these throw std::runtime_error if the file can't be written
+    void write(const TraceRecord& rec);
+    void flush();
+    /// flushes, and for compressed traces writes the last block and the index
+    void close();
+
+  private:
+    void writeBlock();
+
+    TraceFormat format;
+    TraceWriter writer;
+    TraceTextFormatter formatter;
+    fmt::memory_buffer text;
+
+    // compressed traces
+    std::vector<TraceRecord> block;
+    std::vector<uint8_t> packed;
+    std::vector<TraceIndex::Entry> index;
+    uint64_t nRecords = 0;
+    bool closed = false;
+};
+
+/**
+ * Reads binary tracefiles, compressed or not, from any record on.
+ * Compressed traces only decompress the block being read.
+ */
+class TraceReader {
+  public:
+    /// throws std::runtime_error if `filename` isn't a tracefile we can read
+    explicit TraceReader(const std::string& filename);
+
+    /// records in the trace
+    auto size() const -> uint64_t { return nRecords; }
+    /// whether a compressed trace lost its end (it had no index, and its
+    /// last block was cut short), in which case size() is what's left
+    auto truncated() const -> bool { return cutShort; }
+
+    void seek(uint64_t record);
+    /**
+     * Reads up to `n` records from the current one on.
+     * @return how many were read: fewer than `n` only at the end
+     */
+    auto read(TraceRecord* out, size_t n) -> size_t;
+
+  private:
+    void scanBlocks(uint64_t fileSize);
+    void loadBlock(size_t idx);
+
+    std::ifstream in;
+    bool compressed;
+    bool cutShort = false;
+    uint64_t nRecords;
+    uint64_t pos = 0;
+
+    // compressed traces
+    std::vector<TraceIndex::Entry> index;
+    std::vector<TraceRecord> block;
+    std::vector<uint8_t> packed;
+    size_t blockIdx = SIZE_MAX; // which one `block` holds
+};
+
+/**
+ * Feeds a TraceSink from a thread of its own, so formatting and I/O overlap
+ * with simulation instead of holding it up. The simulator only copies each
+ * record into a ring; once the ring is full, push() waits for the writer to
+ * catch up rather than dropping anything.
+ *
+ * Either thread sleeps when it has nothing to do. To keep push() free of
+ * fences, the simulator only checks for a sleeping writer opportunistically
+ * and wakes it for real once there's a batch waiting, when the ring fills,
+ * or on drain(). Records pushed since the last of those may sit in the ring
+ * until the next one (e.g. while stopped in the debugger), hence drain().
+ */
+class AsyncTraceSink {
+  public:
+    static constexpr size_t RING_SIZE = 1 << 12; // 1MiB, so it stays in cache
+    static constexpr size_t WAKE_AT = RING_SIZE / 4;
+
+    /// `sink` is the writer thread's while records are queued; drain() takes
+    /// it back once the ring is empty
+    explicit AsyncTraceSink(TraceSink& sink);
+    /// writes out everything pushed, then stops the writer thread
+    ~AsyncTraceSink();
+
+    AsyncTraceSink(const AsyncTraceSink&) = delete;
+    AsyncTraceSink& operator=(const AsyncTraceSink&) = delete;
+
+    void push(const TraceRecord& rec) {
+        if (!ring.push(rec)) [[unlikely]]
+            return pushFull(rec);
+        if (writerAsleep.load(std::memory_order_relaxed)) [[unlikely]]
+            if (ring.size() >= WAKE_AT &&
+                writerAsleep.exchange(false, std::memory_order_relaxed))
+                wakeWriter();
+    }
+
+    /**
+     * Waits until everything pushed so far is in the file, and rethrows
+     * anything the writer thread died of.
+     */
+    void drain();
+
+  private:
+    void run();
+    void pushFull(const TraceRecord& rec);
+    void waitForWriter(size_t queued);
+    void wakeWriter();
+    void wakeSimulator();
+
+    TraceSink& sink;
+    SpscRing<TraceRecord, RING_SIZE> ring;
+
+    // bumped (and notified) to wake the thread waiting on it
+    std::atomic<uint32_t> writerSignal{0};
+    std::atomic<uint32_t> simulatorSignal{0};
+    std::atomic<bool> writerAsleep{false};
+    std::atomic<bool> simulatorAsleep{false};
+    std::atomic<bool> stopping{false};
+
+    // set by the writer thread, which then throws away whatever it's sent
+    std::exception_ptr error;
+    std::atomic<bool> failed{false};
+
+    // last, so everything it uses exists by the time it starts
+    std::thread writer;
+};
+
+/**
+ * Which instructions make it into a trace. All of these have to match; the
+ * defaults match everything.
+ */
+struct TraceFilter {
+    /// [first, last) PC ranges, any of which matches. empty matches any PC
+    std::vector<std::pair<uint64_t, uint64_t>> pcs;
+    /// bit per isa::Category
+    uint32_t categories = ~0u;
+    /// [first, last) window of executed instructions, counting from 0
+    uint64_t first = 0;
+    uint64_t last = UINT64_MAX;
+
+    auto matches(uint64_t n, uint64_t pc, uint32_t ir) const -> bool {
+        if (n < first || n >= last)
+            return false;
+        auto category = isa::opcodeInfo[isa::opcodeOf(bits<32>(ir))].category;
+        if (!(categories & (1u << static_cast<unsigned>(category))))
+            return false;
+        if (pcs.empty())
+            return true;
+        for (auto [lo, hi] : pcs)
+            if (pc >= lo && pc < hi)
+                return true;
+        return false;
+    }
+};
+
+struct FileTracer final : public Tracer {
     virtual ~FileTracer() = default;
 
-    explicit FileTracer(const std::string& filename)
-        : itrace{}, out(filename, std::ios::trunc) {}
+    /**
+     * @param async format and write from a separate thread (see
+     * AsyncTraceSink)
+     */
+    FileTracer(const std::string& filename, TraceFormat format,
+               bool async = false, TraceFilter filter = {});
 
     void begin(uint64_t pc, uint64_t ir) override {
-        itrace.pc = pc;
-        itrace.ir = ir;
-        itrace.inputs.clear();
-        itrace.scalarRegOutput.reset();
-        itrace.vectorRegOutput.reset();
-        itrace.condcode.reset();
-        itrace.vectorMask.reset();
-        itrace.branchConditionCode.reset();
-        itrace.flagsWriteback.reset();
-        itrace.controlFlow.reset();
-
-        itrace.scalarLoad.reset();
-        itrace.scalarStore.reset();
-        itrace.vectorLoad.reset();
-        itrace.vectorStore.reset();
+        // filtered-out instructions still have their record filled in (the
+        // proxy doesn't know), but never formatted or written
+        selected = filter.matches(executed++, pc, static_cast<uint32_t>(ir));
+        if (!selected) {
+            rec.nInputs = 0;
+            return;
+        }
+        rec = TraceRecord{};
+        rec.pc = pc;
+        rec.ir = static_cast<uint32_t>(ir);
     }
 
     void end() override {
-        out << itrace << "\n\n";
-        out.flush();
+        if (!selected)
+            return;
+        if (async)
+            async->push(rec);
+        else
+            sink.write(rec);
+    }
+
+    /// get everything so far onto disk, e.g. before dying on an exception
+    void flush() {
+        if (async)
+            async->drain();
+        else
+            sink.flush();
+    }
+
+    /// writes the rest of the trace, once the program's done
+    void close() {
+        flush();
+        sink.close();
     }
 
     // -- const inputs
     void immInput(int64_t imm) override {
-        itrace.inputs.push_back(fmt::format("imm={}", imm));
+        auto& op = input(TraceRecord::Operand::Kind::Imm, nullptr, 0);
+        op.imm = imm;
+    }
+    void vectorMask(vmask_t mask) override {
+        rec.present |= TraceRecord::VectorMask;
+        rec.vectorMask = mask.inner;
+    }
+    void branchCondcode(condition_t cond) override {
+        rec.present |= TraceRecord::Condcode;
+        rec.condcode = static_cast<uint8_t>(cond);
     }
-    void vectorMask(vmask_t mask) override { itrace.vectorMask = mask; }
-    void branchCondcode(condition_t cond) override { itrace.condcode = cond; }
     void swizzleInput(vlaneidx_t i0, vlaneidx_t i1, vlaneidx_t i2,
                       vlaneidx_t i3) override {
-        itrace.inputs.push_back(fmt::format("i0={} i1={} i2={} i3={}", i0.raw(),
-                                            i1.raw(), i2.raw(), i3.raw()));
+        auto& op = input(TraceRecord::Operand::Kind::Swizzle, nullptr, 0);
+        op.lanes[0] = i0.inner;
+        op.lanes[1] = i1.inner;
+        op.lanes[2] = i2.inner;
+        op.lanes[3] = i3.inner;
     }
 
     // -- reg inputs
     void scalarRegInput(CPUState& cpu, const char* name,
                         reg_idx ridx) override {
-        itrace.inputs.push_back(
-            fmt::format("{}=r{}={:#x}", name, ridx.inner, cpu.r[ridx].raw()));
+        auto& op = input(TraceRecord::Operand::Kind::Scalar, name, ridx);
+        op.scalar = cpu.r[ridx].raw();
     }
     void vectorRegInput(CPUState& cpu, const char* name,
                         vreg_idx vidx) override {
-        itrace.inputs.push_back(
-            fmt::format("{}=v{}={}", name, vidx.inner, cpu.v[vidx]));
+        auto& op = input(TraceRecord::Operand::Kind::Vector, name, vidx);
+        setVec(op.vec, cpu.v[vidx]);
     }
 
     // -- writeback
     void scalarRegOutput(CPUState& cpu, const char* name,
                          reg_idx ridx) override {
-        itrace.scalarRegOutput = fmt::format("{}=r{}={:#x}", name, ridx.inner,
-                                             cpu.r[ridx], cpu.r[ridx].raw());
+        auto& op = rec.scalarOutput;
+        operand(op, TraceRecord::Operand::Kind::Scalar, name, ridx);
+        op.scalar = cpu.r[ridx].raw();
     }
     void vectorRegOutput(CPUState& cpu, const char* name,
                          vreg_idx vidx) override {
-        itrace.vectorRegOutput = fmt::format("{}=v{}={}", name, vidx.inner,
-                                             cpu.v[vidx], cpu.v[vidx]);
+        auto& op = rec.vectorOutput;
+        operand(op, TraceRecord::Operand::Kind::Vector, name, vidx);
+        setVec(op.vec, cpu.v[vidx]);
     }
 
     void flagsWriteback(ConditionFlags flags) override {
-        itrace.flagsWriteback = flags;
+        rec.present |= TraceRecord::Flags;
+        rec.flags = flags.zero | (flags.sign << 1) | (flags.overflow << 2);
     }
     void controlFlow(PC& pc) override {
-        itrace.controlFlow = fmt::format(
-            "taken={} taken_addr={:#x} not_taken_addr={:#x}",
-            pc.wasTaken() ? 1 : 0, pc.peekTaken(), pc.peekNotTaken());
+        rec.present |= TraceRecord::ControlFlow;
+        rec.taken = pc.wasTaken() ? 1 : 0;
+        rec.takenAddr = pc.peekTaken();
+        rec.notTakenAddr = pc.peekNotTaken();
     }
 
     // -- memory transactions
     void memWrite(uint64_t addr, u<32> val) override {
-        itrace.scalarStore = fmt::format("32 : {:#x} = {:#x}", addr, val.raw());
+        mem(rec.store, TraceRecord::MemAccess::Kind::Scalar32, addr).scalar =
+            val.raw();
     }
 
     void memWrite(uint64_t addr, u<36> val) override {
-        itrace.scalarStore = fmt::format("36 : {:#x} = {:#x}", addr, val.raw());
+        mem(rec.store, TraceRecord::MemAccess::Kind::Scalar36, addr).scalar =
+            val.raw();
     }
 
     void memWrite(uint64_t addr, f32x4 val) override {
-        itrace.vectorStore = fmt::format("{:#x} = {}", addr, val);
+        setVec(mem(rec.store, TraceRecord::MemAccess::Kind::Vector, addr).vec,
+               val);
     }
 
     void memRead32(uint64_t addr, uint32_t val) override {
-        itrace.scalarLoad = fmt::format("32 : {:#x} = {:#x}", addr, val);
+        mem(rec.load, TraceRecord::MemAccess::Kind::Scalar32, addr).scalar =
+            val;
     }
 
     void memRead36(uint64_t addr, uint64_t val) override {
-        itrace.scalarLoad = fmt::format("36 : {:#x} = {:#x}", addr, val);
+        mem(rec.load, TraceRecord::MemAccess::Kind::Scalar36, addr).scalar =
+            val;
     }
 
     void memReadVec(uint64_t addr, f32x4 val) override {
-        itrace.vectorLoad = fmt::format("{:#x} = {}", addr, val);
+        setVec(mem(rec.load, TraceRecord::MemAccess::Kind::Vector, addr).vec,
+               val);
     }
 
-  protected:
-    InstructionTrace itrace;
-    std::ofstream out;
+  private:
+    static void operand(TraceRecord::Operand& op,
+                        TraceRecord::Operand::Kind kind, const char* name,
+                        uint8_t idx) {
+        op.kind = kind;
+        if (name) {
+            op.name[0] = name[0];
+            op.name[1] = name[1];
+        }
+        op.idx = idx;
+    }
+
+    auto input(TraceRecord::Operand::Kind kind, const char* name, uint8_t idx)
+        -> TraceRecord::Operand& {
+        if (rec.nInputs == TraceRecord::MAX_INPUTS)
+            panic("too many trace inputs for one instruction");
+        auto& op = rec.inputs[rec.nInputs++];
+        operand(op, kind, name, idx);
+        return op;
+    }
+
+    static auto mem(TraceRecord::MemAccess& m,
+                    TraceRecord::MemAccess::Kind kind, uint64_t addr)
+        -> TraceRecord::MemAccess& {
+        m.kind = kind;
+        m.addr = addr;
+        return m;
+    }
+
+    static void setVec(float (&dst)[4], const f32x4& v) {
+        for (size_t lane = 0; lane < N_LANES; lane++)
+            dst[lane] = v[lane];
+    }
+
+    TraceFilter filter;
+    uint64_t executed = 0;
+    bool selected = false;
+    TraceRecord rec;
+    TraceSink sink;
+    // destroyed first, so it's done with `sink` by then
+    std::unique_ptr<AsyncTraceSink> async;
 };
@@ -0,0 +1,85 @@
+// renders a binary tracefile (`sim --trace-format binary` or `compressed`)
+// in the text format from docs/trace.md.
+#include <iostream>
+#include <vector>
+
+#include <argparse/argparse.hpp>
+#include <fmt/format.h>
+
+#include "trace.h"
+
+int main(int argc, char* argv[]) {
+    argparse::ArgumentParser ap("tracecat");
+    ap.add_argument("trace").help("binary tracefile");
+    ap.add_argument("-o", "--output")
+        .help("write here instead of stdout")
+        .metavar("OUT");
+    ap.add_argument("-s", "--start")
+        .help("skip to the Nth instruction (from 0). only decompresses "
+              "from the block it's in")
+        .metavar("N")
+        .default_value<uint64_t>(0)
+        .scan<'i', uint64_t>();
+    ap.add_argument("-n", "--count")
+        .help("stop after N instructions")
+        .metavar("N")
+        .scan<'i', uint64_t>();
+
+    try {
+        ap.parse_args(argc, argv);
+    } catch (const std::runtime_error& err) {
+        std::cerr << err.what() << std::endl;
+        std::cerr << ap;
+        return 1;
+    }
+
+    auto path = ap.get<std::string>("trace");
+    std::unique_ptr<TraceReader> reader;
+    try {
+        reader = std::make_unique<TraceReader>(path);
+    } catch (const std::runtime_error& err) {
+        fmt::print(stderr, "[!] {}\n", err.what());
+        return 1;
+    }
+
+    std::ios::sync_with_stdio(false);
+    std::unique_ptr<TraceWriter> file;
+    std::ostream out(std::cout.rdbuf());
+    if (auto outpath = ap.present<std::string>("--output")) {
+        file = std::make_unique<TraceWriter>(*outpath);
+        out.rdbuf(file.get());
+    }
+
+    auto start = ap.get<uint64_t>("--start");
+    auto left = ap.present<uint64_t>("--count").value_or(UINT64_MAX);
+    reader->seek(start);
+
+    TraceTextFormatter formatter;
+    fmt::memory_buffer text;
+    std::vector<TraceRecord> chunk(4096);
+    try {
+        while (left > 0) {
+            auto n = reader->read(chunk.data(),
+                                  std::min<uint64_t>(chunk.size(), left));
+            if (n == 0)
+                break;
+            left -= n;
+            text.clear();
+            for (size_t i = 0; i < n; i++)
+                formatter.format(chunk[i], text);
+            out.write(text.data(), static_cast<std::streamsize>(text.size()));
+        }
+    } catch (const std::runtime_error& err) {
+        out.flush();
+        fmt::print(stderr, "[!] `{}`: {}\n", path, err.what());
+        return 1;
+    }
+    out.flush();
+
+    if (reader->truncated() && left > 0) {
+        fmt::print(stderr, "[!] `{}` was cut short while being written\n",
+                   path);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,246 @@
+#include "x64.h"
+
+#include <cstring>
+
+#include <sys/mman.h>
+
+namespace x64 {
+
+void Assembler::rex(bool w, uint8_t reg, uint8_t base) {
+    uint8_t prefix = 0x40 | (w << 3) | ((reg >> 3) << 2) | (base >> 3);
+    if (prefix != 0x40)
+        buf.push_back(prefix);
+}
+
+void Assembler::modrm(uint8_t reg, Mem m) {
+    // mod=10: [base + disp32]
+    buf.push_back(0x80 | ((reg & 7) << 3) | (m.base & 7));
+    if ((m.base & 7) == rsp)
+        buf.push_back(0x24); // SIB, no index
+    imm32(static_cast<uint32_t>(m.disp));
+}
+
+void Assembler::modrm(uint8_t reg, Reg rm) {
+    buf.push_back(0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+void Assembler::imm32(uint32_t v) {
+    for (int i = 0; i < 4; i++)
+        buf.push_back((v >> (8 * i)) & 0xff);
+}
+
+void Assembler::push(Reg r) {
+    rex(false, 0, r);
+    buf.push_back(0x50 + (r & 7));
+}
+
+void Assembler::pop(Reg r) {
+    rex(false, 0, r);
+    buf.push_back(0x58 + (r & 7));
+}
+
+void Assembler::ret() { buf.push_back(0xc3); }
+
+void Assembler::call(Reg r) {
+    rex(false, 0, r);
+    buf.push_back(0xff);
+    modrm(2, r);
+}
+
+void Assembler::mov(Reg dst, Reg src) {
+    rex(true, src, dst);
+    buf.push_back(0x89);
+    modrm(src, dst);
+}
+
+void Assembler::mov(Reg dst, Mem src) {
+    rex(true, dst, src.base);
+    buf.push_back(0x8b);
+    modrm(dst, src);
+}
+
+void Assembler::mov(Mem dst, Reg src) {
+    rex(true, src, dst.base);
+    buf.push_back(0x89);
+    modrm(src, dst);
+}
+
+void Assembler::movImm64(Reg dst, uint64_t imm) {
+    rex(true, 0, dst);
+    buf.push_back(0xb8 + (dst & 7));
+    imm32(static_cast<uint32_t>(imm));
+    imm32(static_cast<uint32_t>(imm >> 32));
+}
+
+void Assembler::movImm32(Reg dst, int32_t imm) {
+    rex(true, 0, dst);
+    buf.push_back(0xc7);
+    modrm(0, dst);
+    imm32(static_cast<uint32_t>(imm));
+}
+
+void Assembler::movByte(Mem dst, uint8_t imm) {
+    rex(false, 0, dst.base);
+    buf.push_back(0xc6);
+    modrm(0, dst);
+    buf.push_back(imm);
+}
+
+void Assembler::mov32(Reg dst, Mem src) {
+    rex(false, dst, src.base);
+    buf.push_back(0x8b);
+    modrm(dst, src);
+}
+
+void Assembler::mov32(Mem dst, Reg src) {
+    rex(false, src, dst.base);
+    buf.push_back(0x89);
+    modrm(src, dst);
+}
+
+void Assembler::alu(AluOp op, Reg dst, Reg src) {
+    rex(true, src, dst);
+    // the r/m, reg forms are spaced 8 apart in the same order as the /digit
+    buf.push_back(0x01 + 8 * static_cast<uint8_t>(op));
+    modrm(src, dst);
+}
+
+void Assembler::alu(AluOp op, Reg dst, int32_t imm) {
+    rex(true, 0, dst);
+    buf.push_back(0x81);
+    modrm(static_cast<uint8_t>(op), dst);
+    imm32(static_cast<uint32_t>(imm));
+}
+
+void Assembler::imul(Reg dst, Reg src) {
+    rex(true, dst, src);
+    buf.push_back(0x0f);
+    buf.push_back(0xaf);
+    modrm(dst, src);
+}
+
+void Assembler::cmp(Reg lhs, Mem rhs) {
+    rex(true, lhs, rhs.base);
+    buf.push_back(0x3b);
+    modrm(lhs, rhs);
+}
+
+void Assembler::shift(ShiftOp op, Reg dst, uint8_t amount) {
+    rex(true, 0, dst);
+    buf.push_back(0xc1);
+    modrm(static_cast<uint8_t>(op), dst);
+    buf.push_back(amount);
+}
+
+void Assembler::shiftCl(ShiftOp op, Reg dst) {
+    rex(true, 0, dst);
+    buf.push_back(0xd3);
+    modrm(static_cast<uint8_t>(op), dst);
+}
+
+void Assembler::not_(Reg dst) {
+    rex(true, 0, dst);
+    buf.push_back(0xf7);
+    modrm(2, dst);
+}
+
+void Assembler::bt(Reg r, uint8_t bit) {
+    rex(true, 0, r);
+    buf.push_back(0x0f);
+    buf.push_back(0xba);
+    modrm(4, r);
+    buf.push_back(bit);
+}
+
+void Assembler::set(Cond cc, Mem dst) {
+    rex(false, 0, dst.base);
+    buf.push_back(0x0f);
+    buf.push_back(0x90 + static_cast<uint8_t>(cc));
+    modrm(0, dst);
+}
+
+void Assembler::testAl() {
+    buf.push_back(0x84);
+    buf.push_back(0xc0);
+}
+
+auto Assembler::jcc(Cond cc) -> size_t {
+    buf.push_back(0x0f);
+    buf.push_back(0x80 + static_cast<uint8_t>(cc));
+    size_t at = buf.size();
+    imm32(0);
+    return at;
+}
+
+auto Assembler::jmp() -> size_t {
+    buf.push_back(0xe9);
+    size_t at = buf.size();
+    imm32(0);
+    return at;
+}
+
+void Assembler::bind(size_t rel32At) {
+    auto rel = static_cast<uint32_t>(buf.size() - (rel32At + 4));
+    for (int i = 0; i < 4; i++)
+        buf[rel32At + i] = (rel >> (8 * i)) & 0xff;
+}
+
+void Assembler::movups(Xmm dst, Mem src) {
+    rex(false, dst, src.base);
+    buf.push_back(0x0f);
+    buf.push_back(0x10);
+    modrm(dst, src);
+}
+
+void Assembler::movups(Mem dst, Xmm src) {
+    rex(false, src, dst.base);
+    buf.push_back(0x0f);
+    buf.push_back(0x11);
+    modrm(src, dst);
+}
+
+void Assembler::packed(PackedOp op, Xmm dst, Xmm src) {
+    buf.push_back(0x0f);
+    buf.push_back(static_cast<uint8_t>(op));
+    buf.push_back(0xc0 | (dst << 3) | src);
+}
+
+CodeArena::~CodeArena() {
+    for (auto& chunk : chunks)
+        munmap(chunk.base, CHUNK_SIZE);
+}
+
+auto CodeArena::commit(const std::vector<uint8_t>& code) -> const void* {
+    if (code.size() > CHUNK_SIZE)
+        return nullptr;
+
+    if (chunks.empty() || chunks.back().used + code.size() > CHUNK_SIZE) {
+        void* base = mmap(nullptr, CHUNK_SIZE, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED)
+            return nullptr;
+        chunks.push_back({static_cast<uint8_t*>(base), 0});
+    }
+
+    // W^X: flip the chunk writable just long enough to append to it
+    auto& chunk = chunks.back();
+    if (mprotect(chunk.base, CHUNK_SIZE, PROT_READ | PROT_WRITE) != 0)
+        return nullptr;
+    uint8_t* at = chunk.base + chunk.used;
+    std::memcpy(at, code.data(), code.size());
+    chunk.used += (code.size() + 15) & ~size_t{15};
+    if (mprotect(chunk.base, CHUNK_SIZE, PROT_READ | PROT_EXEC) != 0)
+        return nullptr;
+
+    return at;
+}
+
+auto hostSupported() -> bool {
+#if defined(__x86_64__) && defined(__linux__)
+    return true;
+#else
+    return false;
+#endif
+}
+
+} // namespace x64
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Just enough of an x86-64 assembler for the JIT: every memory operand is
+ * [base + disp32], and only the instruction forms jit.h actually uses are
+ * here.
+ */
+namespace x64 {
+
+enum Reg : uint8_t {
+    rax,
+    rcx,
+    rdx,
+    rbx,
+    rsp,
+    rbp,
+    rsi,
+    rdi,
+    r8,
+    r9,
+    r10,
+    r11,
+    r12,
+    r13,
+    r14,
+    r15,
+};
+
+enum Xmm : uint8_t { xmm0, xmm1 };
+
+enum class Cond : uint8_t {
+    c = 0x2,
+    ae = 0x3,
+    e = 0x4,
+    ne = 0x5,
+    a = 0x7,
+    s = 0x8,
+};
+
+enum class AluOp : uint8_t {
+    Add = 0,
+    Or = 1,
+    And = 4,
+    Sub = 5,
+    Xor = 6,
+    Cmp = 7,
+};
+
+enum class ShiftOp : uint8_t { Shl = 4, Shr = 5, Sar = 7 };
+
+enum class PackedOp : uint8_t {
+    Add = 0x58,
+    Mul = 0x59,
+    Sub = 0x5c,
+    Div = 0x5e,
+};
+
+struct Mem {
+    Reg base;
+    int32_t disp;
+};
+
+class Assembler {
+  public:
+    Assembler() : buf{} {}
+
+    void push(Reg r);
+    void pop(Reg r);
+    void ret();
+    void call(Reg r);
+
+    void mov(Reg dst, Reg src);
+    void mov(Reg dst, Mem src);
+    void mov(Mem dst, Reg src);
+    void movImm64(Reg dst, uint64_t imm);
+    void movImm32(Reg dst, int32_t imm); // sign extended
+    void movByte(Mem dst, uint8_t imm);
+    void mov32(Reg dst, Mem src); // zero extended
+    void mov32(Mem dst, Reg src);
+
+    void alu(AluOp op, Reg dst, Reg src);
+    void alu(AluOp op, Reg dst, int32_t imm); // sign extended
+    void imul(Reg dst, Reg src);
+    void cmp(Reg lhs, Mem rhs);
+    void shift(ShiftOp op, Reg dst, uint8_t amount);
+    void shiftCl(ShiftOp op, Reg dst);
+    void not_(Reg dst);
+    void bt(Reg r, uint8_t bit);
+    void set(Cond cc, Mem dst);
+    void testAl();
+
+    /// returns the offset of the rel32 to hand to `bind` later
+    auto jcc(Cond cc) -> size_t;
+    /// same, unconditionally
+    auto jmp() -> size_t;
+    /// point a jcc/jmp emitted earlier at the current position
+    void bind(size_t rel32At);
+
+    void movups(Xmm dst, Mem src);
+    void movups(Mem dst, Xmm src);
+    void packed(PackedOp op, Xmm dst, Xmm src);
+
+    [[nodiscard]] auto bytes() const -> const std::vector<uint8_t>& {
+        return buf;
+    }
+
+  private:
+    void rex(bool w, uint8_t reg, uint8_t base);
+    void modrm(uint8_t reg, Mem m);
+    void modrm(uint8_t reg, Reg rm);
+    void imm32(uint32_t v);
+
+    std::vector<uint8_t> buf;
+};
+
+/**
+ * Executable memory for generated code. Code is never freed: a block that
+ * goes stale may still be on the stack when we find out, and self-modifying
+ * programs that churn through enough of it to matter are not something we
+ * run.
+ */
+class CodeArena {
+  public:
+    static constexpr size_t CHUNK_SIZE = 1 << 20;
+
+    CodeArena() = default;
+    ~CodeArena();
+
+    CodeArena(const CodeArena&) = delete;
+    CodeArena& operator=(const CodeArena&) = delete;
+
+    /// copy code in and make it executable, nullptr if the host won't let us
+    auto commit(const std::vector<uint8_t>& code) -> const void*;
+
+  private:
+    struct Chunk {
+        uint8_t* base;
+        size_t used;
+    };
+    std::vector<Chunk> chunks;
+};
+
+/// true if generated code can run on this host at all
+auto hostSupported() -> bool;
+
+} // namespace x64